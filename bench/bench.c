@@ -0,0 +1,309 @@
+/*
+ * File: bench.c
+ * Description: Throughput benchmark for the BMP filters
+ *
+ * Runs grayscale, reflect, levels, blur, convolve and edges on synthetic images of several
+ * sizes, on images of any exact shapes given with --shapes (e.g. the narrow
+ * widths that produce every row padding, or single rows) and on any BMP
+ * files given on the command line, and prints one
+ * tab-separated line per (image, filter) pair so the results of two builds
+ * can be compared with diff or a spreadsheet. Built and run by `make bench`.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bmpio.h"
+#include "convolve.h"
+#include "filters.h"
+#include "lut.h"
+#include "simd.h"
+
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Benchmark defaults */
+#define DEFAULT_RUNS     5         /* Timed runs of each filter */
+#define DEFAULT_SIZES    "1,12,100" /* Synthetic image sizes in megapixels */
+#define SYNTHETIC_SEED   12345u    /* Seed of the synthetic image contents */
+#define ASPECT_WIDTH     4         /* Synthetic images are 4:3 landscape */
+#define ASPECT_HEIGHT    3
+#define BENCH_KERNEL     "1,2,1;2,4,2;1,2,1" /* Kernel of the convolve filter (3x3 Gaussian) */
+#define MAX_SHAPE_SIDE   (1 << 24) /* Largest side of a --shapes image */
+
+/*
+ * Filters exercised by the benchmark
+ */
+static const struct {
+    const char *name;
+    char        flag;
+} bench_filters[] = {
+    { "grayscale", 'g' },
+    { "reflect", 'r' },
+    { "levels", 'l' },
+    { "blur", 'b' },
+    { "convolve", 'c' },
+    { "edges", 'e' },
+};
+
+/*
+ * Returns the current monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Fills an image with deterministic noise over a diagonal gradient, so blur
+ * and edges see both smooth areas and sharp transitions
+ */
+static void fill_synthetic(const IMAGE *image) {
+    uint32_t state = SYNTHETIC_SEED;
+
+    for (int i = 0; i < image->height; i++) {
+        RGBTRIPLE *row = (RGBTRIPLE *)image_row(image, i);
+        for (int j = 0; j < image->width; j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int base = (i + j) & 0xff;
+            row[j].rgbtBlue = base ^ (state & 0x3f);
+            row[j].rgbtGreen = (base + (state >> 8)) & 0xff;
+            row[j].rgbtRed = state & 0x80 ? ~base : base;
+        }
+    }
+}
+
+/*
+ * Loads the pixels of a BMP file into a freshly allocated image
+ *
+ * Returns:
+ *   Error code (SUCCESS if loaded, various ERR codes on failure)
+ */
+static int load_bmp(const char *path, IMAGE *image) {
+    FILE *inptr = fopen(path, "rb");
+    if (inptr == NULL) {
+        return ERR_ARGS;
+    }
+
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers(inptr, &bf, &bi);
+    if (result == SUCCESS) {
+        int width = bi.biWidth;
+        int height = bmp_height(&bi);
+        int channels = bmp_channels(&bi);
+        *image = image_view(NULL, (size_t)width * channels, channels, width, height);
+        image->data = malloc(image->stride * height);
+        result = image->data == NULL ? ERR_MEMORY : bmp_read_rows(inptr, image, 0, height);
+    }
+
+    fclose(inptr);
+    return result;
+}
+
+/*
+ * Benchmarks one filter on one image and prints its report line
+ *
+ * Parameters:
+ *   label  - Image name printed in the report
+ *   path   - BMP file to load, or NULL for a synthetic image
+ *   width  - Synthetic image width
+ *   height - Synthetic image height
+ *   filter - Index into bench_filters
+ *   runs   - Number of timed runs
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Runs in a child process so the reported peak RSS belongs to this
+ *   filter and image alone. The filter runs once untimed to fault in the
+ *   buffers, then `runs` times out of place from the same source image.
+ */
+static int bench_case(const char *label, const char *path, int width, int height, int filter, int runs) {
+    IMAGE src;
+    int result = SUCCESS;
+
+    if (path != NULL) {
+        result = load_bmp(path, &src);
+    } else {
+        src = image_view(NULL, width * sizeof(RGBTRIPLE), PIXEL_BGR, width, height);
+        src.data = malloc(src.stride * height);
+        if (src.data == NULL)
+            result = ERR_MEMORY;
+        else
+            fill_synthetic(&src);
+    }
+    if (result != SUCCESS) {
+        fprintf(stderr, "%s: %s\n", label, bmp_error_message(result));
+        return result;
+    }
+
+    IMAGE dst = src;
+    dst.data = malloc(src.stride * src.height);
+    if (dst.data == NULL) {
+        fprintf(stderr, "%s: %s\n", label, bmp_error_message(ERR_MEMORY));
+        return ERR_MEMORY;
+    }
+
+    int threads = thread_count_default();
+    THREAD_POOL *pool = threads > 1 ? thread_pool_create(threads) : NULL;
+    CONTEXT ctx;
+    context_init(&ctx, pool);
+
+    // The warm-up run also sizes the context's buffers
+    const char flag = bench_filters[filter].flag;
+    double best = 0, total = 0;
+    KERNEL kernel;
+    kernel_parse(BENCH_KERNEL, &kernel);
+    FILTER_PARAMS params = { .radius = 1, .kernel = &kernel };
+    lut_default_params(&params);
+    result = apply_filter(&ctx, flag, &params, 1, &src, &dst);
+    for (int run = 0; run < runs && result == SUCCESS; run++) {
+        double start = now_ns();
+        apply_filter(&ctx, flag, &params, 1, &src, &dst);
+        double elapsed = now_ns() - start;
+        total += elapsed;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    threads = thread_pool_size(pool);
+    context_free(&ctx);
+    thread_pool_destroy(pool);
+    if (result != SUCCESS) {
+        free(dst.data);
+        free(src.data);
+        fprintf(stderr, "%s: %s\n", label, bmp_error_message(result));
+        return result;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double pixels = (double)src.width * src.height;
+    printf("%s\t%d\t%d\t%s\t%d\t%s\t%d\t%.3f\t%.3f\t%.2f\t%.3f\t%ld\n",
+           label, src.width, src.height, bench_filters[filter].name, threads,
+           simd_name(), runs, best / 1e6, total / runs / 1e6, pixels / best * 1e3,
+           best / pixels, usage.ru_maxrss);
+    fflush(stdout);
+
+    free(dst.data);
+    free(src.data);
+    return SUCCESS;
+}
+
+/*
+ * Runs every filter on one image, each in its own child process
+ *
+ * Returns:
+ *   Error code (SUCCESS if all cases succeeded, the last failure otherwise)
+ */
+static int bench_image(const char *label, const char *path, int width, int height, int runs) {
+    int result = SUCCESS;
+
+    for (size_t k = 0; k < sizeof(bench_filters) / sizeof(bench_filters[0]); k++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            exit(bench_case(label, path, width, height, (int)k, runs));
+        }
+
+        int status;
+        if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+            fprintf(stderr, "%s: %s benchmark did not complete\n", label, bench_filters[k].name);
+            result = ERR_ARGS;
+        } else if (WEXITSTATUS(status) != SUCCESS) {
+            result = WEXITSTATUS(status);
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Benchmark entry point
+ *
+ * Usage: bench [-n RUNS] [--sizes MP,MP,...] [--shapes WxH,WxH,...] [image.bmp ...]
+ *
+ * Returns:
+ *   SUCCESS, or the error code of the last failed case
+ */
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    const char *sizes = DEFAULT_SIZES;
+    const char *shapes = "";
+    int first_file = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = argv[++i];
+        } else if (strcmp(argv[i], "--shapes") == 0 && i + 1 < argc) {
+            shapes = argv[++i];
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+
+    if (runs < 1) {
+        printf("Usage: %s [-n RUNS] [--sizes MP,MP,...] [--shapes WxH,WxH,...] [image.bmp ...]\n", argv[0]);
+        return ERR_ARGS;
+    }
+
+    printf("# image\twidth\theight\tfilter\tthreads\tsimd\truns\tbest_ms\tmean_ms\tmp_per_s\tns_per_px\tpeak_rss_kb\n");
+    fflush(stdout);
+
+    int result = SUCCESS;
+    for (const char *size = sizes; *size != '\0';) {
+        char *end;
+        long megapixels = strtol(size, &end, 10);
+        if (end == size || megapixels < 1) {
+            printf("Invalid size list: %s\n", sizes);
+            return ERR_ARGS;
+        }
+
+        // Largest 4:3 image with at most the requested number of pixels
+        int unit = (int)sqrt(megapixels * 1e6 / (ASPECT_WIDTH * ASPECT_HEIGHT));
+        char label[32];
+        snprintf(label, sizeof(label), "synthetic-%ldmp", megapixels);
+        int status = bench_image(label, NULL, unit * ASPECT_WIDTH, unit * ASPECT_HEIGHT, runs);
+        if (status != SUCCESS)
+            result = status;
+
+        size = *end == ',' ? end + 1 : end;
+    }
+
+    for (const char *shape = shapes; *shape != '\0';) {
+        char *end;
+        long width = strtol(shape, &end, 10);
+        long height = *end == 'x' ? strtol(end + 1, &end, 10) : 0;
+        if (width < 1 || width > MAX_SHAPE_SIDE || height < 1 || height > MAX_SHAPE_SIDE ||
+            (*end != ',' && *end != '\0')) {
+            printf("Invalid shape list: %s\n", shapes);
+            return ERR_ARGS;
+        }
+
+        char label[48];
+        snprintf(label, sizeof(label), "synthetic-%ldx%ld", width, height);
+        int status = bench_image(label, NULL, (int)width, (int)height, runs);
+        if (status != SUCCESS)
+            result = status;
+
+        shape = *end == ',' ? end + 1 : end;
+    }
+
+    for (int i = first_file; i < argc; i++) {
+        int status = bench_image(argv[i], argv[i], 0, 0, runs);
+        if (status != SUCCESS)
+            result = status;
+    }
+
+    return result;
+}
@@ -0,0 +1,40 @@
+/*
+ * analyze.h
+ * Per-channel histograms and statistics of images (--analyze)
+ */
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stdio.h>
+
+#include "filters.h"
+
+/* Analysis constants */
+#define ANALYSIS_BINS        256    /* One bin per channel value */
+#define ANALYSIS_COPIES      2      /* Interleaved bin sets per band, so equal neighbours do not stall */
+
+/*
+ * Statistics gathered over the rows of an image
+ * Only the histograms are accumulated; counts, minima, maxima and means
+ * all follow from them. Rows may be added in any order and in any number
+ * of calls.
+ */
+typedef struct {
+    int      channels;                              /* Channels per pixel (PIXEL_BGR or PIXEL_BGRA) */
+    uint64_t pixels;                                /* Pixels counted */
+    uint64_t histogram[PIXEL_BGRA][ANALYSIS_BINS];  /* Count of each value of each channel */
+} ANALYSIS;
+
+/*
+ * Function prototypes
+ * analysis_report() writes one JSON object: the image size, the mean
+ * luminance (the mean of 0.299R + 0.587G + 0.114B, the luminance edges()
+ * works on, before rounding) and the minimum, maximum, mean and histogram
+ * of each channel.
+ */
+void analysis_init(ANALYSIS *analysis, int channels);
+int analysis_rows(CONTEXT *ctx, ANALYSIS *analysis, const IMAGE *image, int begin, int end);
+void analysis_report(FILE *out, const ANALYSIS *analysis, const char *name, int width, int height);
+
+#endif /* ANALYZE_H */
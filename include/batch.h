@@ -0,0 +1,41 @@
+/*
+ * batch.h
+ * Batch mode: filters many files in one invocation on a worker pool
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "pipeline.h"
+
+/* Batch mode constants */
+#define BATCH_LIST_STDIN     "-"        /* List name that reads entries from stdin */
+#define BATCH_EXTENSION      ".bmp"     /* Files picked up by --batch-dir */
+
+/*
+ * One file of a batch
+ */
+typedef struct {
+    PIPELINE  pipeline;     /* Filters to apply */
+    char     *infile;       /* Input filename */
+    char     *outfile;      /* Output filename */
+    int       result;       /* ERR_* code once processed */
+} BATCH_ENTRY;
+
+/*
+ * Growable list of batch entries, kept in input order
+ */
+typedef struct {
+    BATCH_ENTRY *entries;   /* Entry array */
+    int          count;     /* Number of entries in use */
+    int          capacity;  /* Number of entries allocated */
+} BATCH;
+
+/* Function prototypes */
+int batch_load_list(BATCH *batch, const char *list, const PIPELINE *pipeline);
+int batch_load_dir(BATCH *batch, const PIPELINE *pipeline, const char *indir, const char *outdir);
+int batch_run(BATCH *batch, const FILTER_PARAMS *params, THREAD_POOL *pool);
+void batch_report(const BATCH *batch, FILE *out);
+void batch_free(BATCH *batch);
+
+#endif /* BATCH_H */
@@ -0,0 +1,85 @@
+/*
+ * bmpfilter.h
+ * Public interface of libbmpfilter: decoding, filtering and encoding BMP
+ * images held in memory
+ *
+ * This header is self-contained: the library's own types stay internal and
+ * are only reached through the opaque handles and functions below.
+ */
+
+#ifndef BMPFILTER_H
+#define BMPFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Functions of this interface are the only symbols the library exports */
+#if defined(__GNUC__)
+#define BMP_API __attribute__((visibility("default")))
+#else
+#define BMP_API
+#endif
+
+/* Result codes, shared with the exit codes of the command line tool */
+#define BMP_SUCCESS          0      /* Operation completed successfully */
+#define BMP_ERR_ARGS         1      /* Invalid argument, chain, parameter or kernel */
+#define BMP_ERR_HEADER_READ  3      /* Data shorter than the BMP headers */
+#define BMP_ERR_FORMAT       4      /* Unsupported BMP format */
+#define BMP_ERR_MEMORY       5      /* Memory allocation failure */
+#define BMP_ERR_IMAGE_READ   6      /* Data shorter than the pixel rows */
+#define BMP_ERR_WRITE_DATA   10     /* Output buffer too small */
+
+/* Defaults of encoded headers */
+#define BMP_PIXELS_PER_METER 2835   /* 72 DPI, written for images not decoded from a file */
+
+/* Thread pool and scratch memory reused by every call given it */
+typedef struct BMP_CONTEXT BMP_CONTEXT;
+
+/* Image: BGR or BGRA pixels, with the orientation and resolution of the
+ * file it was decoded from, or a view of rows in caller memory */
+typedef struct BMP_IMAGE BMP_IMAGE;
+
+/*
+ * Parameters of the filters, set to their defaults by bmp_default_options()
+ * The ranges are those of the command line options of the same names.
+ */
+typedef struct {
+    int         radius;      /* Blur radius of blur stages */
+    int         threshold;   /* Cut-off of threshold stages (1-255) */
+    int         brightness;  /* Offset added by levels stages (-255 to 255) */
+    int         contrast;    /* Contrast of levels stages, in percent */
+    double      gamma;       /* Gamma of levels stages */
+    const char *kernel;      /* Taps of convolve stages in --kernel syntax, e.g. "1,2,1;2,4,2;1,2,1/16", or NULL */
+    const char *border;      /* Border mode of convolve stages: "clamp", "zero" or "skip" (NULL for clamp) */
+} BMP_OPTIONS;
+
+/*
+ * Function prototypes
+ * A context is used by one thread at a time; threads that each use their
+ * own context may filter concurrently. Rows of an image are numbered from
+ * the top of the picture, whatever the row order of its file, and hold
+ * width * channels bytes (3 for BGR, 4 for BGRA). bmp_image_wrap() views
+ * rows of any stride in caller memory, which bmp_apply() then filters in
+ * place. Functions returning an int return BMP_SUCCESS or one of the
+ * BMP_ERR codes; bmp_error_message() describes them.
+ */
+BMP_API BMP_CONTEXT *bmp_context_create(int threads);
+BMP_API void bmp_context_destroy(BMP_CONTEXT *ctx);
+
+BMP_API int bmp_info_mem(const uint8_t *data, size_t size, int *width, int *height, int *channels);
+BMP_API int bmp_decode_mem(const uint8_t *data, size_t size, BMP_IMAGE **image);
+BMP_API BMP_IMAGE *bmp_image_create(int width, int height, int channels);
+BMP_API BMP_IMAGE *bmp_image_wrap(uint8_t *data, size_t stride, int width, int height, int channels);
+BMP_API void bmp_image_destroy(BMP_IMAGE *image);
+BMP_API int bmp_image_width(const BMP_IMAGE *image);
+BMP_API int bmp_image_height(const BMP_IMAGE *image);
+BMP_API int bmp_image_channels(const BMP_IMAGE *image);
+BMP_API uint8_t *bmp_image_row(BMP_IMAGE *image, int row);
+BMP_API size_t bmp_image_encoded_size(const BMP_IMAGE *image);
+BMP_API int bmp_encode_mem(const BMP_IMAGE *image, uint8_t *data, size_t size);
+
+BMP_API void bmp_default_options(BMP_OPTIONS *options);
+BMP_API int bmp_apply(BMP_CONTEXT *ctx, const char *filters, const BMP_OPTIONS *options, BMP_IMAGE *image);
+BMP_API const char *bmp_error_message(int code);
+
+#endif /* BMPFILTER_H */
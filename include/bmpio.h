@@ -0,0 +1,48 @@
+/*
+ * bmpio.h
+ * BMP header validation, row I/O and error codes shared by all drivers
+ */
+
+#ifndef BMPIO_H
+#define BMPIO_H
+
+#include "filters.h"
+
+/* Error Codes */
+#define SUCCESS 0             /* Operation completed successfully */
+#define ERR_ARGS 1           /* Invalid command line arguments */
+#define ERR_OUTPUT_FILE 2    /* Failed to create output file */
+#define ERR_HEADER_READ 3    /* Failed to read BMP headers */
+#define ERR_FORMAT 4         /* Unsupported BMP format */
+#define ERR_MEMORY 5         /* Memory allocation failure */
+#define ERR_IMAGE_READ 6     /* Failed to read image data */
+#define ERR_SEEK 7          /* Failed to seek within file */
+#define ERR_WRITE_HEADER 8  /* Failed to write BMP header */
+#define ERR_WRITE_INFO 9    /* Failed to write BMP info */
+#define ERR_WRITE_DATA 10   /* Failed to write image data */
+#define ERR_WRITE_PADDING 11 /* Failed to write padding bytes */
+#define ERR_MAP 12          /* Failed to memory-map a file */
+#define ERR_BATCH 13        /* One or more batch entries failed */
+#define ERR_SOCKET 14       /* Failed to set up the server socket */
+
+/* Row I/O */
+#define IO_BLOCK_BYTES (1 << 20) /* Largest block of rows read or written in one call */
+
+/* Function prototypes */
+int bmp_padding(int width, int channels);
+size_t bmp_stride(int width, int channels);
+size_t bmp_encoded_size(int width, int height, int channels);
+int bmp_channels(const BITMAPINFOHEADER *bi);
+int bmp_height(const BITMAPINFOHEADER *bi);
+int bmp_check_headers(const BITMAPFILEHEADER *bf, const BITMAPINFOHEADER *bi);
+int bmp_read_headers(FILE *inptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi);
+int bmp_read_headers_mem(const BYTE *data, size_t size, BITMAPINFOHEADER *bi);
+int bmp_read_rows(FILE *inptr, const IMAGE *image, int begin, int end);
+void bmp_set_size(BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, int width, int height);
+int bmp_write_headers(FILE *outptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi);
+int bmp_write_rows(FILE *outptr, const IMAGE *image, int begin, int end, int mirror);
+int bmp_write_image(FILE *outptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, const IMAGE *image,
+                    int mirror);
+const char *bmp_error_message(int code);
+
+#endif /* BMPIO_H */
@@ -0,0 +1,49 @@
+/*
+ * cache.h
+ * On-disk cache of filtered images, keyed by a hash of the input file and
+ * of the filters applied to it
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "pipeline.h"
+
+#include <limits.h>
+
+/* Cache constants */
+#define CACHE_DEFAULT_MB     1024       /* Size bound used when --cache-size is not given */
+#define CACHE_MAX_MB         (1 << 20)  /* Largest accepted --cache-size */
+#define CACHE_VERSION        1          /* Changes whenever a filter's output changes */
+#define CACHE_EXTENSION      ".bmp"     /* Suffix of cached files */
+#define CACHE_NAME_BYTES     64         /* Room for a cached file's name within its directory */
+#define CACHE_MAX_DIR        (PATH_MAX - CACHE_NAME_BYTES - 1) /* Longest directory whose entry paths fit in PATH_MAX */
+#define CACHE_MISS           (-1)       /* cache_fetch() result when no usable entry exists, unlike any ERR code */
+
+/*
+ * Cache directory and its size bound
+ * Each entry is a file named after its key, holding the output that was
+ * written for it. The least recently used entries are removed whenever a
+ * new entry takes the directory above `limit` bytes; a hit marks its entry
+ * as used. Any number of processes may share a directory.
+ */
+typedef struct {
+    const char *dir;         /* Directory holding the entries */
+    uint64_t    limit;       /* Most bytes of entries kept */
+} CACHE;
+
+/*
+ * Function prototypes
+ * cache_key() hashes an encoded input file together with the filters and
+ * their parameters. cache_fetch() copies the entry of a key, which must be
+ * `size` bytes long, to a stream and returns SUCCESS, or returns CACHE_MISS
+ * when there is no usable entry; its ERR codes are failures of the stream.
+ * cache_store() adds an entry. Failures of the cache itself are not
+ * reported and leave it as a miss would.
+ */
+uint64_t cache_hash(const void *data, size_t size, uint64_t seed);
+uint64_t cache_key(const BYTE *file, size_t size, const PIPELINE *pipeline, const FILTER_PARAMS *params);
+int cache_fetch(const CACHE *cache, uint64_t key, size_t size, FILE *out);
+void cache_store(const CACHE *cache, uint64_t key, const BYTE *data, size_t size);
+
+#endif /* CACHE_H */
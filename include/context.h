@@ -0,0 +1,57 @@
+/*
+ * context.h
+ * Processing context: the thread pool and the reusable scratch buffers
+ * shared by every filter applied by one driver
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "threadpool.h"
+
+/* Context buffer constants */
+#define CONTEXT_ALIGNMENT    64     /* Alignment of every buffer in bytes (one cache line) */
+
+/*
+ * Scratch buffer that only grows
+ */
+typedef struct {
+    uint8_t *data;           /* Buffer memory, NULL until first needed */
+    size_t   capacity;       /* Bytes allocated */
+} BUFFER;
+
+/*
+ * Processing context
+ * Created once by a driver and passed to every filter, so that repeated
+ * filter calls, the stages of a chain and the files of a batch reuse the
+ * same memory instead of allocating their own. A context is used by one
+ * caller at a time; its filters may run on the pool's threads.
+ */
+typedef struct {
+    THREAD_POOL *pool;       /* Pool filter passes are split across (NULL runs serially) */
+    BUFFER       image;      /* Ping-pong partner of the destination image of a chain */
+    BUFFER       planes;     /* Two planar images for planar chains */
+    BUFFER       temp;       /* Staging image of a blur filtering in place */
+    BUFFER       halo;       /* Neighbour rows snapshot of an edges pass in place */
+    BUFFER       integral;   /* Summed-area tables of a large-radius blur */
+    BUFFER      *work;       /* Per-tile working memory, one buffer per pool thread */
+    int          workers;    /* Number of work buffers */
+} CONTEXT;
+
+/* Function prototypes */
+void context_init(CONTEXT *ctx, THREAD_POOL *pool);
+void context_free(CONTEXT *ctx);
+uint8_t *context_buffer(BUFFER *buffer, size_t size);
+int context_reserve_work(CONTEXT *ctx, size_t size);
+
+/*
+ * Returns the work buffer of a worker, reserved by context_reserve_work()
+ */
+static inline uint8_t *context_work(const CONTEXT *ctx, int worker) {
+    return ctx->work[worker].data;
+}
+
+#endif /* CONTEXT_H */
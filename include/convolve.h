@@ -0,0 +1,75 @@
+/*
+ * convolve.h
+ * Convolution of packed images with integer or fixed-point kernels
+ */
+
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include "filters.h"
+
+/* Kernel limits */
+#define MAX_KERNEL_SIZE      (2 * MAX_BLUR_RADIUS + 1) /* Longest side of a separable kernel (a blur window) */
+#define MAX_KERNEL_TAPS      1024   /* Most taps of a kernel given as text (e.g. 31 x 33) */
+#define MAX_KERNEL_WEIGHT    (1 << 23) /* Bound on the sum of |taps|, keeping sums of bytes in 32 bits */
+#define MAX_KERNEL_DECIMALS  4      /* Most fractional digits of a fixed-point tap */
+#define MAX_KERNEL_FILE      65536  /* Largest accepted kernel file in bytes */
+
+/*
+ * Handling of the taps of a kernel that fall outside the image
+ */
+typedef enum {
+    BORDER_ZERO,            /* Outside pixels are black */
+    BORDER_CLAMP,           /* Outside pixels repeat the nearest edge pixel */
+    BORDER_SKIP             /* Outside taps are dropped and the rest renormalised */
+} BORDER_MODE;
+
+/*
+ * Convolution kernel
+ * Each colour channel of an output pixel becomes the sum of the taps times
+ * the pixels under them, divided by `divisor`, rounded and clamped to a
+ * byte; alpha is kept. The kernel is centred on the pixel, so its sides are
+ * odd. Separable kernels, whose taps are column[i] * row[j], only store
+ * their two factors and run as a vertical and a horizontal pass; the others
+ * store width * height taps, row by row. With BORDER_SKIP, a pixel whose
+ * window is clipped by the image divides by divisor times the fraction of
+ * the total weight that is in bounds, so a normalised kernel averages the
+ * in-bounds pixels; kernels whose weights do not sum to a positive value
+ * treat outside pixels as black instead.
+ */
+struct KERNEL {
+    int         width;                    /* Columns (odd) */
+    int         height;                   /* Rows (odd) */
+    int         divisor;                  /* Positive divisor of the sums */
+    BORDER_MODE border;                   /* Handling of taps outside the image */
+    int         separable;                /* Non-zero if row and column hold the taps */
+    int         row[MAX_KERNEL_SIZE];     /* Horizontal factor of a separable kernel */
+    int         column[MAX_KERNEL_SIZE];  /* Vertical factor of a separable kernel */
+    int         taps[MAX_KERNEL_TAPS];    /* Row-major taps of other kernels */
+};
+
+/*
+ * Returns tap (i, j) of a kernel, row i and column j
+ */
+static inline int kernel_tap(const KERNEL *kernel, int i, int j) {
+    return kernel->separable ? kernel->column[i] * kernel->row[j] : kernel->taps[i * kernel->width + j];
+}
+
+/*
+ * Function prototypes
+ * kernel_parse() reads rows of taps separated by ';' or newlines, taps
+ * separated by ',' or blanks, with an optional "/divisor" after the last
+ * tap and '#' comments; kernel_load() reads the same syntax from a file.
+ * convolve_span() is the unchecked interior loop shared with the filters
+ * built on the engine.
+ */
+int kernel_parse(const char *text, KERNEL *kernel);
+int kernel_load(const char *path, KERNEL *kernel);
+int kernel_border(const char *name, BORDER_MODE *border);
+void kernel_box(KERNEL *kernel, int radius);
+void convolve_span(const KERNEL *kernel, const BYTE *const *rows, int step, int count, int32_t *out,
+                   int32_t *work);
+size_t convolve_span_work(const KERNEL *kernel, int step, int count);
+int convolve(CONTEXT *ctx, const KERNEL *kernel, int bottom_up, const IMAGE *src, const IMAGE *dst);
+
+#endif /* CONVOLVE_H */
@@ -11,11 +11,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "context.h"
+
 /* Bitmap file constants */
 #define BITMAP_HEADER_SIZE    54
 #define BITMAP_TYPE          0x4d42
 #define BITMAP_COMPRESSION   0
 
+/* Pixel formats, in bytes per pixel */
+#define PIXEL_BGR            3      /* 24-bit blue, green, red */
+#define PIXEL_BGRA           4      /* 32-bit blue, green, red, alpha */
+
+/* Byte offsets of the channels within a pixel */
+#define CHANNEL_BLUE         0
+#define CHANNEL_GREEN        1
+#define CHANNEL_RED          2
+#define CHANNEL_ALPHA        3      /* PIXEL_BGRA only */
+
+/* Constants for image processing */
+#define AVG_DIVISOR 3.0f     /* Floating point divisor for grayscale average calculation */
+#define LUMA_RED    0.299f   /* Weights of the channels in the luminance edges() works on */
+#define LUMA_GREEN  0.587f
+#define LUMA_BLUE   0.114f
+
+/* Filter parameter limits */
+#define DEFAULT_BLUR_RADIUS  1      /* Blur radius used when none is given */
+#define MAX_BLUR_RADIUS      1000   /* Keeps box blur window sums within 32 bits */
+#define MAX_CONTRAST         1000   /* Largest contrast in percent */
+#define MIN_GAMMA            0.1    /* Smallest gamma */
+#define MAX_GAMMA            10.0   /* Largest gamma */
+
+/*
+ * Kernel specialisation
+ * Filter loops are written once as templates and instantiated for every
+ * pixel format X(name, channels) of PIXEL_FORMATS, and blur loops for every
+ * radius X(..., radius) of BLUR_RADII, with the pixel size and radius as
+ * compile-time constants. Other radii run the generic blur kernel.
+ */
+#define PIXEL_FORMATS(X)      X(bgr, PIXEL_BGR) X(bgra, PIXEL_BGRA)
+#define BLUR_RADII(X, ...)    X(__VA_ARGS__, 1) X(__VA_ARGS__, 2) X(__VA_ARGS__, 3)
+#define MAX_FIXED_RADIUS     3      /* Largest radius of BLUR_RADII */
+#define KERNEL_TEMPLATE      static inline __attribute__((always_inline))
+
+/* Convolution kernel, defined in convolve.h */
+typedef struct KERNEL KERNEL;
+
 /* Type definitions for bitmap structures */
 typedef uint8_t  BYTE;
 typedef uint32_t DWORD;
@@ -62,10 +102,117 @@ typedef struct {
     BYTE  rgbtRed;          /* Red component */
 } __attribute__((__packed__)) RGBTRIPLE;
 
-/* Function prototypes */
-void grayscale(int height, int width, RGBTRIPLE image[height][width]);
-void reflect(int height, int width, RGBTRIPLE image[height][width]);
-void edges(int height, int width, RGBTRIPLE image[height][width]);
-void blur(int height, int width, RGBTRIPLE image[height][width]);
+/*
+ * Image view
+ * Describes rows of 3-byte BGR or 4-byte BGRA pixels that need not be
+ * contiguous: row i starts i * stride bytes after data. A stride wider than
+ * width pixels lets filters work in place on padded BMP rows, e.g. straight
+ * from a mapping. Rows are in file order, bottom-up unless the header
+ * height is negative. Every filter but convolve is symmetric under a
+ * vertical flip; convolve() is told the orientation, so that kernel row 0
+ * always lies over the top of the window. Filters only change the
+ * colour channels of BGRA pixels: alpha moves with its pixel.
+ *
+ * A view may also hold only a window of a taller image: height is always the
+ * full image height (so filters handle the image borders correctly), while
+ * filters only write rows [first_row, first_row + rows) of their destination.
+ * When ring is non-zero the view is a ring buffer of `ring` rows and image
+ * row i is stored in slot i % ring.
+ */
+typedef struct {
+    BYTE   *data;            /* First byte of row 0 (or of ring slot 0) */
+    size_t  stride;          /* Bytes between the starts of consecutive rows */
+    int     channels;        /* Bytes per pixel (PIXEL_BGR or PIXEL_BGRA) */
+    int     width;           /* Image width in pixels */
+    int     height;          /* Full image height in pixels */
+    int     first_row;       /* First row a filter writes to this view */
+    int     rows;            /* Number of rows a filter writes to this view */
+    int     ring;            /* Ring buffer size in rows (0 for a plain view) */
+} IMAGE;
+
+/*
+ * Parameters of the filters that take any
+ */
+typedef struct {
+    int           radius;     /* Blur radius for 'b' (1 to MAX_BLUR_RADIUS) */
+    const KERNEL *kernel;     /* Kernel for 'c', or NULL if none was given */
+    int           threshold;  /* Lowest channel value 't' turns white (1 to 255) */
+    int           brightness; /* Offset 'l' adds to every channel (-255 to 255) */
+    int           contrast;   /* Contrast 'l' scales channels by, in percent (0 to MAX_CONTRAST) */
+    double        gamma;      /* Gamma 'l' applies first (MIN_GAMMA to MAX_GAMMA, 1 leaves values) */
+} FILTER_PARAMS;
+
+/*
+ * Returns a plain view covering a whole image
+ */
+static inline IMAGE image_view(BYTE *data, size_t stride, int channels, int width, int height) {
+    IMAGE image = { data, stride, channels, width, height, 0, height, 0 };
+    return image;
+}
+
+/*
+ * Returns a pointer to the first pixel of a row of an image view
+ */
+static inline BYTE *image_row(const IMAGE *image, int row) {
+    size_t slot = image->ring ? (size_t)(row % image->ring) : (size_t)row;
+    return image->data + slot * image->stride;
+}
+
+/*
+ * Returns the number of pixel bytes in a row of an image view
+ */
+static inline size_t image_row_bytes(const IMAGE *image) {
+    return (size_t)image->width * image->channels;
+}
+
+/*
+ * Rounds a non-negative float to the nearest integer, halves away from zero
+ * Matches round() exactly for values below 2^23, since the fraction q - t is
+ * then exact, but compiles to plain conversions that vectorise.
+ */
+static inline int round_positive(float q) {
+    int t = (int)q;
+    return t + (q - t >= 0.5f);
+}
+
+/*
+ * Returns the average of a box window sum of `count` pixels, rounded half up
+ * The division is exact in integers: window sums of up to MAX_BLUR_RADIUS
+ * stay below 2^30, so 2 * sum + count fits in 32 bits.
+ */
+static inline BYTE box_mean(uint32_t sum, uint32_t count) {
+    return (2 * sum + count) / (2 * count);
+}
+
+/*
+ * Computes the grayscale value of a pixel (rounded average of its channels)
+ */
+static inline uint8_t gray_of(int red, int green, int blue) {
+    float avg = (red + green + blue) / AVG_DIVISOR;
+    return round(avg);
+}
+
+/*
+ * Function prototypes
+ * Every filter reads src and writes rows [first_row, first_row + rows) of
+ * dst, which must have the same size; passing the same view twice filters
+ * in place. A source window must hold the written rows plus the number of
+ * rows above and below them reported by filter_context(). Filters run on
+ * the pool of the context and take their working memory from it; those
+ * that need any return ERR_MEMORY when it cannot be allocated.
+ */
+void grayscale(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+void reflect(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+void reflect_grayscale(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+void reflect_row(const BYTE *in, BYTE *out, int width, int channels);
+void copy_image(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+int edges(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+int blur(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst);
+int blur_radius(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst, int radius);
+int box_blur(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst, int radius);
+int filter_context(char flag, const FILTER_PARAMS *params);
+char filter_flag(const char *arg);
+int apply_filter(CONTEXT *ctx, char flag, const FILTER_PARAMS *params, int bottom_up, const IMAGE *src,
+                 const IMAGE *dst);
 
 #endif /* FILTERS_H */
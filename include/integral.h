@@ -0,0 +1,62 @@
+/*
+ * integral.h
+ * Summed-area tables (integral images) of planar images, which give the
+ * sum of any rectangle of a plane in four lookups
+ */
+
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "context.h"
+#include "planar.h"
+
+/* Integral image selection */
+#define INTEGRAL_MIN_RADIUS  (MAX_FIXED_RADIUS + 1) /* Planar blurs without an unrolled kernel use tables */
+
+/*
+ * Summed-area tables of the planes of an image
+ * Entry (y, x) of a table holds the sum of the plane's pixels above and to
+ * the left of it, rows [0, y) and columns [0, x), so each table has
+ * height + 1 rows of width + 1 entries. The sums wrap modulo 2^32 on large
+ * images, but a rectangle's sum is the difference of four entries, which
+ * is exact whenever the rectangle itself sums below 2^32: any window a
+ * blur of up to MAX_BLUR_RADIUS can ask for.
+ */
+typedef struct {
+    uint32_t *table[3];      /* Table of each plane (table[0] only for a gray image) */
+    size_t    stride;        /* Entries between the starts of consecutive rows */
+    int       width;         /* Image width in pixels */
+    int       height;        /* Image height in pixels */
+    int       planes;        /* Number of tables */
+} INTEGRAL;
+
+/*
+ * Returns a pointer to row y of the table of a plane
+ */
+static inline const uint32_t *integral_row(const INTEGRAL *integral, int plane, int y) {
+    return integral->table[plane] + (size_t)y * integral->stride;
+}
+
+/*
+ * Returns the sum of columns [x0, x1) of rows [y0, y1) of a plane
+ */
+static inline uint32_t integral_sum(const INTEGRAL *integral, int plane, int x0, int y0, int x1, int y1) {
+    const uint32_t *top = integral_row(integral, plane, y0);
+    const uint32_t *bottom = integral_row(integral, plane, y1);
+    return bottom[x1] - bottom[x0] - top[x1] + top[x0];
+}
+
+/*
+ * Function prototypes
+ * integral_build() fills tables laid out by integral_bind() in a block of
+ * integral_size() bytes, splitting the work across the pool of the context.
+ */
+size_t integral_size(int width, int height, int planes);
+void integral_bind(INTEGRAL *integral, uint8_t *memory, int width, int height, int planes);
+void integral_build(CONTEXT *ctx, const PLANAR *src, INTEGRAL *dst);
+int integral_box_mean(CONTEXT *ctx, const INTEGRAL *src, PLANAR *dst, int radius);
+
+#endif /* INTEGRAL_H */
@@ -0,0 +1,59 @@
+/*
+ * lut.h
+ * Lookup-table engine for point operations (grayscale, invert, threshold,
+ * levels)
+ */
+
+#ifndef LUT_H
+#define LUT_H
+
+#include "filters.h"
+
+/* Table sizes */
+#define LUT_SIZE             256            /* One entry per channel value */
+#define LUT_SUM_SIZE         (3 * 255 + 1)  /* One entry per sum of three channel values */
+
+/* Default point operation parameters */
+#define DEFAULT_THRESHOLD    128    /* Threshold used when --threshold is not given */
+#define DEFAULT_BRIGHTNESS   0      /* Brightness offset used when --brightness is not given */
+#define DEFAULT_CONTRAST     100    /* Contrast in percent used when --contrast is not given */
+#define DEFAULT_GAMMA        1.0    /* Gamma used when --gamma is not given */
+
+/*
+ * Chain of point operations compiled into tables
+ * Without gray, each colour channel c of a pixel becomes map[c][value].
+ * With gray, the channels are merged: every channel becomes
+ * mix[map[0][blue] + map[1][green] + map[2][red]], where map holds the
+ * operations before the first grayscale and mix the grayscale itself
+ * followed by every later operation. Alpha is kept either way.
+ */
+typedef struct {
+    int  gray;                     /* Non-zero once the chain contains a grayscale */
+    BYTE map[3][LUT_SIZE];         /* Per-channel table (the contribution to the sum with gray) */
+    BYTE mix[LUT_SUM_SIZE];        /* Gray only: output value of each sum of contributions */
+} LUT;
+
+/*
+ * What a compiled chain amounts to
+ */
+typedef enum {
+    LUT_IDENTITY,           /* Leaves every pixel as it is */
+    LUT_GRAYSCALE,          /* Same as grayscale(), which has vectorised kernels */
+    LUT_TABLES              /* Anything else; needs a table pass */
+} LUT_KIND;
+
+/*
+ * Function prototypes
+ * lut_add() appends the point filter `flag` ('g', 'i', 't' or 'l') to a
+ * chain and returns non-zero, or returns 0 for any other filter.
+ * lut_apply() runs a compiled chain over an image in one pass, and mirrors
+ * the rows in the same pass when `mirror` is set.
+ */
+void lut_default_params(FILTER_PARAMS *params);
+int lut_filter(char flag);
+void lut_init(LUT *lut);
+int lut_add(LUT *lut, char flag, const FILTER_PARAMS *params);
+LUT_KIND lut_kind(const LUT *lut);
+void lut_apply(CONTEXT *ctx, const LUT *lut, int mirror, const IMAGE *src, const IMAGE *dst);
+
+#endif /* LUT_H */
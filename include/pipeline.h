@@ -0,0 +1,31 @@
+/*
+ * pipeline.h
+ * Chains of filters applied to one image without intermediate files
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "filters.h"
+
+/* Pipeline limits */
+#define MAX_STAGES           16     /* Longest accepted filter chain */
+#define PIPELINE_SEPARATOR   ','    /* Separates the stages of a chain */
+
+/*
+ * Filter chain, applied left to right
+ */
+typedef struct {
+    char flags[MAX_STAGES]; /* Filter type flag of each stage */
+    int  stages;            /* Number of stages */
+} PIPELINE;
+
+/* Function prototypes */
+int pipeline_parse(const char *spec, PIPELINE *pipeline);
+const char *pipeline_stage_name(char flag);
+int pipeline_find_context(const PIPELINE *pipeline, int from, const FILTER_PARAMS *params);
+int pipeline_defer_mirror(const PIPELINE *pipeline, PIPELINE *rest);
+int pipeline_apply(CONTEXT *ctx, const PIPELINE *pipeline, int first, int last, const FILTER_PARAMS *params,
+                   int bottom_up, const IMAGE *src, const IMAGE *dst);
+
+#endif /* PIPELINE_H */
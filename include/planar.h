@@ -0,0 +1,65 @@
+/*
+ * planar.h
+ * Planar (structure of arrays) image layout used internally by the filters
+ */
+
+#ifndef PLANAR_H
+#define PLANAR_H
+
+#include "filters.h"
+#include "lut.h"
+
+/* Planar layout constants */
+#define PLANE_ALIGNMENT      64     /* Row and plane alignment in bytes (one cache line) */
+
+/*
+ * Pixel layouts a filter can work on
+ */
+typedef enum {
+    LAYOUT_PACKED,          /* Interleaved BGR or BGRA rows, as stored in the file */
+    LAYOUT_PLANAR           /* Separate 8-bit planes per channel */
+} PIXEL_LAYOUT;
+
+/*
+ * Planar image
+ * Each channel is a plane of height rows of `stride` bytes; every row starts
+ * on a PLANE_ALIGNMENT boundary. A gray image, whose three channels are
+ * equal, is stored once in plane[0] with planes == 1. The alpha of a BGRA
+ * image is a separate plane that the ping-pong images of a chain share:
+ * only reflections change it, always in place.
+ */
+typedef struct {
+    BYTE   *plane[3];        /* Blue, green and red planes (plane[0] only when gray) */
+    BYTE   *alpha;           /* Alpha plane, or NULL for a BGR image */
+    size_t  stride;          /* Bytes between the starts of consecutive rows */
+    int     width;           /* Image width in pixels */
+    int     height;          /* Image height in pixels */
+    int     planes;          /* 3 for blue/green/red planes, 1 for a gray plane */
+} PLANAR;
+
+/*
+ * Returns a pointer to the first byte of a row of a plane
+ */
+static inline BYTE *plane_row(const PLANAR *image, int plane, int row) {
+    return image->plane[plane] + (size_t)row * image->stride;
+}
+
+/*
+ * Function prototypes
+ * planar_bind() lays out a planar image of up to three planes in a block of
+ * planar_size() bytes aligned to PLANE_ALIGNMENT, without an alpha plane. The kernels follow the
+ * conventions of filters.h: they read src and write dst, which may be the
+ * same image, and split their work across the pool of the context.
+ */
+PIXEL_LAYOUT filter_layout(char flag);
+size_t planar_size(int width, int height, int planes);
+void planar_bind(PLANAR *image, BYTE *memory, int width, int height, int planes);
+void planar_load(CONTEXT *ctx, const IMAGE *src, PLANAR *dst, int gray);
+void planar_store(CONTEXT *ctx, const PLANAR *src, const IMAGE *dst);
+void planar_grayscale(CONTEXT *ctx, const PLANAR *src, PLANAR *dst);
+void planar_lut(CONTEXT *ctx, const LUT *lut, const PLANAR *src, PLANAR *dst);
+void planar_reflect(CONTEXT *ctx, const PLANAR *src, PLANAR *dst);
+int planar_blur(CONTEXT *ctx, const PLANAR *src, PLANAR *dst, int radius);
+int planar_edges(CONTEXT *ctx, const PLANAR *src, PLANAR *dst);
+
+#endif /* PLANAR_H */
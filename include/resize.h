@@ -0,0 +1,45 @@
+/*
+ * resize.h
+ * Area-average downscaling of images streamed row by row
+ */
+
+#ifndef RESIZE_H
+#define RESIZE_H
+
+#include "filters.h"
+
+/* Resize limits */
+#define MAX_RESIZE_WIDTH     (1 << 24) /* Widest source, keeping the horizontal sums of a row in 32 bits */
+#define RESIZE_SEPARATOR     'x'       /* Separates width and height in "WxH" */
+
+/*
+ * Downscaler accumulating source rows into a smaller image
+ * Source pixel j spans [j * width, (j + 1) * width) and output pixel x
+ * spans [x * src_width, (x + 1) * src_width) on a common fine grid, and
+ * likewise for rows, so every source pixel covers at most two output
+ * columns and rows with integer weights. Each output pixel is the rounded
+ * weighted average of the source area it covers, alpha included.
+ */
+typedef struct {
+    const IMAGE *dst;        /* Output image */
+    int          src_width;  /* Source width in pixels */
+    int          src_height; /* Source height in pixels */
+    int          block;      /* Most source rows passed to one resize_rows() call */
+    int          current;    /* Output row accumulated in sums[0] */
+    int32_t     *column;     /* First output column of each source column */
+    uint32_t    *weight;     /* Weight of each source column in its first output column */
+    uint32_t    *rows;       /* Horizontal sums of each row of a block, width + 1 pixels each */
+    uint64_t    *sums[2];    /* Vertical sums of output rows current and current + 1 (one allocation) */
+} RESIZER;
+
+/*
+ * Function prototypes
+ * resize_rows() takes the source rows in order, `block` at most per call,
+ * and writes every output row as soon as the rows it covers are all in.
+ */
+int resize_parse(const char *text, int *width, int *height);
+int resize_init(RESIZER *resizer, int src_width, int src_height, const IMAGE *dst, int block);
+void resize_rows(CONTEXT *ctx, RESIZER *resizer, const IMAGE *src, int begin, int end);
+void resize_free(RESIZER *resizer);
+
+#endif /* RESIZE_H */
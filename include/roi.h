@@ -0,0 +1,40 @@
+/*
+ * roi.h
+ * Filtering restricted to regions of interest, rectangles of an image
+ * outside which the pixels are left as they are
+ */
+
+#ifndef ROI_H
+#define ROI_H
+
+#include "pipeline.h"
+
+/* Region limits */
+#define MAX_ROIS             64     /* Most --roi options accepted */
+#define ROI_SEPARATOR        ','    /* Separates x, y, width and height in "x,y,w,h" */
+
+/*
+ * Rectangle of an image, in pixels from the top left corner of the picture
+ * whatever the row order of the file
+ */
+typedef struct {
+    int x;                   /* Left column */
+    int y;                   /* Top row */
+    int width;               /* Columns */
+    int height;              /* Rows */
+} ROI;
+
+/*
+ * Function prototypes
+ * roi_apply() gives the pixels of every region the values filtering the
+ * whole image would give them, and writes no other pixel of dst. It reads
+ * and writes only the rows roi_rows() reports.
+ */
+int roi_parse(const char *text, ROI *roi);
+int roi_margin(const PIPELINE *pipeline, const FILTER_PARAMS *params);
+int roi_rows(const PIPELINE *pipeline, const FILTER_PARAMS *params, const ROI *rois, int count, int bottom_up,
+             int width, int height, int *first);
+int roi_apply(CONTEXT *ctx, const PIPELINE *pipeline, const FILTER_PARAMS *params, const ROI *rois, int count,
+              int bottom_up, const IMAGE *src, const IMAGE *dst);
+
+#endif /* ROI_H */
@@ -0,0 +1,33 @@
+/*
+ * rowqueue.h
+ * Bounded single-producer, single-consumer queue of image rows, connecting
+ * the reader, filter and writer threads of an overlapped stream
+ */
+
+#ifndef ROWQUEUE_H
+#define ROWQUEUE_H
+
+/*
+ * Opaque row queue handle
+ * The rows themselves live in a ring buffer of `capacity` rows owned by the
+ * caller (an IMAGE view with ring == capacity); the queue only tracks them.
+ * Rows go through it in order: the producer may fill row r once the
+ * consumer has released row r - capacity, and the consumer may use the
+ * rows the producer has pushed until it releases them.
+ */
+typedef struct ROW_QUEUE ROW_QUEUE;
+
+/*
+ * Function prototypes
+ * The waiting calls return SUCCESS, or the error code given to
+ * row_queue_abort() once either side has given up.
+ */
+ROW_QUEUE *row_queue_create(int capacity);
+void row_queue_destroy(ROW_QUEUE *queue);
+int row_queue_reserve(ROW_QUEUE *queue, int end);
+void row_queue_push(ROW_QUEUE *queue, int end);
+int row_queue_wait(ROW_QUEUE *queue, int end);
+void row_queue_release(ROW_QUEUE *queue, int end);
+void row_queue_abort(ROW_QUEUE *queue, int error);
+
+#endif /* ROWQUEUE_H */
@@ -0,0 +1,44 @@
+/*
+ * serve.h
+ * Server mode: a long-running process filtering bitmaps sent over a Unix
+ * socket, with warm per-worker buffers and per-chain latency metrics
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "pipeline.h"
+
+/* Server mode constants */
+#define SERVE_BACKLOG        64             /* Connections queued while every worker is busy */
+#define SERVE_LINE_BYTES     4096           /* Longest request line, newline included */
+#define SERVE_MAX_REQUEST    (1024u << 20)  /* Largest bitmap accepted in one request, in bytes */
+#define SERVE_POLL_MS        200            /* How often waiting workers check for shutdown */
+#define SERVE_IDLE_MS        30000          /* Idle time after which a connection is closed */
+#define SERVE_MAX_METRICS    64             /* Distinct chains with latency metrics of their own */
+#define SERVE_OTHER_METRIC   "other"        /* Name under which the requests of further chains count */
+#define SERVE_STATS          "STATS"        /* Request line asking for the latency metrics */
+
+/* Latency histograms: exact below 2^SERVE_LATENCY_LINEAR microseconds, then
+ * 2^SERVE_LATENCY_STEPS buckets per doubling, each within 1/8 of its value */
+#define SERVE_LATENCY_LINEAR 4
+#define SERVE_LATENCY_STEPS  3
+#define SERVE_LATENCY_OCTAVES 40            /* Doublings covered: up to 2^40 microseconds */
+
+/*
+ * Function prototypes
+ * serve_run() serves requests until SIGINT or SIGTERM arrives, then writes
+ * the latency metrics to `report`.
+ *
+ * Protocol: a client sends any number of requests on one connection, each
+ * a line "<chain> <size>\n" followed by <size> bytes of BMP file, or
+ * "<chain> @<path>\n" naming a BMP file the server opens itself. Chains use
+ * the syntax of the command line ("-r,-b" or "reflect,blur") and run with
+ * the filter parameters the server was started with. Each request is
+ * answered with "OK <size>\n" followed by the filtered BMP file, or with
+ * "ERR <code> <message>\n". The line SERVE_STATS is answered with "OK <size>\n"
+ * followed by the latency metrics as a JSON object.
+ */
+int serve_run(const char *path, const FILTER_PARAMS *params, THREAD_POOL *pool, FILE *report);
+
+#endif /* SERVE_H */
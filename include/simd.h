@@ -0,0 +1,29 @@
+/*
+ * simd.h
+ * Vectorised row kernels for the point filters, selected at runtime
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "filters.h"
+
+/* Environment variable forcing a kernel set ("scalar", "sse4.1", "avx2", "neon") */
+#define SIMD_ENV             "BMPFILTER_SIMD"
+
+/*
+ * Row kernel
+ * Filters the leading pixels of a row (in may equal out) and returns how
+ * many it processed; the caller finishes the remaining pixels with the
+ * scalar reference code. The reflection kernel works from both ends: it
+ * returns j when pixels [0, j) and [width - j, width) of out are done.
+ * Every kernel handles one pixel format, and BGRA kernels keep the alpha.
+ */
+typedef int (*ROW_KERNEL)(const BYTE *in, BYTE *out, int width);
+
+/* Function prototypes (channels selects the PIXEL_BGR or PIXEL_BGRA kernel) */
+ROW_KERNEL simd_grayscale_row(int channels);
+ROW_KERNEL simd_reflect_row(int channels);
+const char *simd_name(void);
+
+#endif /* SIMD_H */
@@ -0,0 +1,109 @@
+/*
+ * stats.h
+ * Opt-in per-phase timings and I/O counters (--stats, --stats-json)
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "threadpool.h"
+
+/*
+ * Phases of processing one image
+ */
+typedef enum {
+    STATS_SETUP,            /* Opening (and mapping) the files */
+    STATS_HEADERS,          /* Reading and validating the BMP headers */
+    STATS_READ,             /* Reading pixel rows */
+    STATS_FILTER,           /* Running the filters */
+    STATS_WRITE,            /* Writing headers and pixel rows, flushing */
+    STATS_PHASES            /* Number of phases */
+} STATS_PHASE;
+
+/*
+ * Counted operations; each records a number of calls and of bytes
+ */
+typedef enum {
+    STATS_READS,            /* fread() calls and bytes read */
+    STATS_SEEKS,            /* fseek() calls and bytes skipped */
+    STATS_WRITES,           /* fwrite()/fputc() calls and bytes written */
+    STATS_MAPS,             /* mmap() calls and bytes mapped */
+    STATS_ALLOCS,           /* Pixel and work buffer allocations */
+    STATS_CACHE_HITS,       /* Outputs copied from the result cache, and their bytes */
+    STATS_CACHE_MISSES,     /* Lookups that found no usable cache entry */
+    STATS_COUNTERS          /* Number of counters */
+} STATS_COUNTER;
+
+/*
+ * Report formats
+ */
+typedef enum {
+    STATS_OFF,              /* No statistics are collected */
+    STATS_TEXT,             /* Human-readable table */
+    STATS_JSON              /* Single JSON object */
+} STATS_FORMAT;
+
+/*
+ * Start of a timed phase
+ */
+typedef struct {
+    long long wall_ns;      /* Monotonic clock */
+    long long cpu_ns;       /* Process CPU clock (all threads) */
+} STATS_TIMER;
+
+/*
+ * Totals collected so far
+ */
+typedef struct {
+    long long phase_wall[STATS_PHASES];       /* Wall time of each phase in ns */
+    long long phase_cpu[STATS_PHASES];        /* CPU time of each phase in ns */
+    long long counter_calls[STATS_COUNTERS];  /* Calls of each operation */
+    long long counter_bytes[STATS_COUNTERS];  /* Bytes moved by each operation */
+    long long largest_alloc;                  /* Largest single allocation in bytes */
+} STATS_TOTALS;
+
+/* Non-zero while statistics are being collected */
+extern int stats_enabled;
+
+/*
+ * Function prototypes
+ * stats_start() and stats_report() belong to the command line tool
+ * (statsreport.c); the library only counts.
+ */
+void stats_start(STATS_FORMAT format);
+STATS_TIMER stats_now(void);
+void stats_add_phase(STATS_PHASE phase, const STATS_TIMER *start);
+void stats_add_count(STATS_COUNTER counter, size_t bytes);
+void stats_totals(STATS_TOTALS *totals);
+void stats_report(FILE *out, const THREAD_POOL *pool);
+
+/*
+ * Marks the start of a phase (free when statistics are off)
+ */
+static inline STATS_TIMER stats_begin(void) {
+    STATS_TIMER start = { 0, 0 };
+    if (stats_enabled)
+        start = stats_now();
+    return start;
+}
+
+/*
+ * Adds the time since stats_begin() to a phase
+ */
+static inline void stats_end(STATS_PHASE phase, const STATS_TIMER *start) {
+    if (stats_enabled)
+        stats_add_phase(phase, start);
+}
+
+/*
+ * Counts one call of an operation moving `bytes` bytes
+ */
+static inline void stats_count(STATS_COUNTER counter, size_t bytes) {
+    if (stats_enabled)
+        stats_add_count(counter, bytes);
+}
+
+#endif /* STATS_H */
@@ -0,0 +1,35 @@
+/*
+ * threadpool.h
+ * Fixed-size pthread worker pool that runs row-band jobs
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* Thread pool limits */
+#define MAX_THREADS          256    /* Upper bound for -j / BMPFILTER_THREADS */
+#define THREADS_ENV          "BMPFILTER_THREADS"
+
+/*
+ * Band job callback
+ * Processes rows [begin, end) of a job; arg is the job's private data
+ */
+typedef void (*BAND_FN)(void *arg, int begin, int end);
+
+/* Opaque thread pool handle */
+typedef struct THREAD_POOL THREAD_POOL;
+
+/* Function prototypes */
+THREAD_POOL *thread_pool_create(int threads);
+void thread_pool_destroy(THREAD_POOL *pool);
+int thread_pool_size(const THREAD_POOL *pool);
+int thread_pool_bands(const THREAD_POOL *pool, int rows);
+void thread_pool_band_range(int rows, int bands, int index, int *begin, int *end);
+int thread_pool_band_index(int rows, int bands, int row);
+void thread_pool_run(THREAD_POOL *pool, int rows, BAND_FN fn, void *arg);
+int thread_count_default(void);
+void thread_pool_set_timing(THREAD_POOL *pool, int enabled);
+long long thread_pool_busy_ns(const THREAD_POOL *pool, int index);
+long long thread_pool_run_ns(const THREAD_POOL *pool);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,40 @@
+/*
+ * tile.h
+ * Cache-sized rectangular tiles used as the unit of work of the
+ * neighbourhood filters
+ */
+
+#ifndef TILE_H
+#define TILE_H
+
+#include <stddef.h>
+
+#include "threadpool.h"
+
+/* Tile sizing */
+#define TILE_CACHE_BYTES     (512 * 1024) /* L2 size assumed when the system does not report one */
+#define TILE_MIN_WIDTH       256          /* Narrowest tile, so halos stay a small overhead */
+
+/*
+ * Rectangle of output pixels processed by one call of a tile kernel
+ */
+typedef struct {
+    int x;                  /* First column */
+    int y;                  /* First row */
+    int width;              /* Number of columns */
+    int height;             /* Number of rows */
+    int band;               /* Index of the row band holding the tile */
+    int worker;             /* Index of the pool band running the tile, below the pool size */
+} TILE;
+
+/*
+ * Tile kernel
+ * Produces the output pixels of one tile; arg is the job's private data
+ */
+typedef void (*TILE_FN)(void *arg, const TILE *tile);
+
+/* Function prototypes */
+void tile_run(THREAD_POOL *pool, int width, int first_row, int rows, int halo,
+              size_t column_bytes, TILE_FN fn, void *arg);
+
+#endif /* TILE_H */
@@ -0,0 +1,185 @@
+/*
+ * analyze.c
+ * Implementation of image analysis.
+ *
+ * Histograms are counted in parallel bands, each into bins of its own in
+ * the context's work buffers, so threads never share a counter; the bands
+ * are then merged in order into the analysis. Within a band, consecutive
+ * pixels alternate between ANALYSIS_COPIES sets of bins: runs of equal
+ * values, common in real images, would otherwise make every increment wait
+ * for the previous one to the same bin. The drivers call analysis_rows()
+ * on each block of rows right after reading it, while it is still in cache,
+ * so analysing an image costs no second read of it.
+ */
+
+#include "analyze.h"
+#include "bmpio.h"
+
+#include <string.h>
+
+/* Names of the channels in the order of their bytes */
+static const char *const channel_names[PIXEL_BGRA] = { "blue", "green", "red", "alpha" };
+
+/*
+ * Data shared by all bands of one analysis pass
+ */
+typedef struct {
+    const CONTEXT *ctx;      /* Context holding the bins of each band */
+    const IMAGE   *image;    /* Rows being counted */
+    int            begin;    /* First row of the pass */
+    int            bands;    /* Number of bands the pass is split into */
+} ANALYSIS_JOB;
+
+/*
+ * Prepares an empty analysis of an image with `channels` channels
+ */
+void analysis_init(ANALYSIS *analysis, int channels) {
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->channels = channels;
+}
+
+/*
+ * Counts the channel values of rows [begin, end) of a band into its bins
+ */
+KERNEL_TEMPLATE void analysis_count(const ANALYSIS_JOB *job, int begin, int end, const int channels) {
+    const int band = thread_pool_band_index(job->image->rows, job->bands, begin - job->begin);
+    uint64_t (*bins)[ANALYSIS_BINS] = (uint64_t (*)[ANALYSIS_BINS])context_work(job->ctx, band);
+    const int width = job->image->width;
+
+    memset(bins, 0, ANALYSIS_COPIES * channels * sizeof(*bins));
+    for (int i = begin; i < end; i++) {
+        const BYTE *row = image_row(job->image, i);
+        int x = 0;
+        for (; x + ANALYSIS_COPIES <= width; x += ANALYSIS_COPIES) {
+            for (int k = 0; k < ANALYSIS_COPIES; k++) {
+                for (int c = 0; c < channels; c++)
+                    bins[k * channels + c][row[(size_t)(x + k) * channels + c]]++;
+            }
+        }
+        for (; x < width; x++) {
+            for (int c = 0; c < channels; c++)
+                bins[c][row[(size_t)x * channels + c]]++;
+        }
+    }
+}
+
+#define DEFINE_ANALYSIS_BAND(name, channels) \
+    static void analysis_band_##name(void *arg, int begin, int end) { \
+        ANALYSIS_JOB *job = arg; \
+        analysis_count(job, job->begin + begin, job->begin + end, channels); \
+    }
+PIXEL_FORMATS(DEFINE_ANALYSIS_BAND)
+
+#define ANALYSIS_BAND_ENTRY(name, channels) [channels] = analysis_band_##name,
+static const BAND_FN analysis_bands[PIXEL_BGRA + 1] = { PIXEL_FORMATS(ANALYSIS_BAND_ENTRY) };
+
+/*
+ * Adds rows [begin, end) of an image to an analysis
+ *
+ * Parameters:
+ *   ctx      - Processing context, whose pool counts the rows
+ *   analysis - Analysis to add to, of the image's pixel format
+ *   image    - View holding the rows (any stride, or a ring)
+ *   begin    - First row
+ *   end      - One past the last row
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_MEMORY if the bins cannot be allocated)
+ */
+int analysis_rows(CONTEXT *ctx, ANALYSIS *analysis, const IMAGE *image, int begin, int end) {
+    const int channels = analysis->channels;
+    if (end <= begin) {
+        return SUCCESS;
+    }
+
+    int result = context_reserve_work(ctx, ANALYSIS_COPIES * channels * ANALYSIS_BINS * sizeof(uint64_t));
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    IMAGE rows = *image;
+    rows.first_row = begin;
+    rows.rows = end - begin;
+    ANALYSIS_JOB job = { ctx, &rows, begin, thread_pool_bands(ctx->pool, rows.rows) };
+    thread_pool_run(ctx->pool, rows.rows, analysis_bands[channels], &job);
+
+    for (int band = 0; band < job.bands; band++) {
+        const uint64_t (*bins)[ANALYSIS_BINS] = (const uint64_t (*)[ANALYSIS_BINS])context_work(ctx, band);
+        for (int k = 0; k < ANALYSIS_COPIES * channels; k++) {
+            for (int v = 0; v < ANALYSIS_BINS; v++)
+                analysis->histogram[k % channels][v] += bins[k][v];
+        }
+    }
+    analysis->pixels += (uint64_t)(end - begin) * image->width;
+
+    return SUCCESS;
+}
+
+/*
+ * Writes a string as a JSON string literal
+ */
+static void json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < ' ') {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/*
+ * Writes an analysis as a single-line JSON object
+ *
+ * Parameters:
+ *   out      - Stream to write to
+ *   analysis - Analysis of the whole image
+ *   name     - File name reported for the image
+ *   width    - Image width
+ *   height   - Image height
+ *
+ * Description:
+ *   Minima and maxima are the lowest and highest values counted, and 0
+ *   for an image without pixels; means are over all pixels
+ */
+void analysis_report(FILE *out, const ANALYSIS *analysis, const char *name, int width, int height) {
+    const double pixels = analysis->pixels > 0 ? (double)analysis->pixels : 1.0;
+    double means[PIXEL_BGRA];
+
+    for (int c = 0; c < analysis->channels; c++) {
+        uint64_t sum = 0;
+        for (int v = 0; v < ANALYSIS_BINS; v++)
+            sum += analysis->histogram[c][v] * v;
+        means[c] = sum / pixels;
+    }
+
+    fprintf(out, "{\"file\": ");
+    json_string(out, name);
+    // The weighted sum is linear, so its mean follows from the channel means
+    double luminance = LUMA_RED * means[CHANNEL_RED] + LUMA_GREEN * means[CHANNEL_GREEN] +
+                       LUMA_BLUE * means[CHANNEL_BLUE];
+    fprintf(out, ", \"width\": %d, \"height\": %d, \"pixels\": %llu, \"mean_luminance\": %.4f, \"channels\": {",
+            width, height, (unsigned long long)analysis->pixels, luminance);
+    for (int c = 0; c < analysis->channels; c++) {
+        const uint64_t *histogram = analysis->histogram[c];
+        int min = 0, max = 0;
+        if (analysis->pixels > 0) {
+            max = ANALYSIS_BINS - 1;
+            while (histogram[min] == 0)
+                min++;
+            while (histogram[max] == 0)
+                max--;
+        }
+
+        fprintf(out, "%s\"%s\": {\"min\": %d, \"max\": %d, \"mean\": %.4f, \"histogram\": [", c ? ", " : "",
+                channel_names[c], min, max, means[c]);
+        for (int v = 0; v < ANALYSIS_BINS; v++)
+            fprintf(out, "%s%llu", v ? ", " : "", (unsigned long long)histogram[v]);
+        fprintf(out, "]}");
+    }
+    fprintf(out, "}}\n");
+}
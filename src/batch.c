@@ -0,0 +1,420 @@
+/*
+ * batch.c
+ * Implementation of batch mode.
+ *
+ * A batch is a list of (filters, input, output) entries, loaded either from a
+ * list file or from a directory of bitmaps. The entries are shared by a
+ * fixed set of workers running on the thread pool: each worker repeatedly
+ * claims the next unprocessed entry, so large and small files balance out
+ * across threads. Every worker owns one pair of pixel buffers that only
+ * grows, so after the first few files no memory is allocated per image.
+ * The same goes for the processing context of each worker, which holds the
+ * filters' scratch images and working memory. Workers
+ * never print; each entry records its ERR_* code for the report.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "bmpio.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <string.h>
+
+/* List file parsing */
+#define BATCH_SEPARATORS     " \t\r\n"  /* Characters separating list fields */
+#define BATCH_COMMENT        '#'        /* Lines starting with this are ignored */
+
+/*
+ * Pixel buffers owned by one worker and reused across files
+ */
+typedef struct {
+    BYTE    *src;           /* Decoded input pixels */
+    BYTE    *dst;           /* Filtered output pixels */
+    size_t   capacity;      /* Bytes allocated for each of src and dst */
+    CONTEXT  ctx;           /* Serial processing context for the filters */
+} BATCH_BUFFERS;
+
+/*
+ * State shared by the workers of one batch_run() call
+ */
+typedef struct {
+    BATCH               *batch;   /* Entries to process */
+    const FILTER_PARAMS *params;  /* Filter parameters of every entry */
+    int                  next;    /* Index of the next unclaimed entry */
+    pthread_mutex_t      lock;    /* Protects next */
+    BATCH_BUFFERS       *buffers; /* One buffer pair per worker */
+} BATCH_JOB;
+
+/*
+ * Appends an entry to a batch
+ *
+ * Parameters:
+ *   batch    - Batch to extend
+ *   pipeline - Filters to apply
+ *   infile   - Input filename (copied)
+ *   outfile  - Output filename (copied)
+ *
+ * Returns:
+ *   Error code (SUCCESS if added, ERR_MEMORY on allocation failure)
+ */
+static int batch_add(BATCH *batch, const PIPELINE *pipeline, const char *infile, const char *outfile) {
+    if (batch->count == batch->capacity) {
+        int capacity = batch->capacity > 0 ? 2 * batch->capacity : 64;
+        BATCH_ENTRY *entries = realloc(batch->entries, capacity * sizeof(BATCH_ENTRY));
+        if (entries == NULL) {
+            return ERR_MEMORY;
+        }
+        batch->entries = entries;
+        batch->capacity = capacity;
+    }
+
+    BATCH_ENTRY *entry = &batch->entries[batch->count];
+    entry->pipeline = *pipeline;
+    entry->infile = strdup(infile);
+    entry->outfile = strdup(outfile);
+    entry->result = SUCCESS;
+    if (entry->infile == NULL || entry->outfile == NULL) {
+        free(entry->outfile);
+        free(entry->infile);
+        return ERR_MEMORY;
+    }
+
+    batch->count++;
+    return SUCCESS;
+}
+
+/*
+ * Loads batch entries from a list file
+ *
+ * Parameters:
+ *   batch    - Batch to extend
+ *   list     - List filename, or "-" to read the list from stdin
+ *   pipeline - Default filters for lines without a flag (no stages if none)
+ *
+ * Returns:
+ *   Error code (SUCCESS if loaded, ERR_ARGS for an unreadable or malformed
+ *   list, ERR_MEMORY on allocation failure)
+ *
+ * Description:
+ *   Each line holds "<flag> <input file> <output file>", separated by
+ *   whitespace. The flag may be a chain such as "-r,-b,-g", and may be left
+ *   out when default filters are given.
+ *   Blank lines and lines starting with '#' are skipped.
+ */
+int batch_load_list(BATCH *batch, const char *list, const PIPELINE *pipeline) {
+    int from_stdin = strcmp(list, BATCH_LIST_STDIN) == 0;
+    FILE *file = from_stdin ? stdin : fopen(list, "r");
+    if (file == NULL) {
+        printf("Could not open %s.\n", list);
+        return ERR_ARGS;
+    }
+
+    char *line = NULL;
+    size_t length = 0;
+    int number = 0;
+    int result = SUCCESS;
+
+    while (result == SUCCESS && getline(&line, &length, file) != -1) {
+        char *fields[4] = { NULL, NULL, NULL, NULL };
+        char *save = NULL;
+        int count = 0;
+
+        number++;
+        for (char *field = strtok_r(line, BATCH_SEPARATORS, &save);
+             field != NULL && count < 4;
+             field = strtok_r(NULL, BATCH_SEPARATORS, &save)) {
+            fields[count++] = field;
+        }
+
+        if (count == 0 || fields[0][0] == BATCH_COMMENT) {
+            continue;
+        }
+
+        PIPELINE entry_pipeline = *pipeline;
+        if (count == 3) {
+            pipeline_parse(fields[0], &entry_pipeline);
+        }
+        if (entry_pipeline.stages == 0 || (count != 3 && count != 2)) {
+            printf("%s:%d: expected \"<flag> <input file> <output file>\"\n", list, number);
+            result = ERR_ARGS;
+            break;
+        }
+
+        result = batch_add(batch, &entry_pipeline, fields[count - 2], fields[count - 1]);
+    }
+
+    free(line);
+    if (!from_stdin) {
+        fclose(file);
+    }
+
+    return result;
+}
+
+/*
+ * Orders batch entries by input filename
+ */
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const BATCH_ENTRY *)a)->infile, ((const BATCH_ENTRY *)b)->infile);
+}
+
+/*
+ * Loads one batch entry per bitmap in a directory
+ *
+ * Parameters:
+ *   batch    - Batch to extend
+ *   pipeline - Filters applied to every file
+ *   indir    - Directory scanned for *.bmp files
+ *   outdir   - Directory receiving the outputs, under the same names
+ *
+ * Returns:
+ *   Error code (SUCCESS if loaded, ERR_ARGS if indir cannot be read,
+ *   ERR_MEMORY on allocation failure)
+ *
+ * Description:
+ *   Entries are sorted by name so the report order does not depend on the
+ *   directory order of the file system
+ */
+int batch_load_dir(BATCH *batch, const PIPELINE *pipeline, const char *indir, const char *outdir) {
+    DIR *dir = opendir(indir);
+    if (dir == NULL) {
+        printf("Could not open directory %s.\n", indir);
+        return ERR_ARGS;
+    }
+
+    const size_t suffix = strlen(BATCH_EXTENSION);
+    char *infile = NULL, *outfile = NULL;
+    int first = batch->count;
+    int result = SUCCESS;
+    struct dirent *item;
+
+    while (result == SUCCESS && (item = readdir(dir)) != NULL) {
+        const char *name = item->d_name;
+        size_t length = strlen(name);
+        if (length <= suffix || strcmp(name + length - suffix, BATCH_EXTENSION) != 0) {
+            continue;
+        }
+
+        free(infile);
+        free(outfile);
+        infile = malloc(strlen(indir) + length + 2);
+        outfile = malloc(strlen(outdir) + length + 2);
+        if (infile == NULL || outfile == NULL) {
+            result = ERR_MEMORY;
+            break;
+        }
+        sprintf(infile, "%s/%s", indir, name);
+        sprintf(outfile, "%s/%s", outdir, name);
+
+        result = batch_add(batch, pipeline, infile, outfile);
+    }
+
+    free(outfile);
+    free(infile);
+    closedir(dir);
+
+    qsort(batch->entries + first, batch->count - first, sizeof(BATCH_ENTRY), compare_entries);
+
+    return result;
+}
+
+/*
+ * Filters one batch entry with a worker's buffers
+ *
+ * Parameters:
+ *   entry   - Entry to process
+ *   params  - Filter parameters
+ *   buffers - Worker buffers, grown as needed
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   The input is read into the source buffer and filtered out of place into
+ *   the destination buffer, so a single blur or edges stage needs no
+ *   temporary copy. Both buffers use the file's padded row stride, so the
+ *   pixel data is read in large blocks straight into the source. The
+ *   output file is only created once the input has been read successfully.
+ */
+static int batch_process(const BATCH_ENTRY *entry, const FILTER_PARAMS *params, BATCH_BUFFERS *buffers) {
+    STATS_TIMER timer = stats_begin();
+    FILE *inptr = fopen(entry->infile, "rb");
+    if (inptr == NULL) {
+        return ERR_ARGS;
+    }
+    stats_end(STATS_SETUP, &timer);
+
+    timer = stats_begin();
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers(inptr, &bf, &bi);
+    if (result != SUCCESS) {
+        fclose(inptr);
+        return result;
+    }
+    stats_end(STATS_HEADERS, &timer);
+
+    int height = bmp_height(&bi);
+    int width = bi.biWidth;
+    int channels = bmp_channels(&bi);
+    size_t stride = bmp_stride(width, channels);
+    size_t size = stride * height;
+
+    if (size > buffers->capacity) {
+        free(buffers->src);
+        free(buffers->dst);
+        buffers->src = malloc(size);
+        buffers->dst = malloc(size);
+        buffers->capacity = size;
+        stats_count(STATS_ALLOCS, size);
+        stats_count(STATS_ALLOCS, size);
+        if (buffers->src == NULL || buffers->dst == NULL) {
+            free(buffers->src);
+            free(buffers->dst);
+            buffers->src = buffers->dst = NULL;
+            buffers->capacity = 0;
+            fclose(inptr);
+            return ERR_MEMORY;
+        }
+    }
+
+    timer = stats_begin();
+    IMAGE src = image_view(buffers->src, stride, channels, width, height);
+    IMAGE dst = image_view(buffers->dst, stride, channels, width, height);
+    result = bmp_read_rows(inptr, &src, 0, height);
+    fclose(inptr);
+    if (result != SUCCESS) {
+        return result;
+    }
+    stats_end(STATS_READ, &timer);
+
+    // A trailing reflection is applied while writing
+    timer = stats_begin();
+    PIPELINE rest;
+    int mirror = pipeline_defer_mirror(&entry->pipeline, &rest);
+    const IMAGE *out = rest.stages > 0 ? &dst : &src;
+    if (out == &dst)
+        result = pipeline_apply(&buffers->ctx, &rest, 0, rest.stages, params, bi.biHeight > 0, &src, &dst);
+    if (result != SUCCESS) {
+        return result;
+    }
+    stats_end(STATS_FILTER, &timer);
+
+    timer = stats_begin();
+    FILE *outptr = fopen(entry->outfile, "wb");
+    if (outptr == NULL) {
+        return ERR_OUTPUT_FILE;
+    }
+
+    result = bmp_write_image(outptr, &bf, &bi, out, mirror);
+    if (fclose(outptr) != 0 && result == SUCCESS) {
+        result = ERR_WRITE_DATA;
+    }
+    stats_end(STATS_WRITE, &timer);
+
+    return result;
+}
+
+/*
+ * Worker loop: claims and processes entries until none are left
+ */
+static void batch_worker(void *arg, int begin, int end) {
+    BATCH_JOB *job = arg;
+    BATCH_BUFFERS *buffers = &job->buffers[begin];
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (index >= job->batch->count) {
+            break;
+        }
+
+        BATCH_ENTRY *entry = &job->batch->entries[index];
+        entry->result = batch_process(entry, job->params, buffers);
+    }
+}
+
+/*
+ * Processes every entry of a batch
+ *
+ * Parameters:
+ *   batch  - Batch to process; each entry receives its result code
+ *   params - Filter parameters of every entry
+ *   pool   - Pool whose threads act as batch workers (NULL for one worker)
+ *
+ * Returns:
+ *   Error code (SUCCESS if every entry succeeded, ERR_BATCH if any failed,
+ *   ERR_MEMORY if the workers cannot be set up)
+ *
+ * Description:
+ *   Files are processed concurrently, one per worker, rather than splitting
+ *   each image across threads; the filters themselves run serially, on a
+ *   context without a pool owned by each worker.
+ */
+int batch_run(BATCH *batch, const FILTER_PARAMS *params, THREAD_POOL *pool) {
+    int workers = thread_pool_bands(pool, batch->count);
+    BATCH_JOB job = { batch, params, 0, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+    job.buffers = calloc(workers > 0 ? workers : 1, sizeof(BATCH_BUFFERS));
+    if (job.buffers == NULL) {
+        return ERR_MEMORY;
+    }
+    for (int w = 0; w < workers; w++)
+        context_init(&job.buffers[w].ctx, NULL);
+
+    // One band per worker; the band index selects the worker's buffers
+    thread_pool_run(pool, workers, batch_worker, &job);
+
+    for (int w = 0; w < workers; w++) {
+        free(job.buffers[w].src);
+        free(job.buffers[w].dst);
+        context_free(&job.buffers[w].ctx);
+    }
+    free(job.buffers);
+    pthread_mutex_destroy(&job.lock);
+
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->entries[i].result != SUCCESS) {
+            return ERR_BATCH;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Writes the per-file report
+ *
+ * Parameters:
+ *   batch - Processed batch
+ *   out   - Report stream
+ *
+ * Description:
+ *   One tab-separated line per entry, in input order:
+ *   "<ERR code>\t<input file>\t<output file>\t<message>"
+ */
+void batch_report(const BATCH *batch, FILE *out) {
+    for (int i = 0; i < batch->count; i++) {
+        const BATCH_ENTRY *entry = &batch->entries[i];
+        fprintf(out, "%d\t%s\t%s\t%s\n", entry->result, entry->infile, entry->outfile,
+                bmp_error_message(entry->result));
+    }
+}
+
+/*
+ * Releases all entries of a batch
+ */
+void batch_free(BATCH *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->entries[i].infile);
+        free(batch->entries[i].outfile);
+    }
+    free(batch->entries);
+    batch->entries = NULL;
+    batch->count = batch->capacity = 0;
+}
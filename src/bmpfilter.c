@@ -0,0 +1,418 @@
+/*
+ * bmpfilter.c
+ * Implementation of the in-memory library interface.
+ *
+ * A service embedding the filters keeps images in memory end to end: it
+ * validates an encoded file with bmp_info_mem(), decodes its pixels into an
+ * image it owns with bmp_decode_mem(), filters them with bmp_apply() and
+ * encodes the result into a buffer of bmp_image_encoded_size() bytes. A
+ * caller whose pixels already sit in memory of its own, e.g. a frame of a
+ * video pipeline, wraps them with bmp_image_wrap() instead, and bmp_apply()
+ * filters them where they are, with no decode copy. None
+ * of these functions touch a file; the only global state they share is the
+ * statistics counters, which are atomic, and the kernel selection, which
+ * is made once.
+ *
+ * The handles wrap the internal CONTEXT and IMAGE types, which are free to
+ * change without breaking callers. An image keeps its rows in the order of
+ * the file it came from, so that filtering it gives the bytes the command
+ * line tool writes; bmp_image_row() maps picture rows onto them.
+ */
+
+#include "bmpfilter.h"
+#include "bmpio.h"
+#include "convolve.h"
+#include "lut.h"
+#include "pipeline.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The public codes are the internal ones under other names
+_Static_assert(BMP_SUCCESS == SUCCESS && BMP_ERR_ARGS == ERR_ARGS && BMP_ERR_HEADER_READ == ERR_HEADER_READ &&
+               BMP_ERR_FORMAT == ERR_FORMAT && BMP_ERR_MEMORY == ERR_MEMORY &&
+               BMP_ERR_IMAGE_READ == ERR_IMAGE_READ && BMP_ERR_WRITE_DATA == ERR_WRITE_DATA,
+               "public result codes differ from the internal ones");
+
+/*
+ * Thread pool and scratch buffers of one caller
+ */
+struct BMP_CONTEXT {
+    THREAD_POOL *pool;       /* Workers, or NULL to filter on the calling thread */
+    CONTEXT      ctx;        /* Scratch buffers reused across calls */
+};
+
+/*
+ * Pixel rows of an image with the header fields encoding keeps
+ */
+struct BMP_IMAGE {
+    IMAGE   view;            /* Rows in file order, packed unless wrapped */
+    BYTE   *data;            /* Owned pixel memory, or NULL for a wrapped image */
+    int     top_down;        /* Non-zero if row 0 of the view is the top row */
+    int32_t x_ppm;           /* Horizontal resolution in pixels per meter */
+    int32_t y_ppm;           /* Vertical resolution in pixels per meter */
+};
+
+/*
+ * Creates a processing context
+ *
+ * Parameters:
+ *   threads - Threads to filter with, 0 for the BMPFILTER_THREADS or CPU
+ *             count default; a context whose pool cannot start filters on
+ *             the calling thread
+ *
+ * Returns:
+ *   New context, or NULL if out of memory
+ */
+BMP_CONTEXT *bmp_context_create(int threads) {
+    BMP_CONTEXT *ctx = malloc(sizeof(BMP_CONTEXT));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (threads <= 0)
+        threads = thread_count_default();
+    ctx->pool = threads > 1 ? thread_pool_create(threads) : NULL;
+    context_init(&ctx->ctx, ctx->pool);
+    return ctx;
+}
+
+/*
+ * Frees a context, its buffers and its threads (NULL is ignored)
+ */
+void bmp_context_destroy(BMP_CONTEXT *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+
+    context_free(&ctx->ctx);
+    thread_pool_destroy(ctx->pool);
+    free(ctx);
+}
+
+/*
+ * Allocates an image of packed rows, or returns NULL
+ */
+static BMP_IMAGE *image_alloc(int width, int height, int channels) {
+    if (width <= 0 || height <= 0 || (channels != PIXEL_BGR && channels != PIXEL_BGRA) ||
+        (size_t)width > SIZE_MAX / channels / height) {
+        return NULL;
+    }
+
+    const size_t stride = (size_t)width * channels;
+    BMP_IMAGE *image = malloc(sizeof(BMP_IMAGE));
+    BYTE *data = malloc(stride * height);
+    stats_count(STATS_ALLOCS, stride * height);
+    if (image == NULL || data == NULL) {
+        free(image);
+        free(data);
+        return NULL;
+    }
+
+    image->view = image_view(data, stride, channels, width, height);
+    image->data = data;
+    image->top_down = 0;
+    image->x_ppm = image->y_ppm = BMP_PIXELS_PER_METER;
+    return image;
+}
+
+/*
+ * Creates a bottom-up 72 DPI image, with undefined pixels
+ *
+ * Parameters:
+ *   width    - Columns (positive)
+ *   height   - Rows (positive)
+ *   channels - Bytes per pixel, 3 for BGR or 4 for BGRA
+ *
+ * Returns:
+ *   New image, or NULL if a size is invalid or out of memory
+ */
+BMP_IMAGE *bmp_image_create(int width, int height, int channels) {
+    return image_alloc(width, height, channels);
+}
+
+/*
+ * Wraps pixel rows held in caller memory as a top-down 72 DPI image
+ *
+ * Parameters:
+ *   data     - First byte of the top row of the picture
+ *   stride   - Bytes between the starts of consecutive rows, at least
+ *              width * channels
+ *   width    - Columns (positive)
+ *   height   - Rows (positive)
+ *   channels - Bytes per pixel, 3 for BGR or 4 for BGRA
+ *
+ * Returns:
+ *   New image, or NULL if an argument is invalid or out of memory
+ *
+ * Description:
+ *   The image reads and writes the caller's rows in place, and only the
+ *   width * channels pixel bytes of each: bmp_apply() filters them where
+ *   they are and bmp_image_row() points into them. The memory must outlive
+ *   the image, which bmp_image_destroy() does not free.
+ */
+BMP_IMAGE *bmp_image_wrap(uint8_t *data, size_t stride, int width, int height, int channels) {
+    if (data == NULL || width <= 0 || height <= 0 || (channels != PIXEL_BGR && channels != PIXEL_BGRA) ||
+        stride < (size_t)width * channels || (size_t)height > SIZE_MAX / stride) {
+        return NULL;
+    }
+
+    BMP_IMAGE *image = malloc(sizeof(BMP_IMAGE));
+    if (image == NULL) {
+        return NULL;
+    }
+
+    image->view = image_view(data, stride, channels, width, height);
+    image->data = NULL;
+    image->top_down = 1;
+    image->x_ppm = image->y_ppm = BMP_PIXELS_PER_METER;
+    return image;
+}
+
+/*
+ * Frees an image, and its pixels unless they were wrapped (NULL is ignored)
+ */
+void bmp_image_destroy(BMP_IMAGE *image) {
+    if (image == NULL) {
+        return;
+    }
+
+    free(image->data);
+    free(image);
+}
+
+int bmp_image_width(const BMP_IMAGE *image) {
+    return image->view.width;
+}
+
+int bmp_image_height(const BMP_IMAGE *image) {
+    return image->view.height;
+}
+
+int bmp_image_channels(const BMP_IMAGE *image) {
+    return image->view.channels;
+}
+
+/*
+ * Returns the first pixel of a row of an image, counted from the top of the
+ * picture, or NULL if there is no such row
+ */
+uint8_t *bmp_image_row(BMP_IMAGE *image, int row) {
+    const int height = image->view.height;
+    if (row < 0 || row >= height) {
+        return NULL;
+    }
+
+    return image_row(&image->view, image->top_down ? row : height - 1 - row);
+}
+
+/*
+ * Reads and validates the headers of an encoded bitmap
+ *
+ * Parameters:
+ *   data     - Encoded bitmap file
+ *   size     - Bytes available at data
+ *   width    - Receives the width in pixels (may be NULL)
+ *   height   - Receives the height in pixels (may be NULL)
+ *   channels - Receives the bytes per pixel, 3 or 4 (may be NULL)
+ *
+ * Returns:
+ *   Error code (BMP_SUCCESS if supported, BMP_ERR_HEADER_READ if data is
+ *   shorter than the headers, BMP_ERR_FORMAT if unsupported,
+ *   BMP_ERR_IMAGE_READ if data is shorter than the pixel rows)
+ */
+int bmp_info_mem(const uint8_t *data, size_t size, int *width, int *height, int *channels) {
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers_mem(data, size, &bi);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    if (width != NULL)
+        *width = bi.biWidth;
+    if (height != NULL)
+        *height = bmp_height(&bi);
+    if (channels != NULL)
+        *channels = bmp_channels(&bi);
+    return SUCCESS;
+}
+
+/*
+ * Decodes an encoded bitmap
+ *
+ * Parameters:
+ *   data  - Encoded bitmap file
+ *   size  - Bytes available at data
+ *   image - Receives the new image on success, NULL otherwise
+ *
+ * Returns:
+ *   Error code (BMP_SUCCESS if decoded, BMP_ERR_MEMORY if the image cannot
+ *   be allocated, or an error of bmp_info_mem())
+ *
+ * Description:
+ *   The image keeps the row order and resolution of the file, which
+ *   bmp_encode_mem() writes back.
+ */
+int bmp_decode_mem(const uint8_t *data, size_t size, BMP_IMAGE **image) {
+    BITMAPINFOHEADER bi;
+    *image = NULL;
+    int result = bmp_read_headers_mem(data, size, &bi);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    BMP_IMAGE *decoded = image_alloc(bi.biWidth, bmp_height(&bi), bmp_channels(&bi));
+    if (decoded == NULL) {
+        return ERR_MEMORY;
+    }
+    decoded->top_down = bi.biHeight < 0;
+    decoded->x_ppm = bi.biXPelsPerMeter;
+    decoded->y_ppm = bi.biYPelsPerMeter;
+
+    const IMAGE *view = &decoded->view;
+    const size_t stride = bmp_stride(view->width, view->channels);
+    const BYTE *row = data + BITMAP_HEADER_SIZE;
+    for (int i = 0; i < view->height; i++, row += stride)
+        memcpy(image_row(view, i), row, view->stride);
+
+    *image = decoded;
+    return SUCCESS;
+}
+
+/*
+ * Returns the size of the encoded bitmap of an image, headers included
+ */
+size_t bmp_image_encoded_size(const BMP_IMAGE *image) {
+    return bmp_encoded_size(image->view.width, image->view.height, image->view.channels);
+}
+
+/*
+ * Encodes an image as an uncompressed 24-bit or, for BGRA pixels, 32-bit
+ * bitmap
+ *
+ * Parameters:
+ *   image - Image to encode
+ *   data  - Receives the encoded file
+ *   size  - Bytes available at data, at least bmp_image_encoded_size()
+ *
+ * Returns:
+ *   Error code (BMP_SUCCESS if encoded, BMP_ERR_WRITE_DATA if data is too
+ *   small)
+ *
+ * Description:
+ *   Rows are written in the order and with the resolution of the file the
+ *   image was decoded from, padded with zero bytes
+ */
+int bmp_encode_mem(const BMP_IMAGE *image, uint8_t *data, size_t size) {
+    const IMAGE *view = &image->view;
+    const size_t encoded = bmp_image_encoded_size(image);
+    if (size < encoded) {
+        return ERR_WRITE_DATA;
+    }
+
+    BITMAPFILEHEADER file;
+    BITMAPINFOHEADER info;
+    file.bfType = BITMAP_TYPE;
+    file.bfSize = encoded;
+    file.bfReserved1 = 0;
+    file.bfReserved2 = 0;
+    file.bfOffBits = BITMAP_HEADER_SIZE;
+    info.biSize = sizeof(BITMAPINFOHEADER);
+    info.biWidth = view->width;
+    info.biHeight = image->top_down ? -view->height : view->height;
+    info.biPlanes = 1;
+    info.biBitCount = 8 * view->channels;
+    info.biCompression = BITMAP_COMPRESSION;
+    info.biSizeImage = encoded - BITMAP_HEADER_SIZE;
+    info.biXPelsPerMeter = image->x_ppm;
+    info.biYPelsPerMeter = image->y_ppm;
+    info.biClrUsed = 0;
+    info.biClrImportant = 0;
+    memcpy(data, &file, sizeof(BITMAPFILEHEADER));
+    memcpy(data + sizeof(BITMAPFILEHEADER), &info, sizeof(BITMAPINFOHEADER));
+
+    const size_t row_bytes = image_row_bytes(view);
+    const int padding = bmp_padding(view->width, view->channels);
+    BYTE *row = data + BITMAP_HEADER_SIZE;
+    for (int i = 0; i < view->height; i++, row += row_bytes + padding) {
+        memcpy(row, image_row(view, i), row_bytes);
+        memset(row + row_bytes, 0, padding);
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Sets filter options to the defaults of the command line tool
+ */
+void bmp_default_options(BMP_OPTIONS *options) {
+    FILTER_PARAMS params;
+    lut_default_params(&params);
+
+    options->radius = DEFAULT_BLUR_RADIUS;
+    options->threshold = params.threshold;
+    options->brightness = params.brightness;
+    options->contrast = params.contrast;
+    options->gamma = params.gamma;
+    options->kernel = NULL;
+    options->border = NULL;
+}
+
+/*
+ * Applies a filter chain to an image in place
+ *
+ * Parameters:
+ *   ctx     - Processing context of the calling thread
+ *   filters - Chain in --pipeline syntax, e.g. "-b" or "reflect,blur,gray"
+ *   options - Parameters of the filters, or NULL for bmp_default_options()
+ *   image   - Image to filter
+ *
+ * Returns:
+ *   Error code (BMP_SUCCESS if filtered, BMP_ERR_ARGS if the chain, an
+ *   option or the kernel is invalid, or the chain convolves without a
+ *   kernel, BMP_ERR_MEMORY if the context cannot grow, leaving the image
+ *   contents undefined)
+ */
+int bmp_apply(BMP_CONTEXT *ctx, const char *filters, const BMP_OPTIONS *options, BMP_IMAGE *image) {
+    BMP_OPTIONS defaults;
+    PIPELINE pipeline;
+    KERNEL kernel;
+
+    if (options == NULL) {
+        bmp_default_options(&defaults);
+        options = &defaults;
+    }
+    if (pipeline_parse(filters, &pipeline) == 0 ||
+        options->radius < 1 || options->radius > MAX_BLUR_RADIUS ||
+        options->threshold < 1 || options->threshold > 255 ||
+        options->brightness < -255 || options->brightness > 255 ||
+        options->contrast < 0 || options->contrast > MAX_CONTRAST ||
+        !(options->gamma >= MIN_GAMMA && options->gamma <= MAX_GAMMA)) {
+        return ERR_ARGS;
+    }
+
+    FILTER_PARAMS params = {
+        .radius = options->radius,
+        .kernel = NULL,
+        .threshold = options->threshold,
+        .brightness = options->brightness,
+        .contrast = options->contrast,
+        .gamma = options->gamma,
+    };
+    if (options->kernel != NULL) {
+        if (kernel_parse(options->kernel, &kernel) != SUCCESS) {
+            return ERR_ARGS;
+        }
+        kernel.border = BORDER_CLAMP;
+        if (options->border != NULL && kernel_border(options->border, &kernel.border) != SUCCESS) {
+            return ERR_ARGS;
+        }
+        params.kernel = &kernel;
+    } else if (memchr(pipeline.flags, 'c', pipeline.stages) != NULL) {
+        return ERR_ARGS;
+    }
+
+    return pipeline_apply(&ctx->ctx, &pipeline, 0, pipeline.stages, &params, !image->top_down, &image->view,
+                          &image->view);
+}
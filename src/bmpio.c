@@ -0,0 +1,373 @@
+/*
+ * bmpio.c
+ * Implementation of BMP header validation and row-level file I/O.
+ *
+ * These helpers only report errors through their return codes, so they can
+ * be shared by the single-file drivers in main.c and the batch workers.
+ *
+ * Rows move in blocks of up to IO_BLOCK_BYTES: a view whose stride is the
+ * padded row size of the file is read straight into, and any other view
+ * goes through a staging block, so a stream is never read or written one
+ * row at a time and never needs to seek, which lets the input and output
+ * be pipes.
+ */
+
+#include "bmpfilter.h"   /* exports bmp_error_message() from the library */
+#include "bmpio.h"
+#include "stats.h"
+
+#include <string.h>
+
+/*
+ * Returns the number of padding bytes after each row of a bitmap of
+ * `channels`-byte pixels (rows are padded to a multiple of 4 bytes, so
+ * 32-bit rows never are)
+ */
+int bmp_padding(int width, int channels) {
+    return (4 - ((size_t)width * channels) % 4) % 4;
+}
+
+/*
+ * Returns the bytes per pixel of a validated bitmap (PIXEL_BGR or PIXEL_BGRA)
+ */
+int bmp_channels(const BITMAPINFOHEADER *bi) {
+    return bi->biBitCount / 8;
+}
+
+/*
+ * Returns the height in pixels of a validated bitmap
+ * A negative biHeight marks a top-down bitmap, whose first row is the top
+ * one; views keep the rows in file order either way, and writers keep the
+ * sign of the header, so the orientation of the output is the input's.
+ */
+int bmp_height(const BITMAPINFOHEADER *bi) {
+    return bi->biHeight < 0 ? -bi->biHeight : bi->biHeight;
+}
+
+/*
+ * Validates the BMP headers
+ *
+ * Parameters:
+ *   bf - Bitmap file header
+ *   bi - Bitmap info header
+ *
+ * Returns:
+ *   Error code (SUCCESS if supported, ERR_FORMAT otherwise)
+ *
+ * Description:
+ *   Only uncompressed 24-bit BGR and 32-bit BGRA bitmaps of at least one
+ *   pixel, bottom-up or top-down, with the pixel data right after the
+ *   headers are supported
+ */
+int bmp_check_headers(const BITMAPFILEHEADER *bf, const BITMAPINFOHEADER *bi) {
+    if (bf->bfType != BITMAP_TYPE || bf->bfOffBits != BITMAP_HEADER_SIZE ||
+        bi->biSize != 40 || (bi->biBitCount != 24 && bi->biBitCount != 32) ||
+        bi->biCompression != BITMAP_COMPRESSION) {
+        return ERR_FORMAT;
+    }
+
+    // An empty image has no rows to move, and the height of a top-down
+    // bitmap must be representable once negated
+    if (bi->biWidth <= 0 || bi->biHeight == 0 || bi->biHeight == INT32_MIN) {
+        return ERR_FORMAT;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Reads and validates the BMP headers
+ *
+ * Parameters:
+ *   inptr - Input file pointer, positioned at the start of the file
+ *   bf    - Receives the bitmap file header
+ *   bi    - Receives the bitmap info header
+ *
+ * Returns:
+ *   Error code (SUCCESS if supported, ERR_HEADER_READ or ERR_FORMAT otherwise)
+ */
+int bmp_read_headers(FILE *inptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi) {
+    stats_count(STATS_READS, sizeof(BITMAPFILEHEADER));
+    stats_count(STATS_READS, sizeof(BITMAPINFOHEADER));
+    if (fread(bf, sizeof(BITMAPFILEHEADER), 1, inptr) != 1 ||
+        fread(bi, sizeof(BITMAPINFOHEADER), 1, inptr) != 1) {
+        return ERR_HEADER_READ;
+    }
+
+    return bmp_check_headers(bf, bi);
+}
+
+/*
+ * Reads and validates the headers of a bitmap file held in memory
+ *
+ * Parameters:
+ *   data - Encoded bitmap file
+ *   size - Bytes available at data
+ *   bi   - Receives the bitmap info header
+ *
+ * Returns:
+ *   Error code (SUCCESS if supported, ERR_HEADER_READ if data is shorter
+ *   than the headers, ERR_FORMAT if unsupported, ERR_IMAGE_READ if data is
+ *   shorter than the pixel rows)
+ */
+int bmp_read_headers_mem(const BYTE *data, size_t size, BITMAPINFOHEADER *bi) {
+    BITMAPFILEHEADER bf;
+
+    if (size < BITMAP_HEADER_SIZE) {
+        return ERR_HEADER_READ;
+    }
+
+    // The packed headers may sit at any alignment in the caller's buffer
+    memcpy(&bf, data, sizeof(BITMAPFILEHEADER));
+    memcpy(bi, data + sizeof(BITMAPFILEHEADER), sizeof(BITMAPINFOHEADER));
+    if (bmp_check_headers(&bf, bi) != SUCCESS) {
+        return ERR_FORMAT;
+    }
+
+    if (size < bmp_encoded_size(bi->biWidth, bmp_height(bi), bmp_channels(bi))) {
+        return ERR_IMAGE_READ;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Returns the bytes between the starts of consecutive rows in a file
+ */
+size_t bmp_stride(int width, int channels) {
+    return (size_t)width * channels + bmp_padding(width, channels);
+}
+
+/*
+ * Returns the size of the encoded bitmap of an image of `channels`-byte
+ * pixels, headers included
+ */
+size_t bmp_encoded_size(int width, int height, int channels) {
+    return BITMAP_HEADER_SIZE + bmp_stride(width, channels) * height;
+}
+
+/*
+ * Returns the number of rows from `row` on that are stored contiguously in
+ * a view, up to `end`: a ring buffer wraps around after its last slot
+ */
+static int contiguous_rows(const IMAGE *image, int row, int end) {
+    int rows = end - row;
+    if (image->ring != 0 && rows > image->ring - row % image->ring)
+        rows = image->ring - row % image->ring;
+    return rows;
+}
+
+/*
+ * Reads padded rows from the input file
+ * The padding of the last row may be missing at the end of the file.
+ */
+static int read_block(FILE *inptr, BYTE *data, int rows, size_t stride, int padding) {
+    size_t size = rows * stride;
+    stats_count(STATS_READS, size);
+    size_t got = fread(data, 1, size, inptr);
+    return got + padding >= size ? SUCCESS : ERR_IMAGE_READ;
+}
+
+/*
+ * Reads image rows from the input file
+ *
+ * Parameters:
+ *   inptr - Input file pointer, positioned at the first row to read
+ *   image - Image view receiving the rows
+ *   begin - First row to read
+ *   end   - One past the last row to read
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, ERR_MEMORY or ERR_IMAGE_READ on
+ *   failure)
+ *
+ * Description:
+ *   The file's rows hold pixels of the view's format. When the view's
+ *   stride is bmp_stride(), rows and padding are read into
+ *   it directly, so the padding bytes of the view hold the file's; other
+ *   views receive only the pixels, through a staging block
+ */
+int bmp_read_rows(FILE *inptr, const IMAGE *image, int begin, int end) {
+    const size_t row_bytes = image_row_bytes(image);
+    const size_t stride = bmp_stride(image->width, image->channels);
+    const int padding = bmp_padding(image->width, image->channels);
+    const int block = IO_BLOCK_BYTES / stride > 0 ? IO_BLOCK_BYTES / stride : 1;
+
+    if (image->stride == stride) {
+        for (int i = begin; i < end;) {
+            int rows = contiguous_rows(image, i, end);
+            rows = rows < block ? rows : block;
+            if (read_block(inptr, image_row(image, i), rows, stride, padding) != SUCCESS) {
+                return ERR_IMAGE_READ;
+            }
+            i += rows;
+        }
+        return SUCCESS;
+    }
+
+    if (end <= begin) {
+        return SUCCESS;
+    }
+    const int staged = end - begin < block ? end - begin : block;
+    BYTE *staging = malloc(staged * stride);
+    stats_count(STATS_ALLOCS, staged * stride);
+    if (staging == NULL) {
+        return ERR_MEMORY;
+    }
+
+    int result = SUCCESS;
+    for (int i = begin; i < end && result == SUCCESS; i += staged) {
+        int rows = end - i < staged ? end - i : staged;
+        result = read_block(inptr, staging, rows, stride, padding);
+        for (int k = 0; k < rows && result == SUCCESS; k++)
+            memcpy(image_row(image, i + k), staging + k * stride, row_bytes);
+    }
+
+    free(staging);
+    return result;
+}
+
+/*
+ * Writes image rows to the output file
+ *
+ * Parameters:
+ *   outptr - Output file pointer, positioned after the previous row
+ *   image  - Image view holding the rows
+ *   begin  - First row to write
+ *   end    - One past the last row to write
+ *   mirror - Non-zero to write every row reflected horizontally
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, ERR_MEMORY or ERR_WRITE_DATA on
+ *   failure)
+ *
+ * Description:
+ *   Rows are assembled with zero padding bytes into a staging block that is
+ *   written with a single fwrite() call. A mirrored row is reversed on its
+ *   way into the block, so a trailing reflect costs no more than the copy
+ *   and needs no pass over the image.
+ */
+int bmp_write_rows(FILE *outptr, const IMAGE *image, int begin, int end, int mirror) {
+    const int width = image->width;
+    const size_t stride = bmp_stride(width, image->channels);
+    const int block = IO_BLOCK_BYTES / stride > 0 ? IO_BLOCK_BYTES / stride : 1;
+
+    if (end <= begin) {
+        return SUCCESS;
+    }
+    const int staged = end - begin < block ? end - begin : block;
+    BYTE *staging = calloc(staged, stride);
+    stats_count(STATS_ALLOCS, staged * stride);
+    if (staging == NULL) {
+        return ERR_MEMORY;
+    }
+
+    int result = SUCCESS;
+    for (int i = begin; i < end && result == SUCCESS; i += staged) {
+        int rows = end - i < staged ? end - i : staged;
+        for (int k = 0; k < rows; k++) {
+            BYTE *row = staging + k * stride;
+            if (mirror)
+                reflect_row(image_row(image, i + k), row, width, image->channels);
+            else
+                memcpy(row, image_row(image, i + k), image_row_bytes(image));
+        }
+
+        stats_count(STATS_WRITES, rows * stride);
+        if (fwrite(staging, stride, rows, outptr) != rows) {
+            result = ERR_WRITE_DATA;
+        }
+    }
+
+    free(staging);
+    return result;
+}
+
+/*
+ * Rewrites the headers of a bitmap for an image of another size
+ * The width, height, pixel data size and file size change; the orientation,
+ * pixel format and resolution are kept.
+ */
+void bmp_set_size(BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, int width, int height) {
+    const size_t size = bmp_stride(width, bmp_channels(bi)) * height;
+
+    bi->biWidth = width;
+    bi->biHeight = bi->biHeight < 0 ? -height : height;
+    bi->biSizeImage = size;
+    bf->bfSize = BITMAP_HEADER_SIZE + size;
+}
+
+/*
+ * Writes the BMP headers to the output file
+ *
+ * Parameters:
+ *   outptr - Output file pointer
+ *   bf     - Bitmap file header
+ *   bi     - Bitmap info header
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, ERR_WRITE_HEADER or ERR_WRITE_INFO on failure)
+ */
+int bmp_write_headers(FILE *outptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi) {
+    stats_count(STATS_WRITES, sizeof(BITMAPFILEHEADER));
+    stats_count(STATS_WRITES, sizeof(BITMAPINFOHEADER));
+    if (fwrite(bf, sizeof(BITMAPFILEHEADER), 1, outptr) != 1) {
+        return ERR_WRITE_HEADER;
+    }
+
+    if (fwrite(bi, sizeof(BITMAPINFOHEADER), 1, outptr) != 1) {
+        return ERR_WRITE_INFO;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Writes the processed image to output file
+ *
+ * Parameters:
+ *   outptr - Output file pointer
+ *   bf     - Bitmap file header
+ *   bi     - Bitmap info header
+ *   image  - Processed image data to write
+ *   mirror - Non-zero to write every row reflected horizontally
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Writes the BMP headers and image data with appropriate padding
+ */
+int bmp_write_image(FILE *outptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, const IMAGE *image,
+                    int mirror) {
+    int result = bmp_write_headers(outptr, bf, bi);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    return bmp_write_rows(outptr, image, 0, image->height, mirror);
+}
+
+/*
+ * Returns a short description of an error code
+ */
+const char *bmp_error_message(int code) {
+    switch (code) {
+        case SUCCESS:           return "ok";
+        case ERR_ARGS:          return "invalid arguments or input file";
+        case ERR_OUTPUT_FILE:   return "could not create output file";
+        case ERR_HEADER_READ:   return "error reading BMP headers";
+        case ERR_FORMAT:        return "unsupported file format";
+        case ERR_MEMORY:        return "not enough memory";
+        case ERR_IMAGE_READ:    return "error reading image data";
+        case ERR_SEEK:          return "error seeking to next row";
+        case ERR_WRITE_HEADER:  return "error writing BMP header";
+        case ERR_WRITE_INFO:    return "error writing BMP info";
+        case ERR_WRITE_DATA:    return "error writing image data";
+        case ERR_WRITE_PADDING: return "error writing padding bytes";
+        case ERR_MAP:           return "could not map file";
+        case ERR_BATCH:         return "one or more batch entries failed";
+        case ERR_SOCKET:        return "could not set up the server socket";
+        default:                return "unknown error";
+    }
+}
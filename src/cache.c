@@ -0,0 +1,322 @@
+/*
+ * cache.c
+ * Implementation of the result cache.
+ *
+ * A key is the 64-bit XXH64 hash of the encoded input, headers and pixel
+ * rows with zeroed padding, seeded with a hash of the chain and of every
+ * filter parameter, so that any change to either selects another entry.
+ * XXH64 reads eight bytes per step in four independent lanes and hashes
+ * several GB/s, a small cost next to reading the input it covers.
+ *
+ * Entries are plain files in the cache directory. They are written to a
+ * temporary name and renamed into place, so a reader never sees half an
+ * entry, whichever process wrote it. A hit sets the entry's modification
+ * time, which orders the entries for eviction: after each store the
+ * directory is scanned and the oldest entries removed until it fits.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include "bmpio.h"
+#include "convolve.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* XXH64 primes */
+#define PRIME64_1            0x9E3779B185EBCA87ULL
+#define PRIME64_2            0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3            0x165667B19E3779F9ULL
+#define PRIME64_4            0x85EBCA77C2B2AE63ULL
+#define PRIME64_5            0x27D4EB2F165667C5ULL
+
+/*
+ * Entry found while scanning the cache directory
+ */
+typedef struct {
+    char     name[CACHE_NAME_BYTES]; /* File name within the directory */
+    uint64_t size;                   /* Bytes */
+    time_t   used;                   /* Last store or hit */
+    long     used_ns;                /* Nanoseconds of the last store or hit */
+} CACHE_ENTRY;
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const BYTE *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const BYTE *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    return rotl64(acc + input * PRIME64_2, 31) * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t lane) {
+    return (acc ^ xxh64_round(0, lane)) * PRIME64_1 + PRIME64_4;
+}
+
+/*
+ * Returns the XXH64 hash of a block of bytes (little-endian hosts)
+ */
+uint64_t cache_hash(const void *data, size_t size, uint64_t seed) {
+    const BYTE *p = data;
+    const BYTE *end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+        }
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64_merge(hash, v1);
+        hash = xxh64_merge(hash, v2);
+        hash = xxh64_merge(hash, v3);
+        hash = xxh64_merge(hash, v4);
+    } else {
+        hash = seed + PRIME64_5;
+    }
+
+    hash += size;
+    for (; p + 8 <= end; p += 8)
+        hash = rotl64(hash ^ xxh64_round(0, read64(p)), 27) * PRIME64_1 + PRIME64_4;
+    if (p + 4 <= end) {
+        hash = rotl64(hash ^ (read32(p) * PRIME64_1), 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        hash = rotl64(hash ^ (*p * PRIME64_5), 11) * PRIME64_1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+ * Computes the cache key of filtering an encoded bitmap
+ *
+ * Parameters:
+ *   file     - Encoded input, headers followed by the pixel rows, with the
+ *              padding of every row zeroed
+ *   size     - Bytes of the encoded input
+ *   pipeline - Filters applied to it
+ *   params   - Parameters of the filters
+ *
+ * Returns:
+ *   Hash of the input, the chain and every parameter, whether the chain
+ *   uses it or not
+ */
+uint64_t cache_key(const BYTE *file, size_t size, const PIPELINE *pipeline, const FILTER_PARAMS *params) {
+    uint64_t seed = cache_hash(pipeline->flags, pipeline->stages, CACHE_VERSION);
+    const int values[] = { params->radius, params->threshold, params->brightness, params->contrast };
+    seed = cache_hash(values, sizeof(values), seed);
+    seed = cache_hash(&params->gamma, sizeof(params->gamma), seed);
+
+    const KERNEL *kernel = params->kernel;
+    if (kernel != NULL) {
+        const int shape[] = { kernel->width, kernel->height, kernel->divisor, kernel->border, kernel->separable };
+        seed = cache_hash(shape, sizeof(shape), seed);
+        if (kernel->separable) {
+            seed = cache_hash(kernel->row, kernel->width * sizeof(int), seed);
+            seed = cache_hash(kernel->column, kernel->height * sizeof(int), seed);
+        } else {
+            seed = cache_hash(kernel->taps, (size_t)kernel->width * kernel->height * sizeof(int), seed);
+        }
+    }
+
+    return cache_hash(file, size, seed);
+}
+
+/*
+ * Writes the path of a cache entry, or of a temporary file for it, into a
+ * buffer of PATH_MAX bytes
+ * Returns non-zero if the whole path fitted.
+ */
+static int entry_path(const CACHE *cache, uint64_t key, const char *suffix, char *path) {
+    int length = snprintf(path, PATH_MAX, "%s/%016llx%s", cache->dir, (unsigned long long)key, suffix);
+    return length >= 0 && length < PATH_MAX;
+}
+
+/*
+ * Copies a cached entry to a stream
+ *
+ * Parameters:
+ *   cache - Cache
+ *   key   - Key from cache_key()
+ *   size  - Expected size of the entry; an entry of another size is stale
+ *   out   - Stream receiving the entry
+ *
+ * Returns:
+ *   SUCCESS on a hit, CACHE_MISS on a miss, or ERR_WRITE_DATA if the
+ *   stream could not take the whole entry
+ */
+int cache_fetch(const CACHE *cache, uint64_t key, size_t size, FILE *out) {
+    char path[PATH_MAX];
+    struct stat info;
+
+    FILE *file = entry_path(cache, key, CACHE_EXTENSION, path) ? fopen(path, "rb") : NULL;
+    if (file == NULL) {
+        stats_count(STATS_CACHE_MISSES, 0);
+        return CACHE_MISS;
+    }
+    if (fstat(fileno(file), &info) != 0 || (uint64_t)info.st_size != size) {
+        fclose(file);
+        stats_count(STATS_CACHE_MISSES, 0);
+        return CACHE_MISS;
+    }
+
+    // The caller has written nothing yet, so a failed read is still a miss
+    BYTE *block = malloc(size < IO_BLOCK_BYTES ? size : IO_BLOCK_BYTES);
+    int result = block != NULL ? SUCCESS : CACHE_MISS;
+    for (size_t done = 0; result == SUCCESS && done < size;) {
+        size_t bytes = size - done < IO_BLOCK_BYTES ? size - done : IO_BLOCK_BYTES;
+        if (fread(block, 1, bytes, file) != bytes) {
+            result = done == 0 ? CACHE_MISS : ERR_WRITE_DATA;
+        } else if (fwrite(block, 1, bytes, out) != bytes) {
+            result = ERR_WRITE_DATA;
+        }
+        done += bytes;
+    }
+
+    // Mark the entry as recently used
+    if (result == SUCCESS)
+        futimens(fileno(file), NULL);
+    free(block);
+    fclose(file);
+    stats_count(result == SUCCESS ? STATS_CACHE_HITS : STATS_CACHE_MISSES, result == SUCCESS ? size : 0);
+    return result;
+}
+
+/*
+ * Orders cache entries from the least to the most recently used
+ */
+static int compare_entries(const void *a, const void *b) {
+    const CACHE_ENTRY *x = a, *y = b;
+    if (x->used != y->used) {
+        return x->used < y->used ? -1 : 1;
+    }
+    return (x->used_ns > y->used_ns) - (x->used_ns < y->used_ns);
+}
+
+/*
+ * Removes the least recently used entries until the cache fits its bound
+ */
+static void cache_evict(const CACHE *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    CACHE_ENTRY *entries = NULL;
+    int count = 0, capacity = 0;
+    uint64_t total = 0;
+    const size_t suffix = strlen(CACHE_EXTENSION);
+    char path[PATH_MAX];
+    struct dirent *item;
+    struct stat info;
+
+    while ((item = readdir(dir)) != NULL) {
+        const char *name = item->d_name;
+        size_t length = strlen(name);
+        if (length != 16 + suffix || strcmp(name + 16, CACHE_EXTENSION) != 0 ||
+            strspn(name, "0123456789abcdef") != 16) {
+            continue;
+        }
+
+        if (snprintf(path, sizeof(path), "%s/%s", cache->dir, name) >= (int)sizeof(path) ||
+            stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            CACHE_ENTRY *grown = realloc(entries, capacity * sizeof(CACHE_ENTRY));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+
+        CACHE_ENTRY *entry = &entries[count++];
+        strcpy(entry->name, name);
+        entry->size = info.st_size;
+        entry->used = info.st_mtim.tv_sec;
+        entry->used_ns = info.st_mtim.tv_nsec;
+        total += entry->size;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof(CACHE_ENTRY), compare_entries);
+    for (int i = 0; i < count && total > cache->limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+        if (unlink(path) == 0)
+            total -= entries[i].size;
+    }
+    free(entries);
+}
+
+/*
+ * Adds an entry to the cache
+ *
+ * Parameters:
+ *   cache - Cache
+ *   key   - Key from cache_key()
+ *   data  - Output written for the key
+ *   size  - Bytes of output
+ *
+ * Description:
+ *   Outputs larger than the whole cache are not stored, though the cache is
+ *   still brought within its bound. The directory is created if it does not
+ *   exist yet.
+ */
+void cache_store(const CACHE *cache, uint64_t key, const BYTE *data, size_t size) {
+    char path[PATH_MAX], temp[PATH_MAX], suffix[CACHE_NAME_BYTES];
+
+    if (size > cache->limit) {
+        cache_evict(cache);
+        return;
+    }
+    mkdir(cache->dir, 0777);
+
+    // Unique per process, so that concurrent stores of one key do not mix
+    snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    if (!entry_path(cache, key, suffix, temp) || !entry_path(cache, key, CACHE_EXTENSION, path)) {
+        return;
+    }
+
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL) {
+        return;
+    }
+    int written = fwrite(data, 1, size, file) == size;
+    if (fclose(file) != 0 || !written || rename(temp, path) != 0) {
+        unlink(temp);
+        return;
+    }
+
+    cache_evict(cache);
+}
@@ -0,0 +1,107 @@
+/*
+ * context.c
+ * Implementation of the processing context.
+ *
+ * Every buffer keeps its largest size until the context is freed, so a
+ * driver that filters many images, or runs a chain of many stages, only
+ * allocates while the images keep growing. Filters report a failed
+ * allocation with ERR_MEMORY and leave the decision to the driver.
+ */
+
+#include "context.h"
+#include "bmpio.h"
+#include "stats.h"
+
+/*
+ * Initialises an empty context
+ *
+ * Parameters:
+ *   ctx  - Context to initialise
+ *   pool - Pool to split filter passes across, or NULL to run serially
+ */
+void context_init(CONTEXT *ctx, THREAD_POOL *pool) {
+    ctx->pool = pool;
+    ctx->image.data = NULL;
+    ctx->image.capacity = 0;
+    ctx->planes = ctx->temp = ctx->halo = ctx->integral = ctx->image;
+    ctx->work = NULL;
+    ctx->workers = 0;
+}
+
+/*
+ * Releases every buffer of a context (the pool is not owned)
+ */
+void context_free(CONTEXT *ctx) {
+    free(ctx->image.data);
+    free(ctx->planes.data);
+    free(ctx->temp.data);
+    free(ctx->halo.data);
+    free(ctx->integral.data);
+    for (int w = 0; w < ctx->workers; w++)
+        free(ctx->work[w].data);
+    free(ctx->work);
+    context_init(ctx, ctx->pool);
+}
+
+/*
+ * Grows a buffer to hold at least `size` bytes
+ *
+ * Parameters:
+ *   buffer - Buffer to grow
+ *   size   - Bytes needed
+ *
+ * Returns:
+ *   The buffer memory, aligned to CONTEXT_ALIGNMENT, or NULL if it cannot
+ *   be allocated (the buffer is then left empty)
+ *
+ * Description:
+ *   The contents are not preserved when the buffer grows
+ */
+uint8_t *context_buffer(BUFFER *buffer, size_t size) {
+    if (size <= buffer->capacity && buffer->data != NULL) {
+        return buffer->data;
+    }
+
+    // aligned_alloc() needs a non-zero multiple of the alignment
+    size = (size / CONTEXT_ALIGNMENT + 1) * CONTEXT_ALIGNMENT;
+    free(buffer->data);
+    buffer->data = aligned_alloc(CONTEXT_ALIGNMENT, size);
+    buffer->capacity = buffer->data != NULL ? size : 0;
+    stats_count(STATS_ALLOCS, size);
+    return buffer->data;
+}
+
+/*
+ * Reserves a work buffer of at least `size` bytes for every pool thread
+ *
+ * Parameters:
+ *   ctx  - Context
+ *   size - Bytes each tile kernel may use
+ *
+ * Returns:
+ *   Error code (SUCCESS if reserved, ERR_MEMORY on allocation failure)
+ */
+int context_reserve_work(CONTEXT *ctx, size_t size) {
+    int workers = thread_pool_size(ctx->pool);
+
+    if (workers > ctx->workers) {
+        BUFFER *work = realloc(ctx->work, workers * sizeof(BUFFER));
+        if (work == NULL) {
+            return ERR_MEMORY;
+        }
+        for (int w = ctx->workers; w < workers; w++) {
+            work[w].data = NULL;
+            work[w].capacity = 0;
+        }
+        ctx->work = work;
+        ctx->workers = workers;
+    }
+
+    for (int w = 0; w < workers; w++) {
+        if (context_buffer(&ctx->work[w], size) == NULL) {
+            return ERR_MEMORY;
+        }
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,672 @@
+/*
+ * convolve.c
+ * Implementation of the convolution engine.
+ *
+ * A kernel is parsed once into integer taps: fixed-point taps are scaled by
+ * a common power of ten, together with their divisor, so every sum is exact
+ * integer arithmetic, and so is the rounded division of each sum by its
+ * pixel's divisor. Kernels whose taps factor into a column times a row
+ * are detected when they are parsed and run as a vertical pass into 32-bit
+ * sums followed by a horizontal pass, costing width + height instead of
+ * width * height multiplications per byte.
+ *
+ * Each output row is split into regions. The kernel rows above and below
+ * the image are resolved once per row into pointers, to the clamped edge
+ * row or to a row of zeros, so no region checks rows. The interior columns,
+ * whose window lies inside the image horizontally, run convolve_span():
+ * one multiply-add per tap over whole rows of interleaved bytes, with no
+ * branches, which the compiler vectorises. Only the border columns, fewer
+ * than the kernel width, check each tap against the image.
+ *
+ * Box kernels averaging the in-bounds pixels, the blur filter among them,
+ * are recognised and handed to the running-sum box blur of filters.c, whose
+ * cost per pixel does not depend on the radius.
+ */
+
+#include "convolve.h"
+#include "bmpio.h"
+
+#include <limits.h>
+#include <string.h>
+
+/* Output range */
+#define MAX_RGB_VALUE 255    /* Maximum value for RGB components */
+
+/*
+ * Data shared by all bands of one convolution pass
+ */
+typedef struct {
+    CONTEXT      *ctx;       /* Processing context */
+    const KERNEL *kernel;    /* Kernel to apply */
+    const IMAGE  *src;       /* Image being read */
+    const IMAGE  *dst;       /* Image being written (never src) */
+    int           bands;     /* Number of row bands of the pass */
+    long long     total;     /* Sum of the taps */
+} CONVOLVE_JOB;
+
+/*
+ * Parses one tap or divisor: an optional sign, digits and up to
+ * MAX_KERNEL_DECIMALS fractional digits
+ * Returns the position after the number, or NULL if there is none.
+ */
+static const char *parse_number(const char *text, long long *mantissa, int *decimals) {
+    const char *p = text;
+    int negative = *p == '-';
+    int digits = 0, fraction = -1;
+
+    if (*p == '-' || *p == '+')
+        p++;
+
+    *mantissa = 0;
+    for (;; p++) {
+        if (*p == '.' && fraction < 0) {
+            fraction = 0;
+            continue;
+        }
+        if (*p < '0' || *p > '9')
+            break;
+        if (fraction == MAX_KERNEL_DECIMALS || *mantissa > MAX_KERNEL_WEIGHT) {
+            return NULL;
+        }
+        *mantissa = *mantissa * 10 + (*p - '0');
+        digits++;
+        if (fraction >= 0)
+            fraction++;
+    }
+
+    if (digits == 0) {
+        return NULL;
+    }
+    if (negative)
+        *mantissa = -*mantissa;
+    *decimals = fraction > 0 ? fraction : 0;
+    return p;
+}
+
+/*
+ * Returns the greatest common divisor of two non-negative integers
+ */
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/*
+ * Stores the taps of a kernel as a column times a row if they factor so
+ * The row is the first non-zero row of taps divided by the gcd of its
+ * entries, with its first non-zero entry positive; the kernel is separable
+ * when every row of taps is an integer multiple of it.
+ */
+static void kernel_factor(KERNEL *kernel, const int *taps) {
+    const int width = kernel->width;
+    const int height = kernel->height;
+    int first = 0, lead = 0;
+
+    kernel->separable = 0;
+    while (first < width * height && taps[first] == 0)
+        first++;
+    if (first == width * height) {
+        return;
+    }
+
+    const int *base = taps + first / width * width;
+    int g = 0;
+    for (int j = 0; j < width; j++)
+        g = gcd(g, base[j] < 0 ? -base[j] : base[j]);
+    while (base[lead] == 0)
+        lead++;
+    if (base[lead] < 0)
+        g = -g;
+
+    for (int j = 0; j < width; j++)
+        kernel->row[j] = base[j] / g;
+    for (int i = 0; i < height; i++) {
+        if (taps[i * width + lead] % kernel->row[lead] != 0) {
+            return;
+        }
+        kernel->column[i] = taps[i * width + lead] / kernel->row[lead];
+        for (int j = 0; j < width; j++) {
+            if (kernel->column[i] * kernel->row[j] != taps[i * width + j]) {
+                return;
+            }
+        }
+    }
+
+    kernel->separable = 1;
+}
+
+/*
+ * Parses a kernel
+ *
+ * Parameters:
+ *   text   - Rows of taps separated by ';' or newlines, taps separated by
+ *            ',' or blanks, e.g. "1,2,1;2,4,2;1,2,1/16" or "0 .25 0"; a
+ *            '#' starts a comment running to the end of the line
+ *   kernel - Receives the kernel, with BORDER_CLAMP borders
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_ARGS if the rows are ragged or of even
+ *   length, there are more than MAX_KERNEL_TAPS taps, their magnitudes sum
+ *   to more than MAX_KERNEL_WEIGHT, or the divisor is not positive)
+ *
+ * Description:
+ *   Taps and divisor may have up to MAX_KERNEL_DECIMALS fractional digits;
+ *   all of them are then scaled by the same power of ten. Without a
+ *   divisor, a kernel whose taps sum to a positive value is normalised by
+ *   that sum, and any other kernel divides by 1.
+ */
+int kernel_parse(const char *text, KERNEL *kernel) {
+    static const long long powers[MAX_KERNEL_DECIMALS + 1] = { 1, 10, 100, 1000, 10000 };
+    long long mantissa[MAX_KERNEL_TAPS];
+    int decimals[MAX_KERNEL_TAPS];
+    long long divisor = 0;
+    int divisor_decimals = 0, scale = 0;
+    int count = 0, rows = 0, width = 0, row_taps = 0;
+    int comma = 0, divided = 0;
+    const char *p = text;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+
+        if (*p == '#') {
+            while (*p != '\0' && *p != '\n')
+                p++;
+        } else if (*p == ';' || *p == '\n' || *p == '\0') {
+            // A row ends; blank lines and trailing separators are ignored
+            if (comma) {
+                return ERR_ARGS;
+            }
+            if (row_taps > 0) {
+                if (rows > 0 && row_taps != width) {
+                    return ERR_ARGS;
+                }
+                width = row_taps;
+                rows++;
+                row_taps = 0;
+            }
+            if (*p++ == '\0')
+                break;
+        } else if (*p == ',' && row_taps > 0 && !comma) {
+            comma = 1;
+            p++;
+        } else if (*p == '/' && count > 0 && !comma && !divided) {
+            p = parse_number(p + 1, &divisor, &divisor_decimals);
+            if (p == NULL || divisor <= 0) {
+                return ERR_ARGS;
+            }
+            divided = 1;
+            scale = divisor_decimals > scale ? divisor_decimals : scale;
+        } else {
+            if (divided || count == MAX_KERNEL_TAPS) {
+                return ERR_ARGS;
+            }
+            p = parse_number(p, &mantissa[count], &decimals[count]);
+            if (p == NULL) {
+                return ERR_ARGS;
+            }
+            scale = decimals[count] > scale ? decimals[count] : scale;
+            count++;
+            row_taps++;
+            comma = 0;
+        }
+    }
+
+    if (rows == 0 || width % 2 == 0 || rows % 2 == 0) {
+        return ERR_ARGS;
+    }
+
+    // Scale every number to the common number of decimals
+    int taps[MAX_KERNEL_TAPS];
+    long long weight = 0, sum = 0;
+    for (int k = 0; k < count; k++) {
+        long long tap = mantissa[k] * powers[scale - decimals[k]];
+        weight += tap < 0 ? -tap : tap;
+        sum += tap;
+        if (weight > MAX_KERNEL_WEIGHT) {
+            return ERR_ARGS;
+        }
+        taps[k] = (int)tap;
+    }
+
+    if (divided)
+        divisor *= powers[scale - divisor_decimals];
+    else
+        divisor = sum > 0 ? sum : powers[scale];
+    if (divisor > INT_MAX) {
+        return ERR_ARGS;
+    }
+
+    kernel->width = width;
+    kernel->height = rows;
+    kernel->divisor = (int)divisor;
+    kernel->border = BORDER_CLAMP;
+    memcpy(kernel->taps, taps, count * sizeof(int));
+    kernel_factor(kernel, taps);
+    return SUCCESS;
+}
+
+/*
+ * Reads a kernel from a file in the syntax of kernel_parse()
+ *
+ * Parameters:
+ *   path   - Kernel file, at most MAX_KERNEL_FILE bytes
+ *   kernel - Receives the kernel
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS if the file cannot be read, is too large
+ *   or does not hold a valid kernel, ERR_MEMORY if it cannot be buffered)
+ */
+int kernel_load(const char *path, KERNEL *kernel) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return ERR_ARGS;
+    }
+
+    char *text = malloc(MAX_KERNEL_FILE + 1);
+    if (text == NULL) {
+        fclose(file);
+        return ERR_MEMORY;
+    }
+
+    size_t size = fread(text, 1, MAX_KERNEL_FILE + 1, file);
+    int result = ferror(file) || size > MAX_KERNEL_FILE || memchr(text, '\0', size) != NULL ? ERR_ARGS : SUCCESS;
+    fclose(file);
+
+    if (result == SUCCESS) {
+        text[size] = '\0';
+        result = kernel_parse(text, kernel);
+    }
+
+    free(text);
+    return result;
+}
+
+/*
+ * Parses a border mode name ("zero", "clamp" or "skip")
+ * Returns SUCCESS, or ERR_ARGS if name is none of them.
+ */
+int kernel_border(const char *name, BORDER_MODE *border) {
+    static const char *const names[] = { [BORDER_ZERO] = "zero", [BORDER_CLAMP] = "clamp", [BORDER_SKIP] = "skip" };
+
+    for (int mode = BORDER_ZERO; mode <= BORDER_SKIP; mode++) {
+        if (strcmp(name, names[mode]) == 0) {
+            *border = mode;
+            return SUCCESS;
+        }
+    }
+    return ERR_ARGS;
+}
+
+/*
+ * Builds the kernel of a box blur: the average of the in-bounds pixels of
+ * the (2 * radius + 1)^2 window, for a radius of 1 to MAX_BLUR_RADIUS
+ */
+void kernel_box(KERNEL *kernel, int radius) {
+    const int size = 2 * radius + 1;
+
+    kernel->width = size;
+    kernel->height = size;
+    kernel->divisor = size * size;
+    kernel->border = BORDER_SKIP;
+    kernel->separable = 1;
+    for (int k = 0; k < MAX_KERNEL_SIZE; k++)
+        kernel->row[k] = kernel->column[k] = k < size;
+}
+
+/*
+ * Returns the radius of a box kernel averaging the in-bounds pixels of a
+ * square window, or 0 if the kernel is not one
+ */
+static int box_radius(const KERNEL *kernel) {
+    if (!kernel->separable || kernel->border != BORDER_SKIP || kernel->width != kernel->height) {
+        return 0;
+    }
+
+    for (int k = 0; k < kernel->width; k++) {
+        if (kernel->row[k] != kernel->row[0] || kernel->column[k] != kernel->column[0]) {
+            return 0;
+        }
+    }
+
+    long long tap = (long long)kernel->row[0] * kernel->column[0];
+    return tap > 0 && kernel->divisor == tap * kernel->width * kernel->height ? kernel->width / 2 : 0;
+}
+
+/*
+ * Returns the entries of the work buffer convolve_span() needs
+ */
+size_t convolve_span_work(const KERNEL *kernel, int step, int count) {
+    return kernel->separable ? (size_t)count + (size_t)(kernel->width - 1) * step : 0;
+}
+
+/*
+ * Computes the kernel sums of a run of outputs without bounds checks
+ *
+ * Parameters:
+ *   kernel - Kernel to apply; its divisor and border mode are not used
+ *   rows   - One pointer per kernel row to the byte under the top-left tap
+ *            of output 0
+ *   step   - Bytes between two horizontally adjacent taps (the pixel size)
+ *   count  - Number of outputs; output t reads the bytes t + j * step
+ *   out    - Receives the sums of the outputs
+ *   work   - convolve_span_work() entries of scratch memory for separable
+ *            kernels
+ *
+ * Description:
+ *   Consecutive outputs are consecutive bytes, so a run over interleaved
+ *   pixels computes every channel at once. Each tap is one multiply-add
+ *   over the whole run; a separable kernel first sums its column taps into
+ *   work, then its row taps from there.
+ */
+void convolve_span(const KERNEL *kernel, const BYTE *const *rows, int step, int count, int32_t *out,
+                   int32_t *work) {
+    const int width = kernel->width;
+    const int height = kernel->height;
+
+    memset(out, 0, count * sizeof(int32_t));
+
+    if (kernel->separable) {
+        const int span = count + (width - 1) * step;
+        memset(work, 0, span * sizeof(int32_t));
+        for (int i = 0; i < height; i++) {
+            const int32_t tap = kernel->column[i];
+            const BYTE *in = rows[i];
+            if (tap != 0) {
+                for (int t = 0; t < span; t++)
+                    work[t] += tap * in[t];
+            }
+        }
+        for (int j = 0; j < width; j++) {
+            const int32_t tap = kernel->row[j];
+            const int32_t *in = work + j * step;
+            if (tap != 0) {
+                for (int t = 0; t < count; t++)
+                    out[t] += tap * in[t];
+            }
+        }
+        return;
+    }
+
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            const int32_t tap = kernel->taps[i * width + j];
+            const BYTE *in = rows[i] + j * step;
+            if (tap != 0) {
+                for (int t = 0; t < count; t++)
+                    out[t] += tap * in[t];
+            }
+        }
+    }
+}
+
+/*
+ * Divisor of one pixel, the exact fraction denominator / scale
+ */
+typedef struct {
+    int64_t scale;           /* Factor of the sums */
+    int64_t denominator;     /* Positive divisor of the scaled sums */
+} PIXEL_DIVISOR;
+
+/*
+ * Returns a sum divided by the divisor of its pixel, rounded half up and
+ * clamped to a byte
+ * Sums are below 2^31 and scales at most MAX_KERNEL_WEIGHT, so the scaled
+ * sum and twice the denominator fit in 64 bits.
+ */
+static inline BYTE convolve_store(int32_t sum, PIXEL_DIVISOR divisor) {
+    if (sum <= 0) {
+        return 0;
+    }
+    // Most kernels are small enough for the narrower, faster division
+    if (divisor.scale == 1 && divisor.denominator <= MAX_KERNEL_WEIGHT && sum < 1 << 30) {
+        uint32_t q = (2 * (uint32_t)sum + (uint32_t)divisor.denominator) / (2 * (uint32_t)divisor.denominator);
+        return q >= MAX_RGB_VALUE ? MAX_RGB_VALUE : (BYTE)q;
+    }
+    int64_t q = (2 * (int64_t)sum * divisor.scale + divisor.denominator) / (2 * divisor.denominator);
+    return q >= MAX_RGB_VALUE ? MAX_RGB_VALUE : (BYTE)q;
+}
+
+/*
+ * Returns the divisor of a pixel whose in-bounds taps weigh `weight`
+ * Outside BORDER_SKIP, or for kernels without a positive total weight,
+ * every pixel divides by the kernel's divisor; a clipped BORDER_SKIP pixel
+ * divides by divisor * weight / total.
+ */
+static PIXEL_DIVISOR pixel_divisor(const CONVOLVE_JOB *job, long long weight) {
+    const KERNEL *kernel = job->kernel;
+
+    if (kernel->border != BORDER_SKIP || job->total <= 0 || weight <= 0 || weight == job->total) {
+        return (PIXEL_DIVISOR){ 1, kernel->divisor };
+    }
+    return (PIXEL_DIVISOR){ job->total, (int64_t)kernel->divisor * weight };
+}
+
+/*
+ * Computes the sums of a border pixel, checking each tap against the image
+ * Kernel rows [i0, i1) are inside the image; the others point at clamped or
+ * zero rows. Returns the weight of the in-bounds taps.
+ */
+static long long border_pixel(const CONVOLVE_JOB *job, const BYTE *const *rows, int i0, int i1, int x,
+                              int32_t *out) {
+    const KERNEL *kernel = job->kernel;
+    const int channels = job->src->channels;
+    const int width = job->src->width;
+    const int rx = kernel->width / 2;
+    int32_t sum[3] = { 0, 0, 0 };
+    long long weight = 0;
+
+    for (int j = 0; j < kernel->width; j++) {
+        int column = x + j - rx;
+        if (column < 0 || column >= width) {
+            if (kernel->border != BORDER_CLAMP)
+                continue;
+            column = column < 0 ? 0 : width - 1;
+        }
+
+        for (int i = 0; i < kernel->height; i++) {
+            const int tap = kernel_tap(kernel, i, j);
+            const BYTE *pixel = rows[i] + (size_t)column * channels;
+            sum[CHANNEL_BLUE] += tap * pixel[CHANNEL_BLUE];
+            sum[CHANNEL_GREEN] += tap * pixel[CHANNEL_GREEN];
+            sum[CHANNEL_RED] += tap * pixel[CHANNEL_RED];
+            if (i >= i0 && i < i1)
+                weight += tap;
+        }
+    }
+
+    memcpy(out, sum, sizeof(sum));
+    return weight;
+}
+
+/*
+ * Convolution pass over rows [begin, end) of the destination window
+ *
+ * The work buffer of the band holds the sums of one output row, the
+ * scratch memory of convolve_span() and a row of zeros standing for the
+ * rows outside the image.
+ */
+static void convolve_band(void *arg, int begin, int end) {
+    CONVOLVE_JOB *job = arg;
+    const KERNEL *kernel = job->kernel;
+    const IMAGE *src = job->src;
+    const int channels = src->channels;
+    const int width = src->width;
+    const int height = src->height;
+    const int rx = kernel->width / 2;
+    const int ry = kernel->height / 2;
+    const size_t bytes = image_row_bytes(src);
+    const int band = thread_pool_band_index(job->dst->rows, job->bands, begin);
+
+    int32_t *sums = (int32_t *)context_work(job->ctx, band);
+    int32_t *work = sums + bytes;
+    BYTE *zero = (BYTE *)(work + bytes);
+    memset(zero, 0, bytes);
+
+    // Columns [a, b) have their whole window inside the image
+    const int a = rx < width ? rx : width;
+    const int b = width - rx > a ? width - rx : a;
+
+    const BYTE *rows[MAX_KERNEL_SIZE];
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+
+    for (int y = begin; y < end; y++) {
+        // Kernel rows [i0, i1) are inside the image
+        const int i0 = ry - y > 0 ? ry - y : 0;
+        const int i1 = height - y + ry < kernel->height ? height - y + ry : kernel->height;
+        for (int i = 0; i < kernel->height; i++) {
+            int k = y + i - ry;
+            if (i >= i0 && i < i1)
+                rows[i] = image_row(src, k);
+            else
+                rows[i] = kernel->border == BORDER_CLAMP ? image_row(src, k < 0 ? 0 : height - 1) : zero;
+        }
+
+        // Interior: the rows start at the window of column a = rx
+        if (b > a)
+            convolve_span(kernel, rows, channels, (b - a) * channels, sums + (size_t)a * channels, work);
+
+        BYTE *out = image_row(job->dst, y);
+        const BYTE *in = image_row(src, y);
+        for (int x = 0; x < width; x++) {
+            if (x == a)
+                x = b;
+            if (x == width)
+                break;
+            int32_t pixel[3];
+            PIXEL_DIVISOR divisor = pixel_divisor(job, border_pixel(job, rows, i0, i1, x, pixel));
+            for (int c = 0; c < 3; c++)
+                out[(size_t)x * channels + c] = convolve_store(pixel[c], divisor);
+        }
+
+        if (b > a) {
+            long long weight = 0;
+            for (int i = i0; i < i1 && kernel->border == BORDER_SKIP; i++) {
+                for (int j = 0; j < kernel->width; j++)
+                    weight += kernel_tap(kernel, i, j);
+            }
+            const PIXEL_DIVISOR divisor = pixel_divisor(job, weight);
+            for (size_t k = (size_t)a * channels; k < (size_t)b * channels; k++)
+                out[k] = convolve_store(sums[k], divisor);
+        }
+
+        // The interior loop also wrote the alpha bytes
+        if (channels == PIXEL_BGRA) {
+            for (int x = 0; x < width; x++)
+                out[(size_t)x * channels + CHANNEL_ALPHA] = in[(size_t)x * channels + CHANNEL_ALPHA];
+        }
+    }
+}
+
+/*
+ * Runs the convolution bands of a destination window that is not the source
+ */
+static int convolve_run(CONTEXT *ctx, const KERNEL *kernel, const IMAGE *src, const IMAGE *dst) {
+    const size_t bytes = image_row_bytes(src);
+    int result = context_reserve_work(ctx, bytes * (2 * sizeof(int32_t) + 1));
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    CONVOLVE_JOB job = { ctx, kernel, src, dst, thread_pool_bands(ctx->pool, dst->rows), 0 };
+    for (int i = 0; i < kernel->height; i++) {
+        for (int j = 0; j < kernel->width; j++)
+            job.total += kernel_tap(kernel, i, j);
+    }
+
+    thread_pool_run(ctx->pool, dst->rows, convolve_band, &job);
+    return SUCCESS;
+}
+
+/*
+ * Returns non-zero if a kernel reads the same taps upside down
+ */
+static int kernel_symmetric(const KERNEL *kernel) {
+    for (int i = 0; i < kernel->height / 2; i++) {
+        for (int j = 0; j < kernel->width; j++) {
+            if (kernel_tap(kernel, i, j) != kernel_tap(kernel, kernel->height - 1 - i, j)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Copies a kernel upside down: row i of the copy is row height - 1 - i
+ */
+static void kernel_flip(const KERNEL *kernel, KERNEL *flipped) {
+    const int width = kernel->width;
+    const int height = kernel->height;
+
+    flipped->width = width;
+    flipped->height = height;
+    flipped->divisor = kernel->divisor;
+    flipped->border = kernel->border;
+    flipped->separable = kernel->separable;
+    if (kernel->separable) {
+        memcpy(flipped->row, kernel->row, width * sizeof(int));
+        for (int i = 0; i < height; i++)
+            flipped->column[i] = kernel->column[height - 1 - i];
+    } else {
+        for (int i = 0; i < height; i++)
+            memcpy(flipped->taps + i * width, kernel->taps + (height - 1 - i) * width, width * sizeof(int));
+    }
+}
+
+/*
+ * Convolves an image with a kernel
+ *
+ * Parameters:
+ *   ctx       - Processing context
+ *   kernel    - Kernel to apply, from kernel_parse(), kernel_load() or
+ *               kernel_box(); row 0 is the top row of the window
+ *   bottom_up - Non-zero if the first row of the views is the bottom row
+ *               of the picture
+ *   src       - Image to read
+ *   dst       - Image to write (may be src)
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY if the working memory cannot be
+ *   allocated, in which case dst is left unchanged)
+ *
+ * Description:
+ *   A source window must hold kernel->height / 2 rows of context above and
+ *   below the rows written. In place, the image is convolved into the
+ *   context's staging image and copied back, as blur_radius() does.
+ */
+int convolve(CONTEXT *ctx, const KERNEL *kernel, int bottom_up, const IMAGE *src, const IMAGE *dst) {
+    int radius = box_radius(kernel);
+    if (radius != 0) {
+        return box_blur(ctx, src, dst, radius);
+    }
+
+    // The bands apply kernel row i to view row y + i - ry, which runs upwards in a bottom-up view
+    KERNEL flipped;
+    if (bottom_up && !kernel_symmetric(kernel)) {
+        kernel_flip(kernel, &flipped);
+        kernel = &flipped;
+    }
+
+    if (src->data != dst->data) {
+        return convolve_run(ctx, kernel, src, dst);
+    }
+
+    IMAGE temp = image_view(NULL, image_row_bytes(src), src->channels, src->width, src->height);
+    temp.data = context_buffer(&ctx->temp, src->height * temp.stride);
+    temp.first_row = dst->first_row;
+    temp.rows = dst->rows;
+    if (temp.data == NULL) {
+        return ERR_MEMORY;
+    }
+
+    int result = convolve_run(ctx, kernel, src, &temp);
+    if (result == SUCCESS)
+        copy_image(ctx, &temp, dst);
+    return result;
+}
@@ -3,13 +3,164 @@
  * Author: Gokberk Gultekin
  * Date: December 16, 2024
  * Implementation of the functions to apply filters to BMP files.
+ *
+ * Every filter reads a source view and writes a destination view of the
+ * same size; the two may be the same view to filter in place. Views carry a
+ * row stride, so filters can run directly on padded BMP rows, and may cover
+ * only a window of the image, so the streaming driver can run the same
+ * filters on a bounded ring buffer of rows.
+ *
+ * Pixels are 3-byte BGR or 4-byte BGRA. The per-pixel loops are written
+ * once as KERNEL_TEMPLATE functions of the pixel size, and the blur loop
+ * also of its radius, and are instantiated at the end of this file for
+ * every format of PIXEL_FORMATS and every radius of BLUR_RADII, so each
+ * combination gets its own loop with fixed offsets and a fully unrolled
+ * window. Each filter picks the kernels of its format from one table,
+ * kernels_of(), so no band or tile branches on the format; alpha is copied
+ * along with its pixel and never filtered.
+ *
+ * Blur and the Sobel step of edges are convolutions and are built on the
+ * engine of convolve.c: a blur is the box kernel, which the engine hands
+ * back to the running-sum tiles below, and the Sobel gradients are two
+ * separable 3x3 kernels run on zero-padded luminance rows. Invert,
+ * threshold and levels are point operations of the table engine of lut.c.
+ *
+ * Every filter pass is written as a band function over a range of rows and
+ * dispatched through the thread pool of the processing context, and takes
+ * its working memory from the context's buffers rather than allocating.
+ * Passes that read neighbouring pixels always read from an unmodified source
+ * buffer, so the rows a band reads from its neighbours (its halo) are the
+ * same as in the serial path and the output does not depend on the thread
+ * count.
  */
 
 #include "filters.h"
+#include "bmpio.h"
+#include "convolve.h"
+#include "lut.h"
+#include "planar.h"
+#include "simd.h"
+#include "stats.h"
+#include "tile.h"
+
+#include <string.h>
 
 /* Constants for image processing */
-#define AVG_DIVISOR 3.0f     /* Floating point divisor for grayscale average calculation */
 #define MAX_RGB_VALUE 255    /* Maximum value for RGB components */
+#define EDGES_HALO 2         /* Rows of context edges() needs on each side (Sobel + blur) */
+#define SOBEL_WRAP 65281     /* Smallest gx^2 + gy^2 whose rounded magnitude exceeds 255 */
+
+/*
+ * Data shared by all bands of one filter pass
+ */
+typedef struct {
+    CONTEXT     *ctx;        /* Processing context */
+    const IMAGE *src;        /* Image being read */
+    const IMAGE *dst;        /* Image being written (may be src) */
+    int          radius;     /* Blur radius */
+} FILTER_JOB;
+
+/*
+ * Kernels specialised for one pixel format
+ * blur[r] is the tile kernel unrolled for radius r, up to MAX_FIXED_RADIUS;
+ * blur[0] handles any radius.
+ */
+typedef struct {
+    BAND_FN  grayscale;                   /* Grayscale band */
+    BAND_FN  reflect;                     /* Reflection band */
+    BAND_FN  reflect_grayscale;           /* Fused grayscale and reflection band */
+    void   (*reflect_tail)(const BYTE *in, BYTE *out, int from, int width); /* Scalar end of reflect_row() */
+    TILE_FN  blur[MAX_FIXED_RADIUS + 1];  /* Box blur tile by radius */
+    TILE_FN  edges;                       /* Fused edges tile */
+} FORMAT_KERNELS;
+
+static const FORMAT_KERNELS *kernels_of(int channels);
+
+/*
+ * Sobel gradient kernels, applied to luminance rows padded with a zero
+ * column on each side
+ */
+static const KERNEL sobel_x = {
+    .width = 3, .height = 3, .divisor = 1, .border = BORDER_ZERO, .separable = 1,
+    .row = { -1, 0, 1 }, .column = { 1, 2, 1 },
+};
+static const KERNEL sobel_y = {
+    .width = 3, .height = 3, .divisor = 1, .border = BORDER_ZERO, .separable = 1,
+    .row = { 1, 2, 1 }, .column = { -1, 0, 1 },
+};
+
+/*
+ * Reports the rows of context a filter needs
+ *
+ * Parameters:
+ *   flag   - Filter type flag ('b', 'c', 'e', 'g', 'i', 'l', 'r' or 't')
+ *   params - Filter parameters
+ *
+ * Returns:
+ *   Number of source rows above and below each output row that the filter
+ *   reads (0 for point filters)
+ */
+int filter_context(char flag, const FILTER_PARAMS *params) {
+    switch (flag) {
+        case 'b':
+            return params->radius;
+        case 'c':
+            return params->kernel != NULL ? params->kernel->height / 2 : 0;
+        case 'e':
+            return EDGES_HALO;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Computes the luminance of a pixel (L = 0.299R + 0.587G + 0.114B, rounded)
+ */
+static inline uint8_t luminance_of(int red, int green, int blue) {
+    float luminance = LUMA_RED * red +
+                      LUMA_GREEN * green +
+                      LUMA_BLUE * blue;
+    return round(luminance);
+}
+
+/*
+ * Converts pixels [from, width) of a row to grayscale
+ */
+KERNEL_TEMPLATE void grayscale_pixels(const BYTE *in, BYTE *out, int from, int width, const int channels) {
+    for (int j = from; j < width; j++) {
+        const BYTE *pixel = in + (size_t)j * channels;
+        BYTE *gray = out + (size_t)j * channels;
+        uint8_t gray_value = gray_of(pixel[CHANNEL_RED], pixel[CHANNEL_GREEN], pixel[CHANNEL_BLUE]);
+
+        if (channels == PIXEL_BGRA)
+            gray[CHANNEL_ALPHA] = pixel[CHANNEL_ALPHA];
+        gray[CHANNEL_BLUE] = gray_value;
+        gray[CHANNEL_GREEN] = gray_value;
+        gray[CHANNEL_RED] = gray_value;
+    }
+}
+
+/*
+ * Converts a row to grayscale
+ * Uses the vectorised row kernel when the CPU has one; the scalar loop
+ * finishes the row.
+ */
+KERNEL_TEMPLATE void grayscale_row(ROW_KERNEL kernel, const BYTE *in, BYTE *out, int width, const int channels) {
+    int j = kernel != NULL ? kernel(in, out, width) : 0;
+    grayscale_pixels(in, out, j, width, channels);
+}
+
+/*
+ * Grayscale pass over rows [begin, end)
+ */
+KERNEL_TEMPLATE void grayscale_rows(FILTER_JOB *job, int begin, int end, const int channels) {
+    ROW_KERNEL kernel = simd_grayscale_row(channels);
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+
+    for (int i = begin; i < end; i++)
+        grayscale_row(kernel, image_row(job->src, i), image_row(job->dst, i), job->src->width, channels);
+}
 
 /*
  * Converts an image to grayscale by averaging RGB values.
@@ -19,255 +170,844 @@
  * color channels.
  *
  * Parameters:
- *   height - Number of rows in the image
- *   width - Number of columns in the image
- *   image - The 2D array of RGBTRIPLE pixels to be modified
- */
-void grayscale(int height, int width, RGBTRIPLE image[height][width]) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            float avg = (image[i][j].rgbtRed + image[i][j].rgbtGreen + image[i][j].rgbtBlue) / AVG_DIVISOR;
-            uint8_t gray_value = round(avg);
-
-            image[i][j].rgbtBlue = gray_value;
-            image[i][j].rgbtGreen = gray_value;
-            image[i][j].rgbtRed = gray_value;
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src)
+ */
+void grayscale(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    FILTER_JOB job = { ctx, src, dst, 0 };
+    thread_pool_run(ctx->pool, dst->rows, kernels_of(src->channels)->grayscale, &job);
+}
+
+/*
+ * Reverses pixels [from, width - from) of a row
+ */
+KERNEL_TEMPLATE void reflect_pixels(const BYTE *in, BYTE *out, int from, int width, const int channels) {
+    if (in == out) {
+        for (int left = from, right = width - 1 - from; left < right; left++, right--) {
+            BYTE temp[PIXEL_BGRA];
+            memcpy(temp, out + (size_t)left * channels, channels);
+            memcpy(out + (size_t)left * channels, out + (size_t)right * channels, channels);
+            memcpy(out + (size_t)right * channels, temp, channels);
         }
+    } else {
+        for (int k = from; k < width - from; k++)
+            memcpy(out + (size_t)k * channels, in + (size_t)(width - 1 - k) * channels, channels);
     }
 }
 
+/*
+ * Reverses a row with the row kernel, then the middle with the scalar loop
+ */
+KERNEL_TEMPLATE void reflect_row_of(ROW_KERNEL kernel, const BYTE *in, BYTE *out, int width, const int channels) {
+    int j = kernel != NULL ? kernel(in, out, width) : 0;
+    reflect_pixels(in, out, j, width, channels);
+}
+
+/*
+ * Reverses the pixels of a row
+ *
+ * Parameters:
+ *   in       - Row to read
+ *   out      - Row to write (may be in)
+ *   width    - Row width in pixels
+ *   channels - Bytes per pixel (PIXEL_BGR or PIXEL_BGRA)
+ *
+ * Description:
+ *   The row kernel reverses blocks from both ends and leaves the middle,
+ *   shorter than two blocks, to the scalar loops.
+ */
+void reflect_row(const BYTE *in, BYTE *out, int width, int channels) {
+    ROW_KERNEL kernel = simd_reflect_row(channels);
+    int j = kernel != NULL ? kernel(in, out, width) : 0;
+    kernels_of(channels)->reflect_tail(in, out, j, width);
+}
+
+/*
+ * Reflection pass over rows [begin, end)
+ */
+KERNEL_TEMPLATE void reflect_rows(FILTER_JOB *job, int begin, int end, const int channels) {
+    ROW_KERNEL kernel = simd_reflect_row(channels);
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+
+    for (int i = begin; i < end; i++)
+        reflect_row_of(kernel, image_row(job->src, i), image_row(job->dst, i), job->src->width, channels);
+}
+
 /*
  * Reflects the image horizontally.
  *
  * Swaps pixels on horizontal axis, from left to right, effectively
- * creating a mirror image. Only processes up to the middle column
- * to avoid double-swapping.
+ * creating a mirror image. In place, only processes up to the middle
+ * column to avoid double-swapping.
  *
  * Parameters:
- *   height - Number of rows in the image
- *   width - Number of columns in the image
- *   image - The 2D array of RGBTRIPLE pixels to be modified
- */
-void reflect(int height, int width, RGBTRIPLE image[height][width]) {
-    for (int i = 0; i < height; i++) {
-        for (int left = 0, right = width - 1; left < right; left++, right--) {
-            RGBTRIPLE temp = image[i][left];
-            image[i][left] = image[i][right];
-            image[i][right] = temp;
-        }
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src)
+ */
+void reflect(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    FILTER_JOB job = { ctx, src, dst, 0 };
+    thread_pool_run(ctx->pool, dst->rows, kernels_of(src->channels)->reflect, &job);
+}
+
+/*
+ * Copies rows [begin, end) of the source view into the destination view
+ */
+static void copy_band(void *arg, int begin, int end) {
+    FILTER_JOB *job = arg;
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+
+    for (int i = begin; i < end; i++)
+        memcpy(image_row(job->dst, i), image_row(job->src, i), image_row_bytes(job->src));
+}
+
+/*
+ * Copies the rows of the destination window from one view to another
+ *
+ * Parameters:
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write
+ */
+void copy_image(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    FILTER_JOB job = { ctx, src, dst, 0 };
+    thread_pool_run(ctx->pool, dst->rows, copy_band, &job);
+}
+
+/*
+ * Fused grayscale and reflection pass over rows [begin, end)
+ * Each row is converted with the grayscale row kernel and then mirrored
+ * while it is still in cache, so the image is only traversed once.
+ */
+KERNEL_TEMPLATE void reflect_grayscale_rows(FILTER_JOB *job, int begin, int end, const int channels) {
+    ROW_KERNEL gray_kernel = simd_grayscale_row(channels);
+    ROW_KERNEL reflect_kernel = simd_reflect_row(channels);
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+    const int width = job->src->width;
+
+    for (int i = begin; i < end; i++) {
+        BYTE *out = image_row(job->dst, i);
+        grayscale_row(gray_kernel, image_row(job->src, i), out, width, channels);
+        reflect_row_of(reflect_kernel, out, out, width, channels);
     }
 }
 
 /*
- * Calculates the box blur value for a specific pixel.
+ * Converts an image to grayscale and reflects it horizontally in one pass.
  *
- * Computes the average RGB values of all neighboring pixels (including the pixel itself)
- * within a 3x3 grid. Handles edge cases where the grid extends beyond image boundaries.
+ * Produces the same result as grayscale() followed by reflect() (the two
+ * commute, since both work on whole pixels).
  *
  * Parameters:
- *   i - Row index of the target pixel
- *   j - Column index of the target pixel
- *   height - Image height
- *   width - Image width
- *   image - Source image array
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src)
+ */
+void reflect_grayscale(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    FILTER_JOB job = { ctx, src, dst, 0 };
+    thread_pool_run(ctx->pool, dst->rows, kernels_of(src->channels)->reflect_grayscale, &job);
+}
+
+/*
+ * Running per-channel sums used by the separable box blur
+ */
+typedef struct {
+    unsigned int red;
+    unsigned int green;
+    unsigned int blue;
+} CHANNEL_SUMS;
+
+/*
+ * Adds the channels of columns [c0, c1) of a source row to the column sums
+ */
+KERNEL_TEMPLATE void blur_add_row(CHANNEL_SUMS *column, const BYTE *in, int c0, int c1, const int channels) {
+    for (int j = c0; j < c1; j++) {
+        column[j - c0].red += in[j * channels + CHANNEL_RED];
+        column[j - c0].green += in[j * channels + CHANNEL_GREEN];
+        column[j - c0].blue += in[j * channels + CHANNEL_BLUE];
+    }
+}
+
+/*
+ * Subtracts the channels of columns [c0, c1) of a source row from the column sums
+ */
+KERNEL_TEMPLATE void blur_sub_row(CHANNEL_SUMS *column, const BYTE *in, int c0, int c1, const int channels) {
+    for (int j = c0; j < c1; j++) {
+        column[j - c0].red -= in[j * channels + CHANNEL_RED];
+        column[j - c0].green -= in[j * channels + CHANNEL_GREEN];
+        column[j - c0].blue -= in[j * channels + CHANNEL_BLUE];
+    }
+}
+
+/*
+ * Returns the sum of `taps` consecutive column sums
+ * Fully unrolled when taps is a constant.
+ */
+KERNEL_TEMPLATE CHANNEL_SUMS blur_window(const CHANNEL_SUMS *column, const int taps) {
+    CHANNEL_SUMS sum = {0, 0, 0};
+    for (int k = 0; k < taps; k++) {
+        sum.red += column[k].red;
+        sum.green += column[k].green;
+        sum.blue += column[k].blue;
+    }
+    return sum;
+}
+
+/*
+ * Writes the rounded average of a window sum of `count` pixels to a pixel,
+ * with the alpha of the source pixel
+ */
+KERNEL_TEMPLATE void blur_store(BYTE *pixel, const BYTE *in, CHANNEL_SUMS sum, unsigned int count,
+                                const int channels) {
+    pixel[CHANNEL_RED] = box_mean(sum.red, count);
+    pixel[CHANNEL_GREEN] = box_mean(sum.green, count);
+    pixel[CHANNEL_BLUE] = box_mean(sum.blue, count);
+    if (channels == PIXEL_BGRA)
+        pixel[CHANNEL_ALPHA] = in[CHANNEL_ALPHA];
+}
+
+/*
+ * Box blur pass over one tile
  *
- * Returns:
- *   RGBTRIPLE - Blurred pixel value
- */
-static RGBTRIPLE box_blur(int i, int j, int height, int width, RGBTRIPLE image[height][width]) {
-    unsigned int sum_red = 0, sum_green = 0, sum_blue = 0;
-    unsigned int count = 0;
-
-    // Iterate over 3x3 grid centered on pixel
-    for (int di = -1; di <= 1; di++) {
-        for (int dj = -1; dj <= 1; dj++) {
-            int ni = i + di;  // Neighbor row
-            int nj = j + dj;  // Neighbor column
-
-            // Skip pixels outside image boundaries
-            if (ni >= 0 && ni < height && nj >= 0 && nj < width) {
-                sum_red += image[ni][nj].rgbtRed;
-                sum_green += image[ni][nj].rgbtGreen;
-                sum_blue += image[ni][nj].rgbtBlue;
-                count++;
+ * The window sum is separable: a running sum per column covers the vertical
+ * extent of the window and is slid down one row at a time. For any radius,
+ * a running sum over those column sums covers the horizontal extent and is
+ * slid along each row, so every step adds one entry and removes one and the
+ * cost per pixel does not depend on the radius. For a fixed radius (a
+ * constant between 1 and MAX_FIXED_RADIUS), the columns whose window lies
+ * inside the image instead add their 2 * fixed + 1 column sums directly, in
+ * an unrolled loop without carried state or bounds checks, and only the
+ * border columns clip their window. Since the window is a rectangle clipped
+ * to the image, the number of in-bounds neighbours is simply rows * columns.
+ *
+ * The column sums span the tile plus `radius` columns on each side, live in
+ * the worker's context buffer, and are primed from the `radius` rows above
+ * the tile, which belong to the neighbouring tiles; the destination never
+ * aliases the source in this pass, so they are only read.
+ */
+KERNEL_TEMPLATE void blur_pixels(FILTER_JOB *job, const TILE *tile, const int channels, const int fixed) {
+    const IMAGE *src = job->src;
+    const int height = src->height;
+    const int width = src->width;
+    const int radius = fixed != 0 ? fixed : job->radius;
+    const int begin = tile->y;
+    const int end = tile->y + tile->height;
+    const int x0 = tile->x;
+    const int x1 = tile->x + tile->width;
+
+    // Columns [c0, c1) hold the sums read by the tile
+    const int c0 = x0 - radius < 0 ? 0 : x0 - radius;
+    const int c1 = x1 + radius > width ? width : x1 + radius;
+    CHANNEL_SUMS *column = (CHANNEL_SUMS *)context_work(job->ctx, tile->worker);
+    memset(column, 0, (c1 - c0) * sizeof(CHANNEL_SUMS));
+
+    // Columns [a, b) of the tile have their whole window inside the image
+    const int a = radius < x0 ? x0 : radius > x1 ? x1 : radius;
+    const int b = width - radius < a ? a : width - radius > x1 ? x1 : width - radius;
+
+    // Prime the column sums with the rows covered by the window of the first row
+    int first = begin - radius < 0 ? 0 : begin - radius;
+    for (int i = first; i <= begin + radius && i < height; i++)
+        blur_add_row(column, image_row(src, i), c0, c1, channels);
+
+    for (int i = begin; i < end; i++) {
+        int top = i - radius < 0 ? 0 : i - radius;
+        int bottom = i + radius >= height ? height - 1 : i + radius;
+        unsigned int rows = bottom - top + 1;
+        const BYTE *in = image_row(src, i);
+        BYTE *out = image_row(job->dst, i);
+
+        if (fixed != 0) {
+            for (int j = x0; j < x1; j++) {
+                if (j == a)
+                    j = b;
+                if (j == x1)
+                    break;
+                int left = j - radius < 0 ? 0 : j - radius;
+                int right = j + radius >= width ? width - 1 : j + radius;
+                CHANNEL_SUMS sum = blur_window(column + (left - c0), right - left + 1);
+                blur_store(out + (size_t)j * channels, in + (size_t)j * channels, sum,
+                           rows * (right - left + 1), channels);
+            }
+            for (int j = a; j < b; j++) {
+                CHANNEL_SUMS sum = blur_window(column + (j - radius - c0), 2 * fixed + 1);
+                blur_store(out + (size_t)j * channels, in + (size_t)j * channels, sum,
+                           rows * (2 * fixed + 1), channels);
+            }
+        } else {
+            // Prime the horizontal sum with the columns covered by the window of column x0
+            CHANNEL_SUMS sum = blur_window(column, (x0 + radius < width ? x0 + radius + 1 : width) - c0);
+
+            for (int j = x0; j < x1; j++) {
+                int left = j - radius < 0 ? 0 : j - radius;
+                int right = j + radius >= width ? width - 1 : j + radius;
+                blur_store(out + (size_t)j * channels, in + (size_t)j * channels, sum,
+                           rows * (right - left + 1), channels);
+
+                // Slide the window one column to the right
+                if (j + radius + 1 < c1) {
+                    sum.red += column[j + radius + 1 - c0].red;
+                    sum.green += column[j + radius + 1 - c0].green;
+                    sum.blue += column[j + radius + 1 - c0].blue;
+                }
+                if (j - radius >= 0) {
+                    sum.red -= column[j - radius - c0].red;
+                    sum.green -= column[j - radius - c0].green;
+                    sum.blue -= column[j - radius - c0].blue;
+                }
             }
         }
+
+        // Slide the column sums one row down
+        if (i + 1 == end)
+            break;
+        if (i + radius + 1 < height)
+            blur_add_row(column, image_row(src, i + radius + 1), c0, c1, channels);
+        if (i - radius >= 0)
+            blur_sub_row(column, image_row(src, i - radius), c0, c1, channels);
     }
+}
 
-    RGBTRIPLE blurred;
-    blurred.rgbtRed = round((float)sum_red / count);
-    blurred.rgbtGreen = round((float)sum_green / count);
-    blurred.rgbtBlue = round((float)sum_blue / count);
+/*
+ * Runs the blur tiles of a destination window
+ * Per column, a tile keeps its sums and revisits the source rows that leave
+ * the window 2 * radius + 1 rows after entering it.
+ */
+static int blur_tiles(FILTER_JOB *job) {
+    int result = context_reserve_work(job->ctx, job->dst->width * sizeof(CHANNEL_SUMS));
+    if (result != SUCCESS) {
+        return result;
+    }
 
-    return blurred;
+    const int radius = job->radius;
+    TILE_FN tile = kernels_of(job->src->channels)->blur[radius <= MAX_FIXED_RADIUS ? radius : 0];
+    size_t column_bytes = sizeof(CHANNEL_SUMS) + (2 * radius + 3) * job->src->channels;
+    tile_run(job->ctx->pool, job->dst->width, job->dst->first_row, job->dst->rows, radius,
+             column_bytes, tile, job);
+    return SUCCESS;
 }
 
 /*
- * Applies a box blur filter to the entire image.
+ * Box kernel of the convolution engine
  *
- * Creates a blurred version of the image by replacing each pixel with the average
- * color values of its neighboring pixels. Uses a temporary buffer to avoid
- * contaminating the blur calculations with already blurred pixels.
+ * Replaces each pixel with the average of the (2 * radius + 1)^2 window
+ * centred on it, averaging only the neighbours that lie inside the image.
+ * When filtering in place, blurs into the context's staging image to avoid
+ * contaminating the blur calculations with already blurred pixels; chains
+ * avoid this copy by alternating between two images (see pipeline.c).
  *
  * Parameters:
- *   height - Number of rows in the image
- *   width - Number of columns in the image
- *   image - The 2D array of RGBTRIPLE pixels to be modified
- */
-void blur(int height, int width, RGBTRIPLE image[height][width]) {
-    // Allocate temporary buffer for blur calculations
-    RGBTRIPLE(*temp)[width] = calloc(height, width * sizeof(RGBTRIPLE));
-    if (temp == NULL) {
-        fprintf(stderr, "Memory allocation failed for blur buffer.\n");
-        exit(1);
+ *   ctx    - Processing context
+ *   src    - Image to read
+ *   dst    - Image to write (may be src)
+ *   radius - Blur radius in pixels, 1 to MAX_BLUR_RADIUS
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY if the working memory cannot be
+ *   allocated, in which case dst is left unchanged)
+ */
+int box_blur(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst, int radius) {
+    if (src->data != dst->data) {
+        FILTER_JOB job = { ctx, src, dst, radius };
+        return blur_tiles(&job);
     }
 
-    // Calculate blur for each pixel
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++)
-            temp[i][j] = box_blur(i, j, height, width, image);
+    IMAGE temp = image_view(NULL, image_row_bytes(src), src->channels, src->width, src->height);
+    temp.data = context_buffer(&ctx->temp, src->height * temp.stride);
+    temp.first_row = dst->first_row;
+    temp.rows = dst->rows;
+    if (temp.data == NULL) {
+        return ERR_MEMORY;
     }
 
-    // Copy blurred image back to original buffer
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++)
-            image[i][j] = temp[i][j];
+    FILTER_JOB job = { ctx, src, &temp, radius };
+    int result = blur_tiles(&job);
+    if (result != SUCCESS) {
+        return result;
     }
 
-    // Clean up
-    free(temp);
-    temp = NULL;
+    // Copy blurred image back to original buffer
+    FILTER_JOB copy = { ctx, &temp, dst, 0 };
+    thread_pool_run(ctx->pool, dst->rows, copy_band, &copy);
+    return SUCCESS;
 }
 
 /*
- * Calculates the Sobel operator value for a specific pixel.
+ * Applies a box blur filter of the given radius to the entire image.
  *
- * Computes the gradient magnitude using Sobel operators in both x and y directions.
+ * Convolves the image with kernel_box(), the average color of the
+ * (2 * radius + 1)^2 window centred on each pixel over the neighbours that
+ * lie inside the image, which convolve() runs with box_blur().
  *
  * Parameters:
- *   i - Row index of the target pixel
- *   j - Column index of the target pixel
- *   height - Image height
- *   width - Image width
- *   image - Source image array
+ *   ctx    - Processing context
+ *   src    - Image to read
+ *   dst    - Image to write (may be src)
+ *   radius - Blur radius in pixels (1 gives the classic 3x3 box blur)
  *
  * Returns:
- *   RGBTRIPLE - Edge-detected pixel value
- */
-static RGBTRIPLE sobel_calc(int i, int j, int height, int width, RGBTRIPLE image[height][width]) {
-    // Sobel kernels for x and y gradients
-    const int Gx[3][3] = {
-        {-1, 0, 1},
-        {-2, 0, 2},
-        {-1, 0, 1}
-    };
-    const int Gy[3][3] = {
-        {-1, -2, -1},
-        {0, 0, 0},
-        {1, 2, 1}
-    };
-
-    int gx = 0;
-    int gy = 0;
-
-    // Calculate Gx and Gy
-    for (int di = -1; di <= 1; di++) {
-        for (int dj = -1; dj <= 1; dj++) {
-            int ni = i + di;
-            int nj = j + dj;
-
-            // Use 0 for pixels outside the image boundary
-            int pixel_value = 0;
-            if (ni >= 0 && ni < height && nj >= 0 && nj < width) {
-                // Since image is already transformed to luminance, we can use any channel
-                pixel_value = image[ni][nj].rgbtRed;
+ *   Error code (SUCCESS, or ERR_MEMORY if the working memory cannot be
+ *   allocated, in which case dst is left unchanged)
+ */
+int blur_radius(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst, int radius) {
+    KERNEL box;
+    kernel_box(&box, radius);
+    return convolve(ctx, &box, 0, src, dst);
+}
+
+/*
+ * Applies a 3x3 box blur filter to the entire image.
+ *
+ * Each pixel is replaced with the average color of itself and its in-bounds
+ * neighbours. Equivalent to blur_radius() with a radius of 1.
+ *
+ * Parameters:
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src)
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY as for blur_radius())
+ */
+int blur(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    return blur_radius(ctx, src, dst, 1);
+}
+
+/*
+ * Data shared by all tiles of the fused edges pass
+ * Exactly one of src and planar_src, and one of dst and planar_dst, is set.
+ */
+typedef struct {
+    CONTEXT      *ctx;        /* Processing context */
+    const IMAGE  *src;        /* Packed image being read */
+    const IMAGE  *dst;        /* Packed image being written (may be src) */
+    const PLANAR *planar_src; /* Planar image being read */
+    const PLANAR *planar_dst; /* Planar image being written (may be planar_src) */
+    int           width;      /* Image width in pixels */
+    int           height;     /* Full image height in pixels */
+    int           first_row;  /* First row written */
+    int           rows;       /* Number of rows written */
+    int           bands;      /* Number of row bands the pass is split into */
+    uint8_t      *halo;       /* In place only, per band: luminance of the EDGES_HALO rows above and below it */
+    uint8_t      lum[3 * MAX_RGB_VALUE + 1]; /* Luminance of the gray pixel for each channel sum */
+} EDGES_JOB;
+
+/*
+ * Computes the luminance of columns [x0, x1) of a source row
+ * The image is converted to grayscale before luminance, so both steps only
+ * depend on the channel sum and are folded into one table lookup. Packed
+ * images pass their pixel size as `channels`, planar images 0.
+ */
+KERNEL_TEMPLATE void edges_luminance_row(const EDGES_JOB *job, int k, int x0, int x1, uint8_t *out,
+                                         const int channels) {
+    const PLANAR *planar = job->planar_src;
+
+    if (channels != 0) {
+        const BYTE *row = image_row(job->src, k);
+        for (int j = x0; j < x1; j++) {
+            const BYTE *pixel = row + (size_t)j * channels;
+            out[j - x0] = job->lum[pixel[CHANNEL_RED] + pixel[CHANNEL_GREEN] + pixel[CHANNEL_BLUE]];
+        }
+    } else if (planar->planes == 1) {
+        const BYTE *gray = plane_row(planar, 0, k);
+        for (int j = x0; j < x1; j++)
+            out[j - x0] = job->lum[3 * gray[j]];
+    } else {
+        const BYTE *blue = plane_row(planar, 0, k);
+        const BYTE *green = plane_row(planar, 1, k);
+        const BYTE *red = plane_row(planar, 2, k);
+        for (int j = x0; j < x1; j++)
+            out[j - x0] = job->lum[red[j] + green[j] + blue[j]];
+    }
+}
+
+/*
+ * Returns the halo slot of a row just outside band [begin, end)
+ * Slots hold rows begin - 2, begin - 1, end and end + 1, in that order.
+ */
+static uint8_t *edges_halo_row(const EDGES_JOB *job, int band, int row, int begin, int end) {
+    int slot = row < begin ? row - (begin - EDGES_HALO) : EDGES_HALO + row - end;
+    return job->halo + ((size_t)band * 2 * EDGES_HALO + slot) * job->width;
+}
+
+/*
+ * Returns the Sobel magnitude round(sqrt(s)) wrapped into a byte
+ * sqrtf() is exact enough to give the integer square root of any s a 3x3
+ * Sobel can produce, and m rounds up exactly when s > (m + 1/2)^2 - 1/4.
+ */
+static inline uint8_t sobel_magnitude(int s) {
+    int m = (int)sqrtf((float)s);
+    return m + (s > m * m + m);
+}
+
+/*
+ * Returns the work buffer bytes of an edges tile thresholding `span` columns
+ * The buffer holds the column sums of the blur, the two Sobel gradients and
+ * the scratch sums of convolve_span(), then three luminance rows of
+ * span + 2 columns, three thresholded rows and the gray output row.
+ */
+static size_t edges_work_size(int span) {
+    return span * sizeof(unsigned int) + (3 * span + 2) * sizeof(int32_t) + 3 * (span + 2) + 4 * span;
+}
+
+/*
+ * Fused edges pass over one tile of an image of `channels`-byte pixels, or
+ * of a planar image for 0
+ *
+ * Streams the tile through two rolling windows of three rows each: the
+ * luminance rows feeding the Sobel operator, and the thresholded rows
+ * feeding the box blur. Output row i is written once luminance row i + 2
+ * has been read, so the image can be overwritten in place. In place, tiles
+ * span whole rows, and the luminance rows owned by the neighbouring bands,
+ * which may already be overwritten, come from the halo snapshot taken
+ * before the pass started. Out of place, a tile also covers the two
+ * columns on each side it reads.
+ */
+KERNEL_TEMPLATE void edges_pixels(EDGES_JOB *job, const TILE *tile, const int channels) {
+    const int height = job->height;
+    const int width = job->width;
+    const int begin = tile->y;
+    const int end = tile->y + tile->height;
+    const int x0 = tile->x;
+    const int x1 = tile->x + tile->width;
+
+    // Output columns [x0, x1) blur thresholded columns [s0, s1), which read luminance columns [l0, l1)
+    const int s0 = x0 - 1 < 0 ? 0 : x0 - 1;
+    const int s1 = x1 + 1 > width ? width : x1 + 1;
+    const int l0 = s0 - 1 < 0 ? 0 : s0 - 1;
+    const int l1 = s1 + 1 > width ? width : s1 + 1;
+    const int span = s1 - s0;
+
+    // Luminance rows carry a column on each side, zero outside the image, so the
+    // Sobel taps need no bounds checks
+    const int padded = span + 2;
+    unsigned int *column = (unsigned int *)context_work(job->ctx, tile->worker);
+    int32_t *gx = (int32_t *)(column + span);
+    int32_t *gy = gx + span;
+    int32_t *sobel_work = gy + span;
+    uint8_t *buffer = (uint8_t *)(sobel_work + span + 2);
+    memset(buffer, 0, 3 * padded);
+    uint8_t *lum[3] = { buffer, buffer + padded, buffer + 2 * padded };
+    uint8_t *bin[3] = { buffer + 3 * padded, buffer + 3 * padded + span, buffer + 3 * padded + 2 * span };
+    uint8_t *average = buffer + 3 * padded + 3 * span;
+
+    int first = begin - 1 < 0 ? 0 : begin - 1;        // First thresholded row needed
+    int last = end < height ? end : height - 1;       // Last thresholded row needed
+
+    for (int k = first - 1; k <= last + 1; k++) {
+        // Read luminance row k (zero outside the image); row[c - s0] holds column c
+        uint8_t *row = lum[(k + 3) % 3] + 1;
+        if (k < 0 || k >= height)
+            memset(row - 1, 0, padded);
+        else if (job->halo == NULL || (k >= begin && k < end))
+            edges_luminance_row(job, k, l0, l1, row + l0 - s0, channels);
+        else
+            memcpy(row + l0 - s0, edges_halo_row(job, tile->band, k, begin, end) + l0, l1 - l0);
+
+        // Threshold row t = k - 1 once its lower neighbour is available
+        int t = k - 1;
+        if (t < first)
+            continue;
+        const uint8_t *window[3] = { lum[(t + 2) % 3], lum[t % 3], lum[(t + 1) % 3] };
+        const uint8_t *mid = window[1];
+        uint8_t *edge = bin[t % 3];
+        convolve_span(&sobel_x, window, 1, span, gx, sobel_work);
+        convolve_span(&sobel_y, window, 1, span, gy, sobel_work);
+        for (int j = 0; j < span; j++) {
+            int s = gx[j] * gx[j] + gy[j] * gy[j];
+            int l = mid[j + 1];
+
+            // Below SOBEL_WRAP, round(sqrt(s)) > l is s > (l + 1/2)^2, i.e. s > l^2 + l.
+            // Larger magnitudes are deliberately not capped at 255 and wrap like the original.
+            int above = s < SOBEL_WRAP ? s > l * l + l : sobel_magnitude(s) > l;
+            edge[j] = above ? MAX_RGB_VALUE : 0;
+        }
+
+        // Blur output row o = t - 1 once its lower thresholded neighbour exists,
+        // or the last image row, which has none
+        for (int o = t - 1; o <= t; o++) {
+            if (o < begin || o >= end || (o == t && t != height - 1))
+                continue;
+
+            int top = o - 1 < 0 ? 0 : o - 1;
+            int bottom = o + 1 >= height ? height - 1 : o + 1;
+            unsigned int rows = bottom - top + 1;
+            for (int j = 0; j < span; j++) {
+                column[j] = 0;
+                for (int r = top; r <= bottom; r++)
+                    column[j] += bin[r % 3][j];
             }
 
-            // Add weighted pixel values
-            gx += pixel_value * Gx[di + 1][dj + 1];
-            gy += pixel_value * Gy[di + 1][dj + 1];
+            // Average into a gray row: the image border columns have a two-column window
+            BYTE *gray = channels == 0 ? plane_row(job->planar_dst, 0, o) + x0 : average;
+            const unsigned int *sums = column + (x0 - s0);
+            int j = 0, stop = x1 - x0;
+            if (x0 == 0)
+                gray[j++] = box_mean(sums[0] + (width > 1 ? sums[1] : 0), (width > 1 ? 2 : 1) * rows);
+            if (x1 == width && width > 1)
+                stop--;
+            for (; j < stop; j++)
+                gray[j] = box_mean(sums[j - 1] + sums[j] + sums[j + 1], 3 * rows);
+            if (stop < x1 - x0)
+                gray[stop] = box_mean(sums[stop - 1] + sums[stop], 2 * rows);
+
+            // Out of place, alpha is copied from the source pixel
+            if (channels != 0) {
+                BYTE *out = image_row(job->dst, o) + (size_t)x0 * channels;
+                for (j = 0; j < x1 - x0; j++, out += channels)
+                    out[CHANNEL_RED] = out[CHANNEL_GREEN] = out[CHANNEL_BLUE] = gray[j];
+                if (channels == PIXEL_BGRA && job->dst->data != job->src->data) {
+                    const BYTE *in = image_row(job->src, o) + (size_t)x0 * channels;
+                    out = image_row(job->dst, o) + (size_t)x0 * channels;
+                    for (j = 0; j < x1 - x0; j++)
+                        out[j * channels + CHANNEL_ALPHA] = in[j * channels + CHANNEL_ALPHA];
+                }
+            }
         }
     }
+}
 
-    // Calculate the magnitude of the gradient
-    int magnitude = round(sqrt((float)(gx * gx + gy * gy)));
+/*
+ * Fused edges pass over one tile of a planar image
+ */
+static void edges_tile_planar(void *arg, const TILE *tile) {
+    edges_pixels(arg, tile, 0);
+}
 
-    // Cap the value at 255
-    //magnitude = magnitude > 255 ? 255 : magnitude;
+/*
+ * Runs the fused edges pass described by a job of either layout, with the
+ * tile kernel of its layout
+ * Returns SUCCESS, or ERR_MEMORY before anything is written.
+ */
+static int edges_run(EDGES_JOB *job, TILE_FN edges_tile, int in_place) {
+    const int height = job->height;
+    CONTEXT *ctx = job->ctx;
+    job->bands = thread_pool_bands(ctx->pool, job->rows);
+    job->halo = NULL;
+    for (int sum = 0; sum <= 3 * MAX_RGB_VALUE; sum++) {
+        uint8_t gray = gray_of(sum, 0, 0);
+        job->lum[sum] = luminance_of(gray, gray, gray);
+    }
 
-    // Create the result pixel (same value for all channels since we're in grayscale)
-    RGBTRIPLE result;
-    result.rgbtRed = result.rgbtGreen = result.rgbtBlue = magnitude;
+    int result = context_reserve_work(ctx, edges_work_size(job->width));
+    if (result != SUCCESS) {
+        return result;
+    }
 
-    return result;
+    // Out of place, every tile reads its neighbours' rows from the source. Per
+    // column, a tile keeps three luminance, three thresholded and one output
+    // byte, a column sum and three gradient sums; source rows are read once.
+    if (!in_place) {
+        size_t column_bytes = 7 + sizeof(unsigned int) + 3 * sizeof(int32_t);
+        tile_run(ctx->pool, job->width, job->first_row, job->rows, EDGES_HALO, column_bytes, edges_tile, job);
+        return SUCCESS;
+    }
+
+    // Snapshot the luminance rows each band reads from its neighbours
+    job->halo = context_buffer(&ctx->halo, (size_t)job->bands * 2 * EDGES_HALO * job->width);
+    if (job->halo == NULL) {
+        return ERR_MEMORY;
+    }
+    for (int band = 0; band < job->bands; band++) {
+        int begin, end;
+        thread_pool_band_range(job->rows, job->bands, band, &begin, &end);
+        begin += job->first_row;
+        end += job->first_row;
+        for (int k = begin - EDGES_HALO; k < end + EDGES_HALO; k++) {
+            if (k == begin)
+                k = end;
+            if (k >= 0 && k < height)
+                edges_luminance_row(job, k, 0, job->width, edges_halo_row(job, band, k, begin, end),
+                                    job->src != NULL ? job->src->channels : 0);
+        }
+    }
+
+    tile_run(ctx->pool, job->width, job->first_row, job->rows, EDGES_HALO, 0, edges_tile, job);
+    return SUCCESS;
 }
 
 /*
- * Converts an RGB image to luminance values.
+ * Applies edge detection to the image using the Sobel operator.
  *
- * Transforms RGB values to luminance using standard coefficients:
- * L = 0.299R + 0.587G + 0.114B
+ * Converts the image to grayscale and luminance, applies the Sobel operator,
+ * keeps the pixels whose gradient magnitude exceeds their luminance, and
+ * finally applies a 3x3 blur to smooth the result. All four steps are fused
+ * into a single streaming pass that needs O(width) working memory.
  *
  * Parameters:
- *   height - Number of rows in the image
- *   width - Number of columns in the image
- *   image - The 2D array of RGBTRIPLE pixels to be modified
- */
-void luminance(int height, int width, RGBTRIPLE image[height][width]) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            float luminance = 0.299f * image[i][j].rgbtRed +
-                            0.587f * image[i][j].rgbtGreen +
-                            0.114f * image[i][j].rgbtBlue;
-            uint8_t lum_value = round(luminance);
-
-            image[i][j].rgbtRed = lum_value;
-            image[i][j].rgbtGreen = lum_value;
-            image[i][j].rgbtBlue = lum_value;
-        }
-    }
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src)
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY if the working memory cannot be
+ *   allocated, in which case dst is left unchanged)
+ */
+int edges(CONTEXT *ctx, const IMAGE *src, const IMAGE *dst) {
+    EDGES_JOB job;
+    job.ctx = ctx;
+    job.src = src;
+    job.dst = dst;
+    job.planar_src = NULL;
+    job.planar_dst = NULL;
+    job.width = src->width;
+    job.height = src->height;
+    job.first_row = dst->first_row;
+    job.rows = dst->rows;
+    return edges_run(&job, kernels_of(src->channels)->edges, src->data == dst->data);
 }
 
 /*
- * Applies edge detection to the image using the Sobel operator.
+ * Applies edge detection to a planar image
+ *
+ * Same result as edges(). Everything after the luminance lookup already
+ * works on one byte per pixel, and the result is a single gray plane.
+ *
+ * Parameters:
+ *   ctx - Processing context
+ *   src - Image to read
+ *   dst - Image to write (may be src); becomes a gray image
  *
- * First converts the image to grayscale and luminance, then applies
- * the Sobel operator to detect edges. Finally applies a blur to
- * smooth the result.
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY as for edges())
+ */
+int planar_edges(CONTEXT *ctx, const PLANAR *src, PLANAR *dst) {
+    EDGES_JOB job;
+    job.ctx = ctx;
+    job.src = NULL;
+    job.dst = NULL;
+    job.planar_src = src;
+    job.planar_dst = dst;
+    job.width = src->width;
+    job.height = src->height;
+    job.first_row = 0;
+    job.rows = src->height;
+    int result = edges_run(&job, edges_tile_planar, src->plane[0] == dst->plane[0]);
+    if (result == SUCCESS)
+        dst->planes = 1;
+    return result;
+}
+
+/*
+ * Parses a filter flag argument
  *
  * Parameters:
- *   height - Number of rows in the image
- *   width - Number of columns in the image
- *   image - The 2D array of RGBTRIPLE pixels to be modified
- */
-void edges(int height, int width, RGBTRIPLE image[height][width]) {
-    grayscale(height, width, image);
-    luminance(height, width, image);
-    // Allocate temporary buffer for sobel calculation
-    RGBTRIPLE(*temp)[width] = calloc(height, width * sizeof(RGBTRIPLE));
-    if (temp == NULL) {
-        fprintf(stderr, "Memory allocation failed for temp buffer. \n");
-        exit(1);
+ *   arg - Argument string such as "-g"
+ *
+ * Returns:
+ *   The filter type flag ('b', 'c', 'e', 'g' or 'r'), or 0 if arg is not one
+ */
+char filter_flag(const char *arg) {
+    if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0')
+        return 0;
+    if (arg[1] != 'b' && arg[1] != 'c' && arg[1] != 'e' && arg[1] != 'r' && !lut_filter(arg[1]))
+        return 0;
+    return arg[1];
+}
+
+/*
+ * Applies a filter selected by its command line flag
+ *
+ * Parameters:
+ *   ctx       - Processing context
+ *   flag      - Filter type flag ('b' for blur, 'c' for convolve, 'e' for
+ *               edges, 'g' for grayscale, 'i' for invert, 'l' for levels,
+ *               'r' for reflect, 't' for threshold)
+ *   params    - Filter parameters
+ *   bottom_up - Non-zero if the first row of the views is the bottom row
+ *               of the picture, which only 'c' needs to know
+ *   src       - Image to read
+ *   dst       - Image to write (may be src to filter in place)
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS for 'c' without a kernel, or ERR_MEMORY
+ *   if the filter's working memory cannot be allocated)
+ */
+int apply_filter(CONTEXT *ctx, char flag, const FILTER_PARAMS *params, int bottom_up, const IMAGE *src,
+                 const IMAGE *dst) {
+    switch (flag) {
+        case 'b':
+            return blur_radius(ctx, src, dst, params->radius);
+        case 'c':
+            return params->kernel != NULL ? convolve(ctx, params->kernel, bottom_up, src, dst) : ERR_ARGS;
+        case 'e':
+            return edges(ctx, src, dst);
+        case 'g':
+            grayscale(ctx, src, dst);
+            break;
+        case 'r':
+            reflect(ctx, src, dst);
+            break;
+        case 'i':
+        case 'l':
+        case 't': {
+            LUT lut;
+            lut_init(&lut);
+            lut_add(&lut, flag, params);
+            lut_apply(ctx, &lut, 0, src, dst);
+            break;
+        }
     }
 
-    // Calculate sobel operator for each pixel
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++)
-            temp[i][j] = sobel_calc(i, j, height, width, image);
+    return SUCCESS;
+}
+
+/*
+ * Kernel instantiations
+ * Every template above is instantiated for each pixel format X(name,
+ * channels) of PIXEL_FORMATS, and the blur tile also for each radius of
+ * BLUR_RADII, and the instances are collected in a table indexed by the
+ * pixel size.
+ */
+#define DEFINE_BLUR_TILE(name, channels, radius) \
+    static void blur_tile_##name##_r##radius(void *arg, const TILE *tile) { \
+        blur_pixels(arg, tile, channels, radius); \
     }
 
-    // Copy modified image back to original buffer
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            if (temp[i][j].rgbtRed > image[i][j].rgbtRed)
-                image[i][j].rgbtRed = image[i][j].rgbtGreen = image[i][j].rgbtBlue = 255;
-            else
-                image[i][j].rgbtRed = image[i][j].rgbtGreen = image[i][j].rgbtBlue = 0;
-        }
+#define DEFINE_FORMAT_KERNELS(name, channels) \
+    static void grayscale_band_##name(void *arg, int begin, int end) { \
+        grayscale_rows(arg, begin, end, channels); \
+    } \
+    static void reflect_band_##name(void *arg, int begin, int end) { \
+        reflect_rows(arg, begin, end, channels); \
+    } \
+    static void reflect_grayscale_band_##name(void *arg, int begin, int end) { \
+        reflect_grayscale_rows(arg, begin, end, channels); \
+    } \
+    static void reflect_tail_##name(const BYTE *in, BYTE *out, int from, int width) { \
+        reflect_pixels(in, out, from, width, channels); \
+    } \
+    static void blur_tile_##name(void *arg, const TILE *tile) { \
+        blur_pixels(arg, tile, channels, 0); \
+    } \
+    BLUR_RADII(DEFINE_BLUR_TILE, name, channels) \
+    static void edges_tile_##name(void *arg, const TILE *tile) { \
+        edges_pixels(arg, tile, channels); \
     }
-    blur(height, width, image);
 
-    // Clean up
-    free(temp);
-    temp = NULL;
+PIXEL_FORMATS(DEFINE_FORMAT_KERNELS)
+
+#define BLUR_TILE_ENTRY(name, channels, radius) [radius] = blur_tile_##name##_r##radius,
+
+#define FORMAT_KERNELS_ENTRY(name, channels) \
+    [channels] = { \
+        .grayscale = grayscale_band_##name, \
+        .reflect = reflect_band_##name, \
+        .reflect_grayscale = reflect_grayscale_band_##name, \
+        .reflect_tail = reflect_tail_##name, \
+        .blur = { [0] = blur_tile_##name, BLUR_RADII(BLUR_TILE_ENTRY, name, channels) }, \
+        .edges = edges_tile_##name, \
+    },
+
+static const FORMAT_KERNELS format_kernels[PIXEL_BGRA + 1] = { PIXEL_FORMATS(FORMAT_KERNELS_ENTRY) };
+
+/*
+ * Returns the kernels of a pixel format (PIXEL_BGR or PIXEL_BGRA)
+ */
+static const FORMAT_KERNELS *kernels_of(int channels) {
+    return &format_kernels[channels];
 }
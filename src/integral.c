@@ -0,0 +1,263 @@
+/*
+ * integral.c
+ * Implementation of summed-area tables.
+ *
+ * A table is built in one pass over the planes: each row accumulates its
+ * pixels from left to right and adds the finished row above it. The rows of
+ * one band only depend on the row above the band, so the bands of the pool
+ * first build their rows as if the band started the image; the last row of
+ * each band is then completed from the band above, one band at a time, and
+ * the remaining rows of every band add the completed row above them in a
+ * second parallel pass. A single band needs neither step.
+ *
+ * Averaging a window from a table costs four lookups whatever its size,
+ * so the box mean runs at the same speed for any radius, and within a run
+ * of columns clipped the same way the lookups are four shifted rows that
+ * the compiler vectorises.
+ */
+
+#include "integral.h"
+#include "bmpio.h"
+#include "filters.h"
+
+#include <string.h>
+
+/* Table layout */
+#define INTEGRAL_ALIGNMENT   16     /* Entries per row are a multiple of this (one cache line) */
+
+/*
+ * Data shared by all bands of one integral image pass
+ */
+typedef struct {
+    CONTEXT        *ctx;      /* Processing context */
+    const PLANAR   *planar;   /* Planar image read by the build, written by the mean */
+    const INTEGRAL *integral; /* Tables written by the build, read by the mean */
+    int             radius;   /* Box radius of the mean */
+    int             bands;    /* Number of row bands of the build */
+} INTEGRAL_JOB;
+
+/*
+ * Returns the row stride of the tables of an image of the given width
+ */
+static size_t integral_stride(int width) {
+    return ((size_t)width + 1 + INTEGRAL_ALIGNMENT - 1) / INTEGRAL_ALIGNMENT * INTEGRAL_ALIGNMENT;
+}
+
+/*
+ * Returns the bytes needed for the tables of `planes` planes of an image
+ */
+size_t integral_size(int width, int height, int planes) {
+    return planes * ((size_t)height + 1) * integral_stride(width) * sizeof(uint32_t);
+}
+
+/*
+ * Lays out the tables of an image in caller-provided memory
+ *
+ * Parameters:
+ *   integral - Tables to lay out
+ *   memory   - Block of at least integral_size() bytes aligned to CONTEXT_ALIGNMENT
+ *   width    - Image width in pixels
+ *   height   - Image height in pixels
+ *   planes   - Number of tables (1 or 3)
+ */
+void integral_bind(INTEGRAL *integral, uint8_t *memory, int width, int height, int planes) {
+    integral->stride = integral_stride(width);
+    integral->width = width;
+    integral->height = height;
+    integral->planes = planes;
+    for (int p = 0; p < 3; p++)
+        integral->table[p] = (uint32_t *)memory + (p < planes ? p : 0) * ((size_t)height + 1) * integral->stride;
+}
+
+/*
+ * Returns a writable pointer to row y of the table of a plane
+ */
+static uint32_t *table_row(const INTEGRAL *integral, int plane, int y) {
+    return integral->table[plane] + (size_t)y * integral->stride;
+}
+
+/*
+ * Build pass over image rows [begin, end): fills table rows begin + 1 to
+ * end as if the image started at row begin
+ */
+static void build_band(void *arg, int begin, int end) {
+    INTEGRAL_JOB *job = arg;
+    const INTEGRAL *integral = job->integral;
+    const int width = integral->width;
+
+    for (int p = 0; p < integral->planes; p++) {
+        for (int i = begin; i < end; i++) {
+            const BYTE *in = plane_row(job->planar, p, i);
+            uint32_t *row = table_row(integral, p, i + 1);
+            uint32_t sum = 0;
+
+            row[0] = 0;
+            if (i == begin) {
+                for (int j = 0; j < width; j++) {
+                    sum += in[j];
+                    row[j + 1] = sum;
+                }
+            } else {
+                const uint32_t *above = table_row(integral, p, i);
+                for (int j = 0; j < width; j++) {
+                    sum += in[j];
+                    row[j + 1] = above[j + 1] + sum;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Completion pass over image rows [begin, end): adds the completed table
+ * row begin to table rows begin + 1 to end - 1 (row end is already complete)
+ */
+static void complete_band(void *arg, int begin, int end) {
+    INTEGRAL_JOB *job = arg;
+    const INTEGRAL *integral = job->integral;
+
+    if (begin == 0) {
+        return;
+    }
+
+    for (int p = 0; p < integral->planes; p++) {
+        const uint32_t *above = table_row(integral, p, begin);
+        for (int i = begin + 1; i < end; i++) {
+            uint32_t *row = table_row(integral, p, i);
+            for (int j = 1; j <= integral->width; j++)
+                row[j] += above[j];
+        }
+    }
+}
+
+/*
+ * Builds the summed-area tables of a planar image
+ *
+ * Parameters:
+ *   ctx - Processing context
+ *   src - Planar image to read
+ *   dst - Tables laid out by integral_bind() for the size and planes of src
+ */
+void integral_build(CONTEXT *ctx, const PLANAR *src, INTEGRAL *dst) {
+    INTEGRAL_JOB job = { ctx, src, dst, 0, thread_pool_bands(ctx->pool, src->height) };
+
+    for (int p = 0; p < dst->planes; p++)
+        memset(table_row(dst, p, 0), 0, (dst->width + 1) * sizeof(uint32_t));
+    thread_pool_run(ctx->pool, src->height, build_band, &job);
+    if (job.bands < 2) {
+        return;
+    }
+
+    // Complete the last row of every band from the band above, top to bottom
+    for (int band = 1; band < job.bands; band++) {
+        int begin, end;
+        thread_pool_band_range(src->height, job.bands, band, &begin, &end);
+        for (int p = 0; p < dst->planes; p++) {
+            const uint32_t *above = table_row(dst, p, begin);
+            uint32_t *row = table_row(dst, p, end);
+            for (int j = 1; j <= dst->width; j++)
+                row[j] += above[j];
+        }
+    }
+
+    thread_pool_run(ctx->pool, src->height, complete_band, &job);
+}
+
+/*
+ * Stores the window sums of columns [from, to) of a row, whose windows span
+ * table columns [j - lo, j + hi) or, for a zero argument, start at column 0
+ * or end at column width
+ */
+KERNEL_TEMPLATE void window_sums(uint32_t *sums, const uint32_t *top, const uint32_t *bottom, int from, int to,
+                                 const int lo, const int hi, int width) {
+    for (int j = from; j < to; j++) {
+        int x0 = lo != 0 ? j - lo : 0;
+        int x1 = hi != 0 ? j + hi : width;
+        sums[j] = bottom[x1] - bottom[x0] - top[x1] + top[x0];
+    }
+}
+
+/*
+ * Box mean pass over rows [begin, end)
+ *
+ * The columns of a row fall into at most three runs: windows clipped on the
+ * left, windows inside the image (or, on images narrower than the window,
+ * clipped on both sides) and windows clipped on the right. In each run the
+ * window bounds move with the column, so the four lookups read contiguous
+ * entries. The window sums and widths are collected in the worker's context
+ * buffer and averaged in one loop, like the tiled kernel of planar.c.
+ */
+static void mean_band(void *arg, int begin, int end) {
+    INTEGRAL_JOB *job = arg;
+    const INTEGRAL *integral = job->integral;
+    const int height = integral->height;
+    const int width = integral->width;
+    const int radius = job->radius;
+    const int band = thread_pool_band_index(height, job->bands, begin);
+    uint32_t *sums = (uint32_t *)context_work(job->ctx, band);
+    uint32_t *span = sums + width;
+
+    // Columns [0, s1) are clipped on the left only, [s2, width) on the right only
+    const int left = radius < width ? radius : width;
+    const int right = width - radius > 0 ? width - radius : 0;
+    const int s1 = left < right ? left : right;
+    const int s2 = left < right ? right : left;
+
+    for (int j = 0; j < width; j++) {
+        int x0 = j - radius < 0 ? 0 : j - radius;
+        int x1 = j + radius >= width ? width : j + radius + 1;
+        span[j] = x1 - x0;
+    }
+
+    for (int p = 0; p < integral->planes; p++) {
+        for (int i = begin; i < end; i++) {
+            int y0 = i - radius < 0 ? 0 : i - radius;
+            int y1 = i + radius >= height ? height : i + radius + 1;
+            uint32_t rows = y1 - y0;
+            const uint32_t *top = integral_row(integral, p, y0);
+            const uint32_t *bottom = integral_row(integral, p, y1);
+            BYTE *out = plane_row(job->planar, p, i);
+
+            window_sums(sums, top, bottom, 0, s1, 0, radius + 1, width);
+            if (left <= right)
+                window_sums(sums, top, bottom, s1, s2, radius, radius + 1, width);
+            else
+                window_sums(sums, top, bottom, s1, s2, 0, 0, width);
+            window_sums(sums, top, bottom, s2, width, radius, 0, width);
+
+            for (int j = 0; j < width; j++)
+                out[j] = box_mean(sums[j], rows * span[j]);
+        }
+    }
+}
+
+/*
+ * Applies a box blur to the image whose tables are given
+ *
+ * Parameters:
+ *   ctx    - Processing context
+ *   src    - Tables of the image, built by integral_build()
+ *   dst    - Planar image of the same size to write; may be the image the
+ *            tables were built from, which they no longer read
+ *   radius - Blur radius in pixels
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY if the working memory cannot be
+ *   allocated, in which case dst is left unchanged)
+ *
+ * Description:
+ *   Same result as planar_blur(): each pixel becomes the rounded average of
+ *   the in-bounds pixels of the (2 * radius + 1)^2 window centred on it.
+ */
+int integral_box_mean(CONTEXT *ctx, const INTEGRAL *src, PLANAR *dst, int radius) {
+    // A band keeps a window sum and a window width per column
+    int result = context_reserve_work(ctx, src->width * 2 * sizeof(uint32_t));
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    INTEGRAL_JOB job = { ctx, dst, src, radius, thread_pool_bands(ctx->pool, src->height) };
+    dst->planes = src->planes;
+    thread_pool_run(ctx->pool, src->height, mean_band, &job);
+    return SUCCESS;
+}
@@ -0,0 +1,206 @@
+/*
+ * lut.c
+ * Implementation of the point operation engine.
+ *
+ * A point operation computes each output pixel from the same input pixel
+ * alone, so any chain of them is a function of the pixel; the per-channel
+ * ones, which are all the operations but grayscale, are functions of one
+ * byte. A chain is therefore compiled once into tables, whatever the
+ * floating point work of each operation, and applied in a single pass of
+ * table lookups: three per pixel, or four once the chain merges the
+ * channels into gray, since the grayscale average depends only on the sum
+ * of the three channels.
+ */
+
+#include "lut.h"
+
+#include <string.h>
+
+/* Middle of the 0-255 range, which contrast scales around */
+#define LUT_MIDDLE           127.5
+
+/*
+ * Data shared by all bands of one table pass
+ */
+typedef struct {
+    const LUT   *lut;        /* Compiled chain */
+    const IMAGE *src;        /* Image being read */
+    const IMAGE *dst;        /* Image being written (may be src) */
+    int          mirror;     /* Reverse each written row */
+} LUT_JOB;
+
+/*
+ * Sets the parameters of the point operations to their defaults
+ */
+void lut_default_params(FILTER_PARAMS *params) {
+    params->threshold = DEFAULT_THRESHOLD;
+    params->brightness = DEFAULT_BRIGHTNESS;
+    params->contrast = DEFAULT_CONTRAST;
+    params->gamma = DEFAULT_GAMMA;
+}
+
+/*
+ * Returns non-zero if a filter flag is a point operation lut_add() takes
+ */
+int lut_filter(char flag) {
+    return flag == 'g' || flag == 'i' || flag == 't' || flag == 'l';
+}
+
+/*
+ * Prepares a chain that leaves every pixel as it is
+ */
+void lut_init(LUT *lut) {
+    lut->gray = 0;
+    for (int v = 0; v < LUT_SIZE; v++)
+        lut->map[0][v] = lut->map[1][v] = lut->map[2][v] = v;
+    memset(lut->mix, 0, sizeof(lut->mix));
+}
+
+/*
+ * Returns the value of one channel after a per-channel point operation
+ */
+static BYTE point_value(char flag, const FILTER_PARAMS *params, BYTE value) {
+    switch (flag) {
+        case 'i':
+            return 255 - value;
+        case 't':
+            return value >= params->threshold ? 255 : 0;
+        default: {
+            double level = 255.0 * pow(value / 255.0, 1.0 / params->gamma);
+            level = (level - LUT_MIDDLE) * params->contrast / 100.0 + LUT_MIDDLE + params->brightness;
+            return level <= 0.0 ? 0 : level >= 255.0 ? 255 : (BYTE)round(level);
+        }
+    }
+}
+
+/*
+ * Appends a point operation to a compiled chain
+ *
+ * Parameters:
+ *   lut    - Chain to extend
+ *   flag   - Filter type flag ('g' for grayscale, 'i' for invert, 't' for
+ *            threshold, 'l' for levels)
+ *   params - Filter parameters
+ *
+ * Returns:
+ *   Non-zero if the operation was added, 0 if flag is not a point operation
+ *
+ * Description:
+ *   A grayscale of a gray image changes nothing, as the three channels are
+ *   already equal; the first one turns the tables built so far into the
+ *   contributions of the channels to the sum.
+ */
+int lut_add(LUT *lut, char flag, const FILTER_PARAMS *params) {
+    if (!lut_filter(flag)) {
+        return 0;
+    }
+
+    if (flag == 'g') {
+        if (!lut->gray) {
+            lut->gray = 1;
+            for (int s = 0; s < LUT_SUM_SIZE; s++)
+                lut->mix[s] = round(s / AVG_DIVISOR);
+        }
+        return 1;
+    }
+
+    if (lut->gray) {
+        for (int s = 0; s < LUT_SUM_SIZE; s++)
+            lut->mix[s] = point_value(flag, params, lut->mix[s]);
+    } else {
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < LUT_SIZE; v++)
+                lut->map[c][v] = point_value(flag, params, lut->map[c][v]);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Classifies a compiled chain, so that chains the dedicated kernels cover
+ * need no table pass
+ */
+LUT_KIND lut_kind(const LUT *lut) {
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < LUT_SIZE; v++) {
+            if (lut->map[c][v] != v)
+                return LUT_TABLES;
+        }
+    }
+    if (!lut->gray) {
+        return LUT_IDENTITY;
+    }
+
+    for (int s = 0; s < LUT_SUM_SIZE; s++) {
+        if (lut->mix[s] != (BYTE)round(s / AVG_DIVISOR))
+            return LUT_TABLES;
+    }
+    return LUT_GRAYSCALE;
+}
+
+/*
+ * Maps the pixels of a row through the tables
+ */
+KERNEL_TEMPLATE void lut_pixels(const LUT *lut, const BYTE *in, BYTE *out, int width, const int channels,
+                                const int gray) {
+    for (int j = 0; j < width; j++) {
+        const BYTE *pixel = in + (size_t)j * channels;
+        BYTE *mapped = out + (size_t)j * channels;
+
+        if (channels == PIXEL_BGRA)
+            mapped[CHANNEL_ALPHA] = pixel[CHANNEL_ALPHA];
+        if (gray) {
+            BYTE value = lut->mix[lut->map[0][pixel[CHANNEL_BLUE]] + lut->map[1][pixel[CHANNEL_GREEN]] +
+                                  lut->map[2][pixel[CHANNEL_RED]]];
+            mapped[CHANNEL_BLUE] = mapped[CHANNEL_GREEN] = mapped[CHANNEL_RED] = value;
+        } else {
+            mapped[CHANNEL_BLUE] = lut->map[0][pixel[CHANNEL_BLUE]];
+            mapped[CHANNEL_GREEN] = lut->map[1][pixel[CHANNEL_GREEN]];
+            mapped[CHANNEL_RED] = lut->map[2][pixel[CHANNEL_RED]];
+        }
+    }
+}
+
+/*
+ * Table pass over rows [begin, end)
+ * A mirrored row is reversed while it is still in cache.
+ */
+KERNEL_TEMPLATE void lut_rows(LUT_JOB *job, int begin, int end, const int channels, const int gray) {
+    begin += job->dst->first_row;
+    end += job->dst->first_row;
+    const int width = job->src->width;
+
+    for (int i = begin; i < end; i++) {
+        BYTE *out = image_row(job->dst, i);
+        lut_pixels(job->lut, image_row(job->src, i), out, width, channels, gray);
+        if (job->mirror)
+            reflect_row(out, out, width, channels);
+    }
+}
+
+#define DEFINE_LUT_BANDS(name, channels) \
+    static void lut_band_##name(void *arg, int begin, int end) { \
+        lut_rows(arg, begin, end, channels, 0); \
+    } \
+    static void lut_gray_band_##name(void *arg, int begin, int end) { \
+        lut_rows(arg, begin, end, channels, 1); \
+    }
+PIXEL_FORMATS(DEFINE_LUT_BANDS)
+
+#define LUT_BANDS_ENTRY(name, channels) [channels] = { lut_band_##name, lut_gray_band_##name },
+static const BAND_FN lut_bands[PIXEL_BGRA + 1][2] = { PIXEL_FORMATS(LUT_BANDS_ENTRY) };
+
+/*
+ * Applies a compiled chain of point operations
+ *
+ * Parameters:
+ *   ctx    - Processing context
+ *   lut    - Compiled chain
+ *   mirror - Non-zero to also reflect the image horizontally
+ *   src    - Image to read
+ *   dst    - Image to write (may be src)
+ */
+void lut_apply(CONTEXT *ctx, const LUT *lut, int mirror, const IMAGE *src, const IMAGE *dst) {
+    LUT_JOB job = { lut, src, dst, mirror };
+    thread_pool_run(ctx->pool, dst->rows, lut_bands[src->channels][lut->gray != 0], &job);
+}
@@ -8,53 +8,367 @@
  * to BMP image files. It handles command-line arguments, file I/O, and image processing.
  */
 
-#include "filters.h"
+#define _POSIX_C_SOURCE 200809L
+
+#include "analyze.h"
+#include "batch.h"
+#include "bmpio.h"
+#include "cache.h"
+#include "convolve.h"
+#include "lut.h"
+#include "resize.h"
+#include "roi.h"
+#include "rowqueue.h"
+#include "serve.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Command Line Argument Constants */
-#define REQUIRED_ARGS 4        /* Number of required command line arguments */
-#define FLAG_INDEX 1           /* Index of the filter flag argument */
-#define INPUT_FILE_INDEX 2     /* Index of the input file argument */
-#define OUTPUT_FILE_INDEX 3    /* Index of the output file argument */
-
-/* Error Codes */
-#define SUCCESS 0             /* Operation completed successfully */
-#define ERR_ARGS 1           /* Invalid command line arguments */
-#define ERR_OUTPUT_FILE 2    /* Failed to create output file */
-#define ERR_HEADER_READ 3    /* Failed to read BMP headers */
-#define ERR_FORMAT 4         /* Unsupported BMP format */
-#define ERR_MEMORY 5         /* Memory allocation failure */
-#define ERR_IMAGE_READ 6     /* Failed to read image data */
-#define ERR_SEEK 7          /* Failed to seek within file */
-#define ERR_WRITE_HEADER 8  /* Failed to write BMP header */
-#define ERR_WRITE_INFO 9    /* Failed to write BMP info */
-#define ERR_WRITE_DATA 10   /* Failed to write image data */
-#define ERR_WRITE_PADDING 11 /* Failed to write padding bytes */
+#define REQUIRED_FILES 2       /* Number of required file arguments (input, output) */
+#define STREAM_CHUNK_ROWS 16   /* Minimum rows filtered per chunk in --stream mode */
+#define OVERLAP_CHUNK_BYTES (256 * 1024) /* Minimum bytes per chunk in --overlap mode */
+#define STDIO_NAME "-"         /* File name standing for stdin or stdout */
+
+/*
+ * Options gathered from the command line
+ */
+typedef struct {
+    PIPELINE    pipeline;      /* Filters to apply, in order */
+    FILTER_PARAMS params;      /* Parameters of the filters */
+    KERNEL      kernel;        /* Kernel for the 'c' filter, when params.kernel is set */
+    int         threads;       /* Number of threads to split filters across */
+    int         mmap_io;       /* Read and write through memory mappings */
+    int         streaming;     /* Process rows in chunks with bounded memory */
+    int         overlap;       /* Read, filter and write chunks on separate threads */
+    int         resize_width;  /* Width to downscale to before filtering (0 to keep the size) */
+    int         resize_height; /* Height to downscale to before filtering */
+    int         analyze;       /* Report histograms of the input as JSON */
+    STATS_FORMAT stats;        /* Statistics report format (STATS_OFF if none) */
+    const char *batch_list;    /* Batch list file ("-" for stdin), or NULL */
+    int         batch_dir;     /* Treat infile and outfile as directories */
+    const char *socket;        /* Unix socket to serve requests on, or NULL */
+    CACHE       cache;         /* Result cache (cache.dir is NULL if none) */
+    ROI         rois[MAX_ROIS]; /* Regions to filter, when roi_count is not 0 */
+    int         roi_count;     /* Number of regions (0 filters the whole image) */
+    const char *infile;        /* Input filename */
+    const char *outfile;       /* Output filename */
+} OPTIONS;
+
+/*
+ * Parses a decimal integer option value
+ *
+ * Parameters:
+ *   text  - Option value string
+ *   min   - Smallest accepted value
+ *   max   - Largest accepted value
+ *   value - Receives the parsed value
+ *
+ * Returns:
+ *   Error code (SUCCESS if valid, ERR_ARGS if not a number or out of range)
+ */
+static int parse_int(const char *text, int min, int max, int *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || parsed < min || parsed > max) {
+        return ERR_ARGS;
+    }
+
+    *value = (int)parsed;
+    return SUCCESS;
+}
+
+/*
+ * Parses a decimal floating point option value
+ *
+ * Parameters:
+ *   text  - Option value string
+ *   min   - Smallest accepted value
+ *   max   - Largest accepted value
+ *   value - Receives the parsed value
+ *
+ * Returns:
+ *   Error code (SUCCESS if valid, ERR_ARGS if not a number or out of range)
+ */
+static int parse_double(const char *text, double min, double max, double *value) {
+    char *end;
+    double parsed = strtod(text, &end);
+
+    if (end == text || *end != '\0' || !(parsed >= min && parsed <= max)) {
+        return ERR_ARGS;
+    }
+
+    *value = parsed;
+    return SUCCESS;
+}
 
 /*
- * Validates command line arguments
+ * Parses and validates command line arguments
  *
  * Parameters:
  *   argc - Number of arguments
  *   argv - Array of argument strings
+ *   opts - Receives the parsed options
  *
  * Returns:
  *   Error code (0 if valid, ERR_ARGS if invalid)
  *
  * Description:
- *   Checks if the correct number of arguments is provided and if the filter flag is valid
+ *   Accepts exactly one filter flag or chain of flags ("-r,-b,-g", or
+ *   "--pipeline reflect,blur,gray"), optional filter parameters and the input
+ *   and output file names, in any order
  */
-static int validate_args(int argc, char *argv[]) {
-    if (argc != REQUIRED_ARGS) {
-        printf("Usage: ./program <flag> <input file> <output file>\n");
+static int parse_args(int argc, char *argv[], OPTIONS *opts) {
+    int files = 0;
+
+    opts->pipeline.stages = 0;
+    opts->params.radius = DEFAULT_BLUR_RADIUS;
+    opts->params.kernel = NULL;
+    lut_default_params(&opts->params);
+    BORDER_MODE border = BORDER_CLAMP;
+    opts->threads = thread_count_default();
+    opts->mmap_io = 0;
+    opts->streaming = 0;
+    opts->overlap = 0;
+    opts->resize_width = opts->resize_height = 0;
+    opts->analyze = 0;
+    opts->stats = STATS_OFF;
+    opts->batch_list = NULL;
+    opts->batch_dir = 0;
+    opts->socket = NULL;
+    opts->cache.dir = NULL;
+    opts->roi_count = 0;
+    int cache_mb = CACHE_DEFAULT_MB, cache_sized = 0;
+    opts->infile = NULL;
+    opts->outfile = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "--radius") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], 1, MAX_BLUR_RADIUS, &opts->params.radius) != SUCCESS) {
+                printf("Invalid blur radius (expected 1-%d)\n", MAX_BLUR_RADIUS);
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--threshold") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], 1, 255, &opts->params.threshold) != SUCCESS) {
+                printf("Invalid threshold (expected 1-255)\n");
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--brightness") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], -255, 255, &opts->params.brightness) != SUCCESS) {
+                printf("Invalid brightness (expected -255 to 255)\n");
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--contrast") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], 0, MAX_CONTRAST, &opts->params.contrast) != SUCCESS) {
+                printf("Invalid contrast (expected 0-%d percent)\n", MAX_CONTRAST);
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--gamma") == 0) {
+            if (i + 1 >= argc || parse_double(argv[++i], MIN_GAMMA, MAX_GAMMA, &opts->params.gamma) != SUCCESS) {
+                printf("Invalid gamma (expected %g-%g)\n", MIN_GAMMA, MAX_GAMMA);
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--kernel") == 0 || strcmp(arg, "--kernel-file") == 0) {
+            int file = strcmp(arg, "--kernel-file") == 0;
+            if (i + 1 >= argc || opts->params.kernel != NULL ||
+                (file ? kernel_load(argv[i + 1], &opts->kernel) : kernel_parse(argv[i + 1], &opts->kernel)) != SUCCESS) {
+                printf(file ? "Invalid kernel file\n" : "Invalid kernel\n");
+                return ERR_ARGS;
+            }
+            opts->params.kernel = &opts->kernel;
+            i++;
+        } else if (strcmp(arg, "--border") == 0) {
+            if (i + 1 >= argc || kernel_border(argv[++i], &border) != SUCCESS) {
+                printf("Invalid border mode (expected zero, clamp or skip)\n");
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "-s") == 0) {
+            if (i + 1 >= argc || resize_parse(argv[++i], &opts->resize_width, &opts->resize_height) != SUCCESS) {
+                printf("Invalid size (expected WxH, e.g. 160x120)\n");
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--roi") == 0) {
+            if (i + 1 >= argc || opts->roi_count == MAX_ROIS ||
+                roi_parse(argv[++i], &opts->rois[opts->roi_count]) != SUCCESS) {
+                printf("Invalid region (expected x,y,w,h, at most %d regions)\n", MAX_ROIS);
+                return ERR_ARGS;
+            }
+            opts->roi_count++;
+        } else if (strcmp(arg, "--mmap") == 0) {
+            opts->mmap_io = 1;
+        } else if (strcmp(arg, "--stream") == 0) {
+            opts->streaming = 1;
+        } else if (strcmp(arg, "--overlap") == 0) {
+            opts->overlap = 1;
+        } else if (strcmp(arg, "--analyze") == 0) {
+            opts->analyze = 1;
+        } else if (strcmp(arg, "--stats") == 0) {
+            opts->stats = STATS_TEXT;
+        } else if (strcmp(arg, "--stats-json") == 0) {
+            opts->stats = STATS_JSON;
+        } else if (strcmp(arg, "--batch") == 0) {
+            if (i + 1 >= argc) {
+                printf("--batch needs a list file (or - for stdin)\n");
+                return ERR_ARGS;
+            }
+            opts->batch_list = argv[++i];
+        } else if (strcmp(arg, "--batch-dir") == 0) {
+            opts->batch_dir = 1;
+        } else if (strcmp(arg, "--serve") == 0) {
+            if (i + 1 >= argc) {
+                printf("--serve needs a socket path\n");
+                return ERR_ARGS;
+            }
+            opts->socket = argv[++i];
+        } else if (strcmp(arg, "--cache") == 0) {
+            if (i + 1 >= argc || strlen(argv[i + 1]) > CACHE_MAX_DIR) {
+                printf("--cache needs a directory of at most %d characters\n", CACHE_MAX_DIR);
+                return ERR_ARGS;
+            }
+            opts->cache.dir = argv[++i];
+        } else if (strcmp(arg, "--cache-size") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], 1, CACHE_MAX_MB, &cache_mb) != SUCCESS) {
+                printf("Invalid cache size (expected 1-%d MB)\n", CACHE_MAX_MB);
+                return ERR_ARGS;
+            }
+            cache_sized = 1;
+        } else if (strcmp(arg, "-j") == 0) {
+            if (i + 1 >= argc || parse_int(argv[++i], 1, MAX_THREADS, &opts->threads) != SUCCESS) {
+                printf("Invalid thread count (expected 1-%d)\n", MAX_THREADS);
+                return ERR_ARGS;
+            }
+        } else if (strcmp(arg, "--pipeline") == 0 || (arg[0] == '-' && arg[1] != '\0')) {
+            const char *spec = arg[1] == '-' ? (i + 1 < argc ? argv[++i] : "") : arg;
+            if (opts->pipeline.stages != 0 || pipeline_parse(spec, &opts->pipeline) == 0) {
+                printf("Invalid flag\n");
+                return ERR_ARGS;
+            }
+        } else if (files == 0) {
+            opts->infile = arg;
+            files++;
+        } else if (files == 1) {
+            opts->outfile = arg;
+            files++;
+        } else {
+            files++;
+        }
+    }
+
+    opts->cache.limit = (uint64_t)cache_mb << 20;
+    if (cache_sized && opts->cache.dir == NULL) {
+        printf("--cache-size needs --cache\n");
         return ERR_ARGS;
     }
 
-    const char flag = argv[FLAG_INDEX][1];
-    if (flag != 'b' && flag != 'e' && flag != 'g' && flag != 'r') {
-        printf("Invalid flag\n");
+    if (opts->socket != NULL) {
+        if (files != 0 || opts->pipeline.stages != 0 || opts->batch_list != NULL || opts->batch_dir ||
+            opts->mmap_io || opts->streaming || opts->analyze || opts->resize_width != 0 || opts->cache.dir != NULL ||
+            opts->roi_count != 0) {
+            printf("--serve takes its filters and images from the requests and cannot be combined with files,\n"
+                   "a filter, batch mode, --mmap, --stream, --analyze, -s, --cache or --roi\n");
+            return ERR_ARGS;
+        }
+        if (opts->params.kernel != NULL)
+            opts->kernel.border = border;
+        return SUCCESS;
+    }
+
+    int batch = opts->batch_list != NULL || opts->batch_dir;
+    int analysis_only = opts->analyze && !batch && opts->pipeline.stages == 0 && opts->resize_width == 0 && files == 1;
+    if (opts->batch_list != NULL ? files != 0 || opts->batch_dir
+        : !analysis_only && ((opts->pipeline.stages == 0 && opts->resize_width == 0) || files != REQUIRED_FILES)) {
+        printf("Usage: ./program <flag[,flag...]> [--radius N] [-j N] [--mmap | --stream [--overlap]] <input file | -> <output file | ->\n"
+               "       ./program <flag[,flag...]> [--radius N] [-j N] --cache <dir> [--cache-size MB] <input file | -> <output file | ->\n"
+               "       ./program <flag[,flag...]> [--radius N] [-j N] [--mmap] --roi x,y,w,h [--roi ...] <input file | -> <output file | ->\n"
+               "       ./program -s WxH [flag[,flag...]] [--radius N] [-j N] <input file | -> <output file | ->\n"
+               "       ./program <flag[,flag...]> [--radius N] [-j N] --batch-dir <input dir> <output dir>\n"
+               "       ./program [flag[,flag...]] [--radius N] [-j N] --batch <list file | ->\n"
+               "       ./program --analyze [-j N] <input file | ->\n"
+               "       ./program --serve <socket> [--radius N] [-j N]\n"
+               "-c convolves with --kernel <taps> or --kernel-file <file> [--border zero | clamp | skip]\n"
+               "-i inverts, -t thresholds at [--threshold N], -l applies [--gamma G] [--contrast P] [--brightness N]\n"
+               "Add --analyze to a filter to also report the input's histograms as JSON\n"
+               "Add --stats or --stats-json to report timings and I/O counters on stderr\n");
+        return ERR_ARGS;
+    }
+
+    if (analysis_only && (opts->mmap_io || opts->streaming)) {
+        printf("--analyze without a filter cannot be combined with --mmap or --stream\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->mmap_io && !batch && (strcmp(opts->infile, STDIO_NAME) == 0 || strcmp(opts->outfile, STDIO_NAME) == 0)) {
+        printf("--mmap needs regular files, not -\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->params.kernel != NULL) {
+        opts->kernel.border = border;
+    } else {
+        for (int i = 0; i < opts->pipeline.stages; i++) {
+            if (opts->pipeline.flags[i] == 'c') {
+                printf("-c needs a kernel (--kernel or --kernel-file)\n");
+                return ERR_ARGS;
+            }
+        }
+    }
+
+    if (opts->overlap && !opts->streaming) {
+        printf("--overlap needs --stream\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->mmap_io && opts->streaming) {
+        printf("--mmap and --stream cannot be combined\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->streaming) {
+        int split = pipeline_find_context(&opts->pipeline, 0, &opts->params);
+        if (split < opts->pipeline.stages &&
+            pipeline_find_context(&opts->pipeline, split + 1, &opts->params) < opts->pipeline.stages) {
+            printf("--stream supports at most one blur, convolve or edges stage\n");
+            return ERR_ARGS;
+        }
+    }
+
+    if (batch && (opts->mmap_io || opts->streaming || opts->analyze)) {
+        printf("Batch mode cannot be combined with --mmap, --stream or --analyze\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->resize_width != 0 && (batch || opts->mmap_io || opts->streaming)) {
+        printf("-s cannot be combined with batch mode, --mmap or --stream\n");
         return ERR_ARGS;
     }
 
+    if (opts->cache.dir != NULL && (batch || analysis_only || opts->mmap_io || opts->streaming || opts->resize_width != 0)) {
+        printf("--cache cannot be combined with batch mode, --mmap, --stream or -s, or without a filter\n");
+        return ERR_ARGS;
+    }
+
+    if (opts->roi_count != 0 && (batch || opts->pipeline.stages == 0 || opts->streaming || opts->resize_width != 0 ||
+                                 opts->cache.dir != NULL)) {
+        printf("--roi needs a filter and cannot be combined with batch mode, --stream, -s or --cache\n");
+        return ERR_ARGS;
+    }
+
+    // Reflecting moves pixels across whole rows, so a region's pixels could come from anywhere
+    for (int i = 0; i < opts->pipeline.stages && opts->roi_count != 0; i++) {
+        if (opts->pipeline.flags[i] == 'r') {
+            printf("--roi cannot be combined with -r\n");
+            return ERR_ARGS;
+        }
+    }
+
     return SUCCESS;
 }
 
@@ -71,17 +385,28 @@ static int validate_args(int argc, char *argv[]) {
  *   Error code (SUCCESS if successful, ERR_ARGS or ERR_OUTPUT_FILE on failure)
  *
  * Description:
- *   Opens the input file in binary read mode and output file in binary write mode
+ *   Opens the input file in binary read mode and output file in binary write
+ *   mode; a file name of "-" stands for stdin or stdout
  */
 static int open_files(const char *infile, const char *outfile, FILE **inptr, FILE **outptr) {
-    *inptr = fopen(infile, "rb");
+    // The image takes over stdout; messages move to stderr first so they cannot corrupt it
+    int piped = strcmp(outfile, STDIO_NAME) == 0;
+    int fd = piped ? dup(STDOUT_FILENO) : -1;
+    if (fd != -1)
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    *inptr = strcmp(infile, STDIO_NAME) == 0 ? stdin : fopen(infile, "rb");
     if (*inptr == NULL) {
+        if (fd != -1)
+            close(fd);
         printf("Could not open %s.\n", infile);
         return ERR_ARGS;
     }
 
-    *outptr = fopen(outfile, "wb");
+    *outptr = piped ? (fd != -1 ? fdopen(fd, "wb") : NULL) : fopen(outfile, "wb");
     if (*outptr == NULL) {
+        if (fd != -1)
+            close(fd);
         fclose(*inptr);
         printf("Could not create %s.\n", outfile);
         return ERR_OUTPUT_FILE;
@@ -91,177 +416,1029 @@ static int open_files(const char *infile, const char *outfile, FILE **inptr, FIL
 }
 
 /*
- * Processes the image with the specified filter
+ * Filters an image whose pixel data is held entirely in memory
  *
  * Parameters:
- *   flag   - Filter type flag ('b' for blur, 'e' for edges, 'g' for grayscale, 'r' for reflect)
- *   height - Image height in pixels
- *   width  - Image width in pixels
- *   image  - Image data array to be processed
+ *   ctx      - Processing context
+ *   opts     - Parsed options
+ *   inptr    - Input file pointer, positioned at the pixel data
+ *   outptr   - Output file pointer
+ *   bf       - Bitmap file header
+ *   bi       - Bitmap info header
+ *   analysis - Receives the histograms of the input rows, or NULL
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
  *
  * Description:
- *   Applies the selected filter transformation to the image data
+ *   The whole output file, headers and padded rows, is assembled in one
+ *   buffer: the pixel data is read into it in large blocks, filtered in
+ *   place through a view with the file's row stride, and written out with
+ *   a single fwrite() call.
  */
-static void process_image(char flag, int height, int width, RGBTRIPLE image[height][width]) {
-    switch (flag) {
-        case 'b':
-            blur(height, width, image);
-            break;
-        case 'e':
-            edges(height, width, image);
-            break;
-        case 'g':
-            grayscale(height, width, image);
-            break;
-        case 'r':
-            reflect(height, width, image);
+static int process_buffered(CONTEXT *ctx, const OPTIONS *opts, FILE *inptr, FILE *outptr,
+                            BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, ANALYSIS *analysis) {
+    int height = bmp_height(bi);
+    int width = bi->biWidth;
+    int channels = bmp_channels(bi);
+    size_t size = bmp_encoded_size(width, height, channels);
+
+    STATS_TIMER timer = stats_begin();
+    BYTE *file = malloc(size);
+    stats_count(STATS_ALLOCS, size);
+    if (file == NULL) {
+        printf("Not enough memory to store image.\n");
+        return ERR_MEMORY;
+    }
+    memcpy(file, bf, sizeof(BITMAPFILEHEADER));
+    memcpy(file + sizeof(BITMAPFILEHEADER), bi, sizeof(BITMAPINFOHEADER));
+
+    // Each block is analysed right after it is read, while it is in cache
+    IMAGE image = image_view(file + BITMAP_HEADER_SIZE, bmp_stride(width, channels), channels, width, height);
+    int block = analysis != NULL && image.stride > 0 && IO_BLOCK_BYTES / image.stride > 0 ? IO_BLOCK_BYTES / image.stride
+                                                                                         : height;
+    int result = SUCCESS;
+    for (int first = 0; result == SUCCESS && first < height; first += block) {
+        int last = first + block < height ? first + block : height;
+        result = bmp_read_rows(inptr, &image, first, last);
+        if (result == SUCCESS && analysis != NULL)
+            result = analysis_rows(ctx, analysis, &image, first, last);
+    }
+    if (result != SUCCESS) {
+        free(file);
+        printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
+        return result;
+    }
+
+    // The padding bytes were read from the input and are written as zeros;
+    // zeroing them first also keeps them out of the cache key
+    int padding = bmp_padding(width, channels);
+    for (int i = 0; i < height && padding > 0; i++)
+        memset(image_row(&image, i) + image_row_bytes(&image), 0, padding);
+    stats_end(STATS_READ, &timer);
+
+    // A hit writes the stored output and skips the filters altogether
+    uint64_t key = 0;
+    if (opts->cache.dir != NULL) {
+        timer = stats_begin();
+        key = cache_key(file, size, &opts->pipeline, &opts->params);
+        result = cache_fetch(&opts->cache, key, size, outptr);
+        stats_end(STATS_WRITE, &timer);
+        if (result != CACHE_MISS) {
+            free(file);
+            if (result != SUCCESS)
+                printf("Error writing output file.\n");
+            return result;
+        }
+    }
+
+    timer = stats_begin();
+    result = pipeline_apply(ctx, &opts->pipeline, 0, opts->pipeline.stages, &opts->params, bi->biHeight > 0,
+                            &image, &image);
+    if (result != SUCCESS) {
+        free(file);
+        printf("Not enough memory to store image.\n");
+        return result;
+    }
+    stats_end(STATS_FILTER, &timer);
+
+    timer = stats_begin();
+    stats_count(STATS_WRITES, size);
+    if (fwrite(file, size, 1, outptr) != 1) {
+        free(file);
+        printf("Error writing output file.\n");
+        return ERR_WRITE_DATA;
+    }
+    if (opts->cache.dir != NULL)
+        cache_store(&opts->cache, key, file, size);
+    stats_end(STATS_WRITE, &timer);
+
+    free(file);
+    file = NULL;
+
+    return SUCCESS;
+}
+
+/*
+ * Copies rows from the input file to the output file unfiltered
+ *
+ * Parameters:
+ *   ctx      - Processing context
+ *   inptr    - Input file pointer, positioned at row `begin`
+ *   outptr   - Output file pointer, positioned after the previous row
+ *   ring     - Ring buffer the rows go through
+ *   begin    - First row to copy
+ *   end      - One past the last row to copy
+ *   analysis - Receives the histograms of the rows, or NULL
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ */
+static int pass_rows(CONTEXT *ctx, FILE *inptr, FILE *outptr, const IMAGE *ring, int begin, int end,
+                     ANALYSIS *analysis) {
+    int result = SUCCESS;
+
+    for (int first = begin; result == SUCCESS && first < end; first += ring->ring) {
+        int last = first + ring->ring < end ? first + ring->ring : end;
+
+        STATS_TIMER timer = stats_begin();
+        result = bmp_read_rows(inptr, ring, first, last);
+        if (result == SUCCESS && analysis != NULL)
+            result = analysis_rows(ctx, analysis, ring, first, last);
+        if (result != SUCCESS) {
+            printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
             break;
+        }
+        stats_end(STATS_READ, &timer);
+
+        timer = stats_begin();
+        result = bmp_write_rows(outptr, ring, first, last, 0);
+        if (result != SUCCESS) {
+            printf("Error writing output file.\n");
+        }
+        stats_end(STATS_WRITE, &timer);
     }
+
+    return result;
 }
 
 /*
- * Writes the processed image to output file
+ * Filters regions of an image, holding only the rows they span
  *
  * Parameters:
- *   outptr - Output file pointer
- *   bf     - Bitmap file header
- *   bi     - Bitmap info header
- *   height - Image height in pixels
- *   width  - Image width in pixels
- *   image  - Processed image data to write
+ *   ctx      - Processing context
+ *   opts     - Parsed options, with at least one region
+ *   inptr    - Input file pointer, positioned at the pixel data
+ *   outptr   - Output file pointer
+ *   bf       - Bitmap file header
+ *   bi       - Bitmap info header
+ *   analysis - Receives the histograms of the input rows, or NULL
  *
  * Returns:
  *   Error code (SUCCESS if successful, various ERR codes on failure)
  *
  * Description:
- *   Writes the BMP headers and image data with appropriate padding
+ *   roi_rows() gives the band of rows the grown regions cover. That band is
+ *   read into a ring of exactly its height, filtered there by roi_apply()
+ *   and written out; the rows above and below it go from the input to the
+ *   output through a ring of at most IO_BLOCK_BYTES and are never filtered.
+ *   Memory is therefore proportional to the rows the regions span, not to
+ *   the image, and the input may still be a pipe.
  */
-static int write_image(FILE *outptr, BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi,
-                      int height, int width, RGBTRIPLE image[height][width]) {
-    int padding = (4 - (width * sizeof(RGBTRIPLE)) % 4) % 4;
+static int process_regions(CONTEXT *ctx, const OPTIONS *opts, FILE *inptr, FILE *outptr,
+                           BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, ANALYSIS *analysis) {
+    int height = bmp_height(bi);
+    int width = bi->biWidth;
+    int channels = bmp_channels(bi);
+    size_t stride = bmp_stride(width, channels);
+    int block = IO_BLOCK_BYTES / stride > 0 ? IO_BLOCK_BYTES / stride : 1;
+    int first;
+    int rows = roi_rows(&opts->pipeline, &opts->params, opts->rois, opts->roi_count, bi->biHeight > 0, width,
+                        height, &first);
 
-    if (fwrite(bf, sizeof(BITMAPFILEHEADER), 1, outptr) != 1) {
-        return ERR_WRITE_HEADER;
+    // Both rings keep the file's padding so that their rows are read in blocks
+    IMAGE through = image_view(NULL, stride, channels, width, height);
+    IMAGE band = image_view(NULL, stride, channels, width, height);
+    through.ring = block < height ? block : height;
+    band.ring = rows > 0 ? rows : 1;
+    through.data = malloc(through.ring * stride);
+    band.data = malloc(band.ring * stride);
+    stats_count(STATS_ALLOCS, through.ring * stride);
+    stats_count(STATS_ALLOCS, band.ring * stride);
+    if (through.data == NULL || band.data == NULL) {
+        free(band.data);
+        free(through.data);
+        printf("Not enough memory to store image.\n");
+        return ERR_MEMORY;
     }
 
-    if (fwrite(bi, sizeof(BITMAPINFOHEADER), 1, outptr) != 1) {
-        return ERR_WRITE_INFO;
+    int result = bmp_write_headers(outptr, bf, bi);
+    if (result == SUCCESS)
+        result = pass_rows(ctx, inptr, outptr, &through, 0, first, analysis);
+
+    if (result == SUCCESS) {
+        STATS_TIMER timer = stats_begin();
+        result = bmp_read_rows(inptr, &band, first, first + rows);
+        if (result == SUCCESS && analysis != NULL)
+            result = analysis_rows(ctx, analysis, &band, first, first + rows);
+        if (result != SUCCESS)
+            printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
+        stats_end(STATS_READ, &timer);
+    }
+
+    if (result == SUCCESS) {
+        STATS_TIMER timer = stats_begin();
+        result = roi_apply(ctx, &opts->pipeline, &opts->params, opts->rois, opts->roi_count, bi->biHeight > 0,
+                           &band, &band);
+        if (result != SUCCESS)
+            printf("Not enough memory to store image.\n");
+        stats_end(STATS_FILTER, &timer);
     }
 
-    for (int i = 0; i < height; i++) {
-        if (fwrite(image[i], sizeof(RGBTRIPLE), width, outptr) != width) {
-            return ERR_WRITE_DATA;
+    if (result == SUCCESS) {
+        STATS_TIMER timer = stats_begin();
+        result = bmp_write_rows(outptr, &band, first, first + rows, 0);
+        if (result != SUCCESS)
+            printf("Error writing output file.\n");
+        stats_end(STATS_WRITE, &timer);
+    }
+
+    if (result == SUCCESS)
+        result = pass_rows(ctx, inptr, outptr, &through, first + rows, height, analysis);
+
+    free(band.data);
+    free(through.data);
+
+    return result;
+}
+
+/*
+ * Filters an image row by row with bounded memory
+ *
+ * Parameters:
+ *   ctx      - Processing context
+ *   opts     - Parsed options
+ *   inptr    - Input file pointer, positioned at the pixel data
+ *   outptr   - Output file pointer
+ *   bf       - Bitmap file header
+ *   bi       - Bitmap info header
+ *   analysis - Receives the histograms of the input rows, or NULL
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Output rows are produced in chunks of `chunk` rows. Source rows are read
+ *   into a ring buffer of chunk + 2 * context rows, where context is the
+ *   number of rows the filter reads above and below each output row; this
+ *   always holds the rows of the current chunk plus their context, and every
+ *   newly read row replaces one that is no longer needed. Filtered rows go
+ *   to a second ring of `chunk` rows and are written out before the next
+ *   chunk, so memory stays O(width * context) whatever the image height.
+ *
+ *   A chain may hold at most one stage with context. Point stages before it
+ *   are applied to source rows as they are read, the rest to each chunk.
+ */
+static int process_streaming(CONTEXT *ctx, const OPTIONS *opts, FILE *inptr, FILE *outptr,
+                             BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, ANALYSIS *analysis) {
+    int height = bmp_height(bi);
+    int width = bi->biWidth;
+    int channels = bmp_channels(bi);
+    PIPELINE rest;
+    int mirror = pipeline_defer_mirror(&opts->pipeline, &rest);
+    const PIPELINE *pipeline = &rest;
+    int split = pipeline_find_context(pipeline, 0, &opts->params);
+    int context = split < pipeline->stages ? filter_context(pipeline->flags[split], &opts->params) : 0;
+    int pre = split < pipeline->stages ? split : 0;
+    int chunk = 2 * context > STREAM_CHUNK_ROWS ? 2 * context : STREAM_CHUNK_ROWS;
+
+    // Source rows keep the file's padding so that each chunk is read in one block
+    IMAGE src = image_view(NULL, bmp_stride(width, channels), channels, width, height);
+    IMAGE dst = image_view(NULL, (size_t)width * channels, channels, width, height);
+    src.ring = chunk + 2 * context;
+    dst.ring = chunk;
+    src.data = calloc(src.ring, src.stride);
+    dst.data = calloc(dst.ring, dst.stride);
+    stats_count(STATS_ALLOCS, src.ring * src.stride);
+    stats_count(STATS_ALLOCS, dst.ring * dst.stride);
+    if (src.data == NULL || dst.data == NULL) {
+        free(dst.data);
+        free(src.data);
+        printf("Not enough memory to store image.\n");
+        return ERR_MEMORY;
+    }
+
+    int result = bmp_write_headers(outptr, bf, bi);
+    int read = 0;
+
+    for (int first = 0; result == SUCCESS && first < height; first += chunk) {
+        int last = first + chunk < height ? first + chunk : height;
+        int needed = last + context < height ? last + context : height;
+
+        STATS_TIMER timer = stats_begin();
+        result = bmp_read_rows(inptr, &src, read, needed);
+        if (result == SUCCESS && analysis != NULL)
+            result = analysis_rows(ctx, analysis, &src, read, needed);
+        if (result != SUCCESS) {
+            printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
+            break;
         }
+        stats_end(STATS_READ, &timer);
+        timer = stats_begin();
 
-        for (int k = 0; k < padding; k++) {
-            if (fputc(0x00, outptr) == EOF) {
-                return ERR_WRITE_PADDING;
-            }
+        // Stages before the neighbourhood filter run once on each new source row
+        IMAGE fresh = src;
+        fresh.first_row = read;
+        fresh.rows = needed - read;
+        result = pipeline_apply(ctx, pipeline, 0, pre, &opts->params, bi->biHeight > 0, &fresh, &fresh);
+        read = needed;
+
+        // A chain left empty by a deferred reflection writes the source rows
+        src.first_row = dst.first_row = first;
+        src.rows = dst.rows = last - first;
+        const IMAGE *out = pipeline->stages > 0 ? &dst : &src;
+        if (result == SUCCESS && out == &dst)
+            result = pipeline_apply(ctx, pipeline, pre, pipeline->stages, &opts->params, bi->biHeight > 0, &src, &dst);
+        if (result != SUCCESS) {
+            printf("Not enough memory to store image.\n");
+            break;
+        }
+        stats_end(STATS_FILTER, &timer);
+
+        timer = stats_begin();
+        result = bmp_write_rows(outptr, out, first, last, mirror);
+        if (result != SUCCESS) {
+            printf("Error writing output file.\n");
         }
+        stats_end(STATS_WRITE, &timer);
     }
 
-    return SUCCESS;
+    free(dst.data);
+    free(src.data);
+
+    return result;
 }
 
 /*
- * Main program entry point
+ * Reader or writer thread of an overlapped stream
+ */
+typedef struct {
+    FILE        *file;       /* File read from or written to */
+    IMAGE        image;      /* Ring the rows go through (a copy of its own) */
+    ROW_QUEUE   *queue;      /* Queue tracking the ring */
+    int          chunk;      /* Rows per read or write */
+    int          mirror;     /* Writer: reverse each row */
+    int          result;     /* Error code of the thread's own I/O */
+} STREAM_IO;
+
+/*
+ * Reader thread: reads every source row into the ring, a chunk at a time,
+ * as soon as the filter thread has released the slots
+ */
+static void *reader_main(void *data) {
+    STREAM_IO *io = data;
+    const int height = io->image.height;
+
+    for (int first = 0; first < height; first += io->chunk) {
+        int last = first + io->chunk < height ? first + io->chunk : height;
+        if (row_queue_reserve(io->queue, last) != SUCCESS)
+            break;
+
+        STATS_TIMER timer = stats_begin();
+        io->result = bmp_read_rows(io->file, &io->image, first, last);
+        stats_end(STATS_READ, &timer);
+        if (io->result != SUCCESS) {
+            row_queue_abort(io->queue, io->result);
+            break;
+        }
+        row_queue_push(io->queue, last);
+    }
+    return NULL;
+}
+
+/*
+ * Writer thread: writes every filtered row from the ring, a chunk at a
+ * time, as soon as the filter thread has pushed it
+ */
+static void *writer_main(void *data) {
+    STREAM_IO *io = data;
+    const int height = io->image.height;
+
+    for (int first = 0; first < height; first += io->chunk) {
+        int last = first + io->chunk < height ? first + io->chunk : height;
+        if (row_queue_wait(io->queue, last) != SUCCESS)
+            break;
+
+        STATS_TIMER timer = stats_begin();
+        io->result = bmp_write_rows(io->file, &io->image, first, last, io->mirror);
+        stats_end(STATS_WRITE, &timer);
+        if (io->result != SUCCESS) {
+            row_queue_abort(io->queue, io->result);
+            break;
+        }
+        row_queue_release(io->queue, last);
+    }
+    return NULL;
+}
+
+/*
+ * Filters an image row by row with reading, filtering and writing overlapped
  *
  * Parameters:
- *   argc - Number of command line arguments
- *   argv - Array of command line argument strings
+ *   ctx      - Processing context
+ *   opts     - Parsed options
+ *   inptr    - Input file pointer, positioned at the pixel data
+ *   outptr   - Output file pointer
+ *   bf       - Bitmap file header
+ *   bi       - Bitmap info header
+ *   analysis - Receives the histograms of the input rows, or NULL
  *
  * Returns:
- *   Program exit code (SUCCESS on successful execution, error code on failure)
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
  *
  * Description:
- *   Coordinates the entire image processing workflow:
- *   1. Validates command line arguments
- *   2. Opens input/output files
- *   3. Reads and validates BMP headers
- *   4. Allocates memory and reads image data
- *   5. Applies the selected filter
- *   6. Writes the processed image
- *   7. Cleans up resources
+ *   Works like process_streaming(), with a reader and a writer thread
+ *   around the calling thread, which filters. Source rows go through a
+ *   ring of 2 * (chunk + context) rows and filtered rows through a ring of
+ *   2 * chunk rows, each tracked by a bounded row queue, so that while
+ *   chunk k is filtered, the reader fills the rows of chunk k + 1 and the
+ *   writer drains chunk k - 1. Chunks are at least OVERLAP_CHUNK_BYTES, so
+ *   the threads hand over work a few times per megabyte. Memory stays
+ *   O(width * context) whatever the image height.
  */
-int main(int argc, char *argv[]) {
-    int result = validate_args(argc, argv);
+static int process_overlapped(CONTEXT *ctx, const OPTIONS *opts, FILE *inptr, FILE *outptr,
+                              BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, ANALYSIS *analysis) {
+    int height = bmp_height(bi);
+    int width = bi->biWidth;
+    int channels = bmp_channels(bi);
+    PIPELINE rest;
+    int mirror = pipeline_defer_mirror(&opts->pipeline, &rest);
+    const PIPELINE *pipeline = &rest;
+    int split = pipeline_find_context(pipeline, 0, &opts->params);
+    int context = split < pipeline->stages ? filter_context(pipeline->flags[split], &opts->params) : 0;
+    int pre = split < pipeline->stages ? split : 0;
+    size_t stride = bmp_stride(width, channels);
+    int chunk = stride > 0 && OVERLAP_CHUNK_BYTES / stride > STREAM_CHUNK_ROWS ? OVERLAP_CHUNK_BYTES / stride
+                                                                             : STREAM_CHUNK_ROWS;
+    chunk = 2 * context > chunk ? 2 * context : chunk;
+
+    IMAGE src = image_view(NULL, stride, channels, width, height);
+    IMAGE dst = image_view(NULL, (size_t)width * channels, channels, width, height);
+    src.ring = 2 * (chunk + context);
+    dst.ring = 2 * chunk;
+    src.data = calloc(src.ring, src.stride);
+    dst.data = calloc(dst.ring, dst.stride);
+    stats_count(STATS_ALLOCS, src.ring * src.stride);
+    stats_count(STATS_ALLOCS, dst.ring * dst.stride);
+    STREAM_IO reader = { inptr, src, row_queue_create(src.ring), chunk, 0, SUCCESS };
+    STREAM_IO writer = { outptr, dst, row_queue_create(dst.ring), chunk, mirror, SUCCESS };
+    if (src.data == NULL || dst.data == NULL || reader.queue == NULL || writer.queue == NULL) {
+        row_queue_destroy(writer.queue);
+        row_queue_destroy(reader.queue);
+        free(dst.data);
+        free(src.data);
+        printf("Not enough memory to store image.\n");
+        return ERR_MEMORY;
+    }
+
+    int result = bmp_write_headers(outptr, bf, bi);
     if (result != SUCCESS) {
+        row_queue_destroy(writer.queue);
+        row_queue_destroy(reader.queue);
+        free(dst.data);
+        free(src.data);
+        printf("Error writing output file.\n");
         return result;
     }
 
-    const char flag = argv[FLAG_INDEX][1];
-    const char *infile = argv[INPUT_FILE_INDEX];
-    const char *outfile = argv[OUTPUT_FILE_INDEX];
+    pthread_t threads[2];
+    int started = (pthread_create(&threads[0], NULL, reader_main, &reader) == 0) +
+                  (pthread_create(&threads[1], NULL, writer_main, &writer) == 0);
+    if (started < 2) {
+        result = ERR_MEMORY;
+    }
 
-    FILE *inptr, *outptr;
-    result = open_files(infile, outfile, &inptr, &outptr);
+    int read = 0;
+    int filtered = SUCCESS;
+    for (int first = 0; result == SUCCESS && first < height; first += chunk) {
+        int last = first + chunk < height ? first + chunk : height;
+        int needed = last + context < height ? last + context : height;
+        if (row_queue_wait(reader.queue, needed) != SUCCESS || row_queue_reserve(writer.queue, last) != SUCCESS)
+            break;
+
+        STATS_TIMER timer = stats_begin();
+        IMAGE fresh = src;
+        fresh.first_row = read;
+        fresh.rows = needed - read;
+        if (analysis != NULL)
+            filtered = analysis_rows(ctx, analysis, &src, read, needed);
+        if (filtered == SUCCESS)
+            filtered = pipeline_apply(ctx, pipeline, 0, pre, &opts->params, bi->biHeight > 0, &fresh, &fresh);
+        read = needed;
+
+        // Even an empty chain copies, so that the writer only reads its own ring
+        src.first_row = dst.first_row = first;
+        src.rows = dst.rows = last - first;
+        if (filtered == SUCCESS)
+            filtered = pipeline_apply(ctx, pipeline, pre, pipeline->stages, &opts->params, bi->biHeight > 0, &src, &dst);
+        stats_end(STATS_FILTER, &timer);
+        if (filtered != SUCCESS) {
+            result = filtered;
+            break;
+        }
+
+        row_queue_push(writer.queue, last);
+        row_queue_release(reader.queue, last - context);
+    }
+
+    // Whatever stopped the loop stops both threads
+    if (result != SUCCESS || read < height) {
+        row_queue_abort(reader.queue, result != SUCCESS ? result : ERR_IMAGE_READ);
+        row_queue_abort(writer.queue, result != SUCCESS ? result : ERR_IMAGE_READ);
+    }
+    for (int k = 0; k < started; k++)
+        pthread_join(threads[k], NULL);
+
+    if (result == SUCCESS)
+        result = reader.result != SUCCESS ? reader.result : writer.result;
+    if (result == ERR_IMAGE_READ) {
+        printf("Error reading image data.\n");
+    } else if (result == ERR_MEMORY) {
+        printf("Not enough memory to store image.\n");
+    } else if (result != SUCCESS) {
+        printf("Error writing output file.\n");
+    }
+
+    row_queue_destroy(writer.queue);
+    row_queue_destroy(reader.queue);
+    free(dst.data);
+    free(src.data);
+
+    return result;
+}
+
+/*
+ * Downscales an image as it is read, then filters the smaller image
+ *
+ * Parameters:
+ *   ctx      - Processing context
+ *   opts     - Parsed options
+ *   inptr    - Input file pointer, positioned at the pixel data
+ *   outptr   - Output file pointer
+ *   bf       - Bitmap file header, rewritten for the output size
+ *   bi       - Bitmap info header, rewritten for the output size
+ *   analysis - Receives the histograms of the input rows, or NULL
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Source rows are read in blocks of up to IO_BLOCK_BYTES into a ring of
+ *   one block and accumulated straight into the output image, which is the
+ *   only image held whole; the filter chain then runs on it. Memory grows
+ *   with the output size and the source width, not the source height.
+ */
+static int process_resized(CONTEXT *ctx, const OPTIONS *opts, FILE *inptr, FILE *outptr,
+                           BITMAPFILEHEADER *bf, BITMAPINFOHEADER *bi, ANALYSIS *analysis) {
+    int height = bmp_height(bi);
+    int width = bi->biWidth;
+    int channels = bmp_channels(bi);
+    if (opts->resize_width > width || opts->resize_height > height) {
+        printf("-s %dx%d is larger than the %dx%d image\n", opts->resize_width, opts->resize_height, width, height);
+        return ERR_ARGS;
+    }
+
+    STATS_TIMER timer = stats_begin();
+    size_t stride = bmp_stride(width, channels);
+    int block = IO_BLOCK_BYTES / stride > 0 ? IO_BLOCK_BYTES / stride : 1;
+    IMAGE src = image_view(NULL, stride, channels, width, height);
+    IMAGE thumb = image_view(NULL, (size_t)opts->resize_width * channels, channels, opts->resize_width,
+                             opts->resize_height);
+    src.ring = block < height ? block : height;
+    src.data = malloc(src.ring * stride);
+    thumb.data = malloc(thumb.height * thumb.stride);
+    stats_count(STATS_ALLOCS, src.ring * stride);
+    stats_count(STATS_ALLOCS, thumb.height * thumb.stride);
+
+    RESIZER resizer;
+    int result = src.data != NULL && thumb.data != NULL ? resize_init(&resizer, width, height, &thumb, src.ring)
+                                                        : ERR_MEMORY;
     if (result != SUCCESS) {
+        free(thumb.data);
+        free(src.data);
+        printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Image too wide to resize.\n");
         return result;
     }
+    stats_end(STATS_SETUP, &timer);
 
-    BITMAPFILEHEADER bf;
-    BITMAPINFOHEADER bi;
-    if (fread(&bf, sizeof(BITMAPFILEHEADER), 1, inptr) != 1 ||
-        fread(&bi, sizeof(BITMAPINFOHEADER), 1, inptr) != 1) {
-        fclose(outptr);
-        fclose(inptr);
+    for (int first = 0; first < height; first += src.ring) {
+        int last = first + src.ring < height ? first + src.ring : height;
+
+        timer = stats_begin();
+        result = bmp_read_rows(inptr, &src, first, last);
+        if (result == SUCCESS && analysis != NULL)
+            result = analysis_rows(ctx, analysis, &src, first, last);
+        if (result != SUCCESS) {
+            printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
+            break;
+        }
+        stats_end(STATS_READ, &timer);
+
+        timer = stats_begin();
+        resize_rows(ctx, &resizer, &src, first, last);
+        stats_end(STATS_FILTER, &timer);
+    }
+    resize_free(&resizer);
+    free(src.data);
+
+    if (result == SUCCESS) {
+        timer = stats_begin();
+        result = pipeline_apply(ctx, &opts->pipeline, 0, opts->pipeline.stages, &opts->params, bi->biHeight > 0,
+                                &thumb, &thumb);
+        if (result != SUCCESS) {
+            printf("Not enough memory to store image.\n");
+        }
+        stats_end(STATS_FILTER, &timer);
+    }
+
+    if (result == SUCCESS) {
+        timer = stats_begin();
+        bmp_set_size(bf, bi, thumb.width, thumb.height);
+        result = bmp_write_image(outptr, bf, bi, &thumb, 0);
+        if (result != SUCCESS) {
+            printf("Error writing output file.\n");
+        }
+        stats_end(STATS_WRITE, &timer);
+    }
+
+    free(thumb.data);
+
+    return result;
+}
+
+/*
+ * Memory mapping of a whole file
+ */
+typedef struct {
+    int     fd;              /* File descriptor, -1 when closed */
+    BYTE   *data;            /* Mapped bytes, NULL when unmapped */
+    size_t  size;            /* Mapping length in bytes */
+} MAPPING;
+
+/*
+ * Unmaps and closes a file mapping
+ */
+static void unmap_file(MAPPING *map) {
+    if (map->data != NULL)
+        munmap(map->data, map->size);
+    if (map->fd != -1)
+        close(map->fd);
+    map->data = NULL;
+    map->fd = -1;
+}
+
+/*
+ * Filters an image through memory mappings of the input and output files
+ *
+ * Parameters:
+ *   ctx  - Processing context
+ *   opts - Parsed options
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Maps the input read-only and the output, preallocated to its final size,
+ *   read-write. The filter reads the padded input rows through a stride-aware
+ *   view and writes straight into the padded output rows, so no pixel data is
+ *   read, copied or written through stdio. The output padding bytes stay zero
+ *   from preallocation.
+ */
+static int process_mapped(CONTEXT *ctx, const OPTIONS *opts) {
+    MAPPING in = { -1, NULL, 0 };
+    MAPPING out = { -1, NULL, 0 };
+    struct stat st;
+    STATS_TIMER timer = stats_begin();
+
+    in.fd = open(opts->infile, O_RDONLY);
+    if (in.fd == -1) {
+        printf("Could not open %s.\n", opts->infile);
+        return ERR_ARGS;
+    }
+
+    if (fstat(in.fd, &st) == -1 || st.st_size < BITMAP_HEADER_SIZE) {
+        unmap_file(&in);
         printf("Error reading BMP headers.\n");
         return ERR_HEADER_READ;
     }
 
-    if (bf.bfType != BITMAP_TYPE || bf.bfOffBits != BITMAP_HEADER_SIZE ||
-        bi.biSize != 40 || bi.biBitCount != 24 || bi.biCompression != BITMAP_COMPRESSION) {
-        fclose(outptr);
-        fclose(inptr);
-        printf("Unsupported file format.\n");
-        return ERR_FORMAT;
+    in.size = st.st_size;
+    in.data = mmap(NULL, in.size, PROT_READ, MAP_PRIVATE, in.fd, 0);
+    if (in.data == MAP_FAILED) {
+        in.data = NULL;
+        unmap_file(&in);
+        printf("Could not map %s.\n", opts->infile);
+        return ERR_MAP;
     }
+    posix_madvise(in.data, in.size, POSIX_MADV_SEQUENTIAL);
+    stats_count(STATS_MAPS, in.size);
+    stats_end(STATS_SETUP, &timer);
 
-    int height = abs(bi.biHeight);
+    // The headers are validated in place in the mapping
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers_mem(in.data, in.size, &bi);
+    if (result != SUCCESS) {
+        unmap_file(&in);
+        printf(result == ERR_FORMAT ? "Unsupported file format.\n" : "Error reading image data.\n");
+        return result;
+    }
+    stats_end(STATS_HEADERS, &timer);
+
+    int height = bmp_height(&bi);
     int width = bi.biWidth;
-    int padding = (4 - (width * sizeof(RGBTRIPLE)) % 4) % 4;
+    int channels = bmp_channels(&bi);
+    size_t stride = bmp_stride(width, channels);
+    size_t size = bmp_encoded_size(width, height, channels);
 
-    RGBTRIPLE(*image)[width] = calloc(height, width * sizeof(RGBTRIPLE));
-    if (image == NULL) {
-        fclose(outptr);
+    timer = stats_begin();
+    out.fd = open(opts->outfile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out.fd == -1) {
+        unmap_file(&in);
+        printf("Could not create %s.\n", opts->outfile);
+        return ERR_OUTPUT_FILE;
+    }
+
+    if (ftruncate(out.fd, size) == -1) {
+        unmap_file(&out);
+        unmap_file(&in);
+        printf("Error writing output file.\n");
+        return ERR_WRITE_DATA;
+    }
+
+    out.size = size;
+    out.data = mmap(NULL, out.size, PROT_READ | PROT_WRITE, MAP_SHARED, out.fd, 0);
+    if (out.data == MAP_FAILED) {
+        out.data = NULL;
+        unmap_file(&out);
+        unmap_file(&in);
+        printf("Could not map %s.\n", opts->outfile);
+        return ERR_MAP;
+    }
+
+    stats_count(STATS_MAPS, out.size);
+    stats_end(STATS_SETUP, &timer);
+
+    memcpy(out.data, in.data, BITMAP_HEADER_SIZE);
+
+    ANALYSIS analysis;
+    IMAGE src = image_view(in.data + BITMAP_HEADER_SIZE, stride, channels, width, height);
+    IMAGE dst = image_view(out.data + BITMAP_HEADER_SIZE, stride, channels, width, height);
+    if (opts->analyze) {
+        timer = stats_begin();
+        analysis_init(&analysis, channels);
+        result = analysis_rows(ctx, &analysis, &src, 0, height);
+        stats_end(STATS_READ, &timer);
+    }
+
+    // With regions, the other rows are copied through as they are
+    timer = stats_begin();
+    if (result == SUCCESS && opts->roi_count != 0) {
+        copy_image(ctx, &src, &dst);
+        result = roi_apply(ctx, &opts->pipeline, &opts->params, opts->rois, opts->roi_count, bi.biHeight > 0,
+                           &src, &dst);
+    } else if (result == SUCCESS) {
+        result = pipeline_apply(ctx, &opts->pipeline, 0, opts->pipeline.stages, &opts->params, bi.biHeight > 0,
+                                &src, &dst);
+    }
+    stats_end(STATS_FILTER, &timer);
+
+    timer = stats_begin();
+    unmap_file(&out);
+    unmap_file(&in);
+    stats_end(STATS_WRITE, &timer);
+
+    if (result != SUCCESS) {
+        printf("Not enough memory to store image.\n");
+    } else if (opts->analyze) {
+        analysis_report(stdout, &analysis, opts->infile, width, height);
+    }
+    return result;
+}
+
+/*
+ * Reports the histograms of an image without filtering it
+ *
+ * Parameters:
+ *   ctx  - Processing context
+ *   opts - Parsed options
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   The pixel rows are read once, in blocks of up to IO_BLOCK_BYTES into a
+ *   ring of one block, and each block is analysed as soon as it is read;
+ *   the JSON report goes to stdout
+ */
+static int process_analysis(CONTEXT *ctx, const OPTIONS *opts) {
+    STATS_TIMER timer = stats_begin();
+    FILE *inptr = strcmp(opts->infile, STDIO_NAME) == 0 ? stdin : fopen(opts->infile, "rb");
+    if (inptr == NULL) {
+        printf("Could not open %s.\n", opts->infile);
+        return ERR_ARGS;
+    }
+    stats_end(STATS_SETUP, &timer);
+
+    timer = stats_begin();
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers(inptr, &bf, &bi);
+    if (result != SUCCESS) {
+        fclose(inptr);
+        printf(result == ERR_FORMAT ? "Unsupported file format.\n" : "Error reading BMP headers.\n");
+        return result;
+    }
+    stats_end(STATS_HEADERS, &timer);
+
+    int height = bmp_height(&bi);
+    int width = bi.biWidth;
+    int channels = bmp_channels(&bi);
+    size_t stride = bmp_stride(width, channels);
+    int block = stride > 0 && IO_BLOCK_BYTES / stride > 0 ? IO_BLOCK_BYTES / stride : 1;
+    IMAGE src = image_view(NULL, stride, channels, width, height);
+    src.ring = block < height ? block : height;
+    src.data = malloc(src.ring * stride);
+    stats_count(STATS_ALLOCS, src.ring * stride);
+    if (src.data == NULL) {
         fclose(inptr);
         printf("Not enough memory to store image.\n");
         return ERR_MEMORY;
     }
 
-    for (int i = 0; i < height; i++) {
-        if (fread(image[i], sizeof(RGBTRIPLE), width, inptr) != width) {
-            free(image);
-            fclose(outptr);
-            fclose(inptr);
-            printf("Error reading image data.\n");
-            return ERR_IMAGE_READ;
-        }
+    ANALYSIS analysis;
+    analysis_init(&analysis, channels);
+    timer = stats_begin();
+    for (int first = 0; result == SUCCESS && first < height; first += src.ring) {
+        int last = first + src.ring < height ? first + src.ring : height;
+        result = bmp_read_rows(inptr, &src, first, last);
+        if (result == SUCCESS)
+            result = analysis_rows(ctx, &analysis, &src, first, last);
+    }
+    stats_end(STATS_READ, &timer);
 
-        if (fseek(inptr, padding, SEEK_CUR) == -1) {
-            free(image);
-            fclose(outptr);
-            fclose(inptr);
-            printf("Error seeking to next row.\n");
-            return ERR_SEEK;
-        }
+    free(src.data);
+    fclose(inptr);
+
+    if (result != SUCCESS) {
+        printf(result == ERR_MEMORY ? "Not enough memory to store image.\n" : "Error reading image data.\n");
+        return result;
     }
+    analysis_report(stdout, &analysis, opts->infile, width, height);
+    return SUCCESS;
+}
 
-    process_image(flag, height, width, image);
+/*
+ * Filters an image through stdio file streams
+ *
+ * Parameters:
+ *   ctx  - Processing context
+ *   opts - Parsed options
+ *
+ * Returns:
+ *   Error code (SUCCESS if successful, various ERR codes on failure)
+ *
+ * Description:
+ *   Opens the files, reads and validates the BMP headers, then processes the
+ *   pixel data fully buffered, streaming, by regions or downscaled, as selected by opts
+ */
+static int process_file(CONTEXT *ctx, const OPTIONS *opts) {
+    FILE *inptr, *outptr;
+    STATS_TIMER timer = stats_begin();
+    int result = open_files(opts->infile, opts->outfile, &inptr, &outptr);
+    if (result != SUCCESS) {
+        return result;
+    }
+    stats_end(STATS_SETUP, &timer);
 
-    result = write_image(outptr, &bf, &bi, height, width, image);
+    timer = stats_begin();
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    result = bmp_read_headers(inptr, &bf, &bi);
     if (result != SUCCESS) {
-        free(image);
         fclose(outptr);
         fclose(inptr);
-        printf("Error writing output file.\n");
+        printf(result == ERR_FORMAT ? "Unsupported file format.\n" : "Error reading BMP headers.\n");
         return result;
     }
+    stats_end(STATS_HEADERS, &timer);
+
+    // Resizing rewrites the headers, so the input size is kept for the report
+    int width = bi.biWidth;
+    int height = bmp_height(&bi);
+    ANALYSIS analysis;
+    ANALYSIS *input = opts->analyze ? &analysis : NULL;
+    analysis_init(&analysis, bmp_channels(&bi));
+
+    if (opts->resize_width != 0) {
+        result = process_resized(ctx, opts, inptr, outptr, &bf, &bi, input);
+    } else if (opts->overlap) {
+        result = process_overlapped(ctx, opts, inptr, outptr, &bf, &bi, input);
+    } else if (opts->streaming) {
+        result = process_streaming(ctx, opts, inptr, outptr, &bf, &bi, input);
+    } else if (opts->roi_count != 0) {
+        result = process_regions(ctx, opts, inptr, outptr, &bf, &bi, input);
+    } else {
+        result = process_buffered(ctx, opts, inptr, outptr, &bf, &bi, input);
+    }
 
-    free(image);
-    image = NULL;
+    // Closing the output flushes its last buffered rows
+    timer = stats_begin();
     fclose(inptr);
     fclose(outptr);
+    stats_end(STATS_WRITE, &timer);
 
-    return SUCCESS;
+    if (result == SUCCESS && input != NULL)
+        analysis_report(stdout, input, opts->infile, width, height);
+    return result;
+}
+
+/*
+ * Filters every file of a batch
+ *
+ * Parameters:
+ *   opts - Parsed options
+ *   pool - Pool whose threads act as batch workers (NULL for one worker)
+ *
+ * Returns:
+ *   Error code (SUCCESS if every file succeeded, ERR_BATCH if any failed,
+ *   other ERR codes if the batch could not be loaded)
+ *
+ * Description:
+ *   Prints one report line per file on stdout and a summary on stderr
+ */
+static int process_batch(const OPTIONS *opts, THREAD_POOL *pool) {
+    BATCH batch = { NULL, 0, 0 };
+    int result;
+
+    if (opts->batch_dir) {
+        result = batch_load_dir(&batch, &opts->pipeline, opts->infile, opts->outfile);
+    } else {
+        result = batch_load_list(&batch, opts->batch_list, &opts->pipeline);
+    }
+
+    if (result == SUCCESS) {
+        result = batch_run(&batch, &opts->params, pool);
+    }
+
+    if (result == SUCCESS || result == ERR_BATCH) {
+        int failed = 0;
+        for (int i = 0; i < batch.count; i++)
+            failed += batch.entries[i].result != SUCCESS;
+
+        batch_report(&batch, stdout);
+        fprintf(stderr, "%d files, %d failed\n", batch.count, failed);
+    } else if (result == ERR_MEMORY) {
+        printf("Not enough memory to load batch.\n");
+    }
+
+    batch_free(&batch);
+
+    return result;
+}
+
+/*
+ * Main program entry point
+ *
+ * Parameters:
+ *   argc - Number of command line arguments
+ *   argv - Array of command line argument strings
+ *
+ * Returns:
+ *   Program exit code (SUCCESS on successful execution, error code on failure)
+ *
+ * Description:
+ *   Coordinates the entire image processing workflow:
+ *   1. Validates command line arguments
+ *   2. Opens input/output files
+ *   3. Reads and validates BMP headers
+ *   4. Reads image data (whole, mapped, or streamed in chunks)
+ *   5. Applies the selected filter
+ *   6. Writes the processed image
+ *   7. Cleans up resources
+ */
+int main(int argc, char *argv[]) {
+    OPTIONS opts;
+    int result = parse_args(argc, argv, &opts);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    stats_start(opts.stats);
+
+    // A pool that cannot be created simply leaves the filters serial
+    THREAD_POOL *pool = opts.threads > 1 ? thread_pool_create(opts.threads) : NULL;
+    thread_pool_set_timing(pool, stats_enabled);
+
+    if (opts.socket != NULL) {
+        // Like batch mode, the server spreads requests, not rows, across the pool
+        result = serve_run(opts.socket, &opts.params, pool, stdout);
+    } else if (opts.batch_list != NULL || opts.batch_dir) {
+        // Batch mode spreads files, not rows, across the pool
+        result = process_batch(&opts, pool);
+    } else {
+        // One context serves every filter applied to the image
+        CONTEXT ctx;
+        context_init(&ctx, pool);
+        if (opts.outfile == NULL) {
+            result = process_analysis(&ctx, &opts);
+        } else {
+            result = opts.mmap_io ? process_mapped(&ctx, &opts) : process_file(&ctx, &opts);
+        }
+        context_free(&ctx);
+    }
+
+    stats_report(stderr, pool);
+    thread_pool_destroy(pool);
+
+    return result;
 }
@@ -0,0 +1,352 @@
+/*
+ * pipeline.c
+ * Implementation of filter chains.
+ *
+ * The stages of a chain run one after another on the same pixels. Point
+ * stages (grayscale, invert, threshold, levels and reflect) only move or
+ * recolour whole pixels, so any run of them is collapsed into at most one
+ * pass: the colour operations are compiled into the tables of lut.c, and
+ * two reflections cancel out. Runs that amount to a grayscale, a
+ * reflection or both keep their vectorised kernels, the fused
+ * reflect_grayscale() pass among them. Edges filters in place with row
+ * snapshots, while blur and convolve need a separate output; consecutive
+ * ones alternate between the destination and the context's scratch image,
+ * which is only used when one would otherwise have to overwrite its own
+ * input.
+ *
+ * When a whole image goes through a chain with a stage that prefers the
+ * planar layout, the image is converted once on entry, every stage runs on
+ * planar ping-pong buffers, and the result is converted back once on exit.
+ */
+
+#include "pipeline.h"
+#include "bmpio.h"
+#include "lut.h"
+#include "planar.h"
+
+#include <string.h>
+
+/*
+ * Long stage names accepted by --pipeline
+ */
+static const struct {
+    const char *name;
+    char        flag;
+} stage_names[] = {
+    { "blur", 'b' },
+    { "convolve", 'c' },
+    { "edges", 'e' },
+    { "gray", 'g' },
+    { "grayscale", 'g' },
+    { "invert", 'i' },
+    { "levels", 'l' },
+    { "reflect", 'r' },
+    { "threshold", 't' },
+};
+
+/*
+ * Parses one stage of a chain, written as a flag ("-g") or a name ("gray")
+ */
+static char parse_stage(const char *text, size_t length) {
+    char item[16];
+
+    if (length == 0 || length >= sizeof(item)) {
+        return 0;
+    }
+    memcpy(item, text, length);
+    item[length] = '\0';
+
+    if (item[0] == '-') {
+        return filter_flag(item);
+    }
+
+    for (size_t k = 0; k < sizeof(stage_names) / sizeof(stage_names[0]); k++) {
+        if (strcmp(item, stage_names[k].name) == 0)
+            return stage_names[k].flag;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the --pipeline name of a filter flag, or NULL for an unknown flag
+ */
+const char *pipeline_stage_name(char flag) {
+    for (size_t k = 0; k < sizeof(stage_names) / sizeof(stage_names[0]); k++) {
+        if (stage_names[k].flag == flag)
+            return stage_names[k].name;
+    }
+    return NULL;
+}
+
+/*
+ * Parses a filter chain
+ *
+ * Parameters:
+ *   spec     - Comma-separated stages, e.g. "-r,-b,-g" or "reflect,blur,gray"
+ *   pipeline - Receives the chain
+ *
+ * Returns:
+ *   Number of stages, or 0 if spec is not a valid chain
+ */
+int pipeline_parse(const char *spec, PIPELINE *pipeline) {
+    pipeline->stages = 0;
+
+    for (;;) {
+        const char *separator = strchr(spec, PIPELINE_SEPARATOR);
+        size_t length = separator != NULL ? (size_t)(separator - spec) : strlen(spec);
+        char flag = parse_stage(spec, length);
+
+        if (flag == 0 || pipeline->stages == MAX_STAGES) {
+            pipeline->stages = 0;
+            return 0;
+        }
+        pipeline->flags[pipeline->stages++] = flag;
+
+        if (separator == NULL) {
+            return pipeline->stages;
+        }
+        spec = separator + 1;
+    }
+}
+
+/*
+ * Finds the next stage that reads neighbouring rows
+ *
+ * Parameters:
+ *   pipeline - Filter chain
+ *   from     - First stage to consider
+ *   params   - Filter parameters
+ *
+ * Returns:
+ *   Index of the first stage at or after `from` with a non-zero
+ *   filter_context(), or pipeline->stages if there is none
+ */
+int pipeline_find_context(const PIPELINE *pipeline, int from, const FILTER_PARAMS *params) {
+    int i = from;
+    while (i < pipeline->stages && filter_context(pipeline->flags[i], params) == 0)
+        i++;
+    return i;
+}
+
+/*
+ * Returns whether a stage only recolours or moves whole pixels
+ */
+static int point_stage(char flag) {
+    return flag == 'r' || lut_filter(flag);
+}
+
+/*
+ * Moves the reflection at the end of a chain to the writer
+ *
+ * Parameters:
+ *   pipeline - Filter chain
+ *   rest     - Receives the chain without its trailing reflect stages
+ *
+ * Returns:
+ *   Non-zero if the result of rest must be written mirrored
+ *
+ * Description:
+ *   Point stages commute with reflect, so every reflect stage after the last
+ *   blur, convolve or edges stage can be dropped in favour of writing the rows
+ *   reversed, with bmp_write_rows(), when their count is odd.
+ */
+int pipeline_defer_mirror(const PIPELINE *pipeline, PIPELINE *rest) {
+    int tail = pipeline->stages;
+    while (tail > 0 && point_stage(pipeline->flags[tail - 1]))
+        tail--;
+
+    int mirror = 0;
+    *rest = *pipeline;
+    rest->stages = tail;
+    for (int i = tail; i < pipeline->stages; i++) {
+        if (pipeline->flags[i] == 'r')
+            mirror = !mirror;
+        else
+            rest->flags[rest->stages++] = pipeline->flags[i];
+    }
+
+    return mirror;
+}
+
+/*
+ * Returns a view of the context's scratch image matching the destination
+ * view, or NULL if it cannot be allocated
+ */
+static const IMAGE *scratch_view(CONTEXT *ctx, const IMAGE *dst, IMAGE *view) {
+    *view = image_view(NULL, image_row_bytes(dst), dst->channels, dst->width, dst->height);
+    view->first_row = dst->first_row;
+    view->rows = dst->rows;
+    view->data = context_buffer(&ctx->image, view->stride * dst->height);
+    return view->data != NULL ? view : NULL;
+}
+
+/*
+ * Collapses the run of point stages starting at stage *i into the tables
+ * of its colour operations and whether it reflects the image
+ */
+static LUT_KIND point_run(const PIPELINE *pipeline, int *i, int last, const FILTER_PARAMS *params, LUT *lut,
+                          int *mirror) {
+    lut_init(lut);
+    *mirror = 0;
+    for (; *i < last && point_stage(pipeline->flags[*i]); (*i)++) {
+        if (pipeline->flags[*i] == 'r')
+            *mirror = !*mirror;
+        else
+            lut_add(lut, pipeline->flags[*i], params);
+    }
+    return lut_kind(lut);
+}
+
+/*
+ * Returns whether stages [first, last) should run on planar images
+ * Only whole images are converted; windows of a streamed image are not,
+ * and neither are chains with a convolution, which has no planar kernel.
+ */
+static int use_planar(const PIPELINE *pipeline, int first, int last, const IMAGE *src, const IMAGE *dst) {
+    if (src->ring != 0 || dst->ring != 0 || src->first_row != 0 || dst->first_row != 0 ||
+        src->rows != src->height || dst->rows != dst->height)
+        return 0;
+
+    int planar = 0;
+    for (int i = first; i < last; i++) {
+        if (pipeline->flags[i] == 'c')
+            return 0;
+        planar |= filter_layout(pipeline->flags[i]) == LAYOUT_PLANAR;
+    }
+    return planar;
+}
+
+/*
+ * Applies stages [first, last) to a whole image in planar form
+ * The two planar images, and the alpha plane they share for a BGRA image,
+ * come from the context and are reused by later calls.
+ */
+static int apply_planar(CONTEXT *ctx, const PIPELINE *pipeline, int first, int last, const FILTER_PARAMS *params,
+                        const IMAGE *src, const IMAGE *dst) {
+    size_t size = planar_size(dst->width, dst->height, 3);
+    size_t alpha = dst->channels == PIXEL_BGRA ? planar_size(dst->width, dst->height, 1) : 0;
+    BYTE *planes = context_buffer(&ctx->planes, 2 * size + alpha);
+    if (planes == NULL) {
+        return ERR_MEMORY;
+    }
+
+    PLANAR images[2];
+    planar_bind(&images[0], planes, dst->width, dst->height, 3);
+    planar_bind(&images[1], planes + size, dst->width, dst->height, 3);
+    if (alpha != 0)
+        images[0].alpha = images[1].alpha = planes + 2 * size;
+    PLANAR *current = &images[0];
+    PLANAR *spare = &images[1];
+
+    // A leading grayscale is folded into the conversion
+    int i = first, mirror;
+    LUT lut;
+    LUT_KIND kind = point_run(pipeline, &i, last, params, &lut, &mirror);
+    planar_load(ctx, src, current, kind == LUT_GRAYSCALE);
+    if (kind == LUT_TABLES)
+        planar_lut(ctx, &lut, current, current);
+    if (mirror)
+        planar_reflect(ctx, current, current);
+
+    while (i < last) {
+        const char flag = pipeline->flags[i];
+
+        if (point_stage(flag)) {
+            kind = point_run(pipeline, &i, last, params, &lut, &mirror);
+            if (kind == LUT_GRAYSCALE)
+                planar_grayscale(ctx, current, current);
+            else if (kind == LUT_TABLES)
+                planar_lut(ctx, &lut, current, current);
+            if (mirror)
+                planar_reflect(ctx, current, current);
+            continue;
+        }
+
+        int result = flag == 'b' ? planar_blur(ctx, current, spare, params->radius) : planar_edges(ctx, current, spare);
+        if (result != SUCCESS) {
+            return result;
+        }
+        PLANAR *swap = current;
+        current = spare;
+        spare = swap;
+        i++;
+    }
+
+    planar_store(ctx, current, dst);
+    return SUCCESS;
+}
+
+/*
+ * Applies stages [first, last) of a filter chain
+ *
+ * Parameters:
+ *   ctx       - Processing context; its scratch images are grown as needed
+ *               and kept for later calls
+ *   pipeline  - Filter chain
+ *   first     - First stage to apply
+ *   last      - One past the last stage to apply
+ *   params    - Filter parameters
+ *   bottom_up - Non-zero if the first row of the views is the bottom row
+ *               of the picture
+ *   src       - Image to read
+ *   dst       - Image to write (may be src to filter in place)
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS if a convolve stage has no kernel, or
+ *   ERR_MEMORY if a stage's working memory cannot be allocated; the
+ *   contents of dst are then undefined)
+ *
+ * Description:
+ *   src is never written unless it is dst. Every stage writes the rows of
+ *   dst's window, so a windowed src must hold the context rows of all
+ *   stages that read neighbouring rows.
+ */
+int pipeline_apply(CONTEXT *ctx, const PIPELINE *pipeline, int first, int last, const FILTER_PARAMS *params,
+                   int bottom_up, const IMAGE *src, const IMAGE *dst) {
+    const IMAGE *current = src;
+    IMAGE temp;
+
+    if (use_planar(pipeline, first, last, src, dst)) {
+        return apply_planar(ctx, pipeline, first, last, params, src, dst);
+    }
+
+    for (int i = first; i < last;) {
+        const char flag = pipeline->flags[i];
+        const IMAGE *out = current == src ? dst : current;
+        int result = SUCCESS;
+
+        if (point_stage(flag)) {
+            LUT lut;
+            int mirror;
+            LUT_KIND kind = point_run(pipeline, &i, last, params, &lut, &mirror);
+
+            if (kind == LUT_TABLES)
+                lut_apply(ctx, &lut, mirror, current, out);
+            else if (kind == LUT_GRAYSCALE && mirror)
+                reflect_grayscale(ctx, current, out);
+            else if (kind == LUT_GRAYSCALE)
+                grayscale(ctx, current, out);
+            else if (mirror)
+                reflect(ctx, current, out);
+            else
+                out = current;
+        } else if (flag == 'b' || flag == 'c') {
+            out = current != dst ? dst : scratch_view(ctx, dst, &temp);
+            result = out != NULL ? apply_filter(ctx, flag, params, bottom_up, current, out) : ERR_MEMORY;
+            i++;
+        } else {
+            result = apply_filter(ctx, flag, params, bottom_up, current, out);
+            i++;
+        }
+
+        if (result != SUCCESS) {
+            return result;
+        }
+        current = out;
+    }
+
+    if (current != dst)
+        copy_image(ctx, current, dst);
+    return SUCCESS;
+}
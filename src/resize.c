@@ -0,0 +1,210 @@
+/*
+ * resize.c
+ * Implementation of area-average downscaling.
+ *
+ * The source is never held whole: the driver reads it a block of rows at a
+ * time and hands each block to resize_rows(). The rows of a block are
+ * first summed horizontally, in parallel bands, into rows of output width;
+ * every source pixel adds its two integer weights times its value to the
+ * one or two output columns it covers, with no branch, since the second
+ * weight is zero when it covers one. The summed rows are then added, in
+ * order, to the vertical sums of the one or two output rows they cover,
+ * and an output row is written as soon as its last source row is in. The
+ * working memory is a few rows of output width plus the column tables, and
+ * the sums are exact integers, so the result is the correctly rounded
+ * average of the area each output pixel covers.
+ */
+
+#include "resize.h"
+#include "bmpio.h"
+#include "stats.h"
+
+#include <string.h>
+
+/*
+ * Data shared by all bands of one horizontal pass
+ */
+typedef struct {
+    const RESIZER *resizer;  /* Resizer being fed */
+    const IMAGE   *src;      /* Source rows */
+    int            begin;    /* First source row of the block */
+} RESIZE_JOB;
+
+/*
+ * Parses a thumbnail size written "WxH"
+ * Returns SUCCESS, or ERR_ARGS if either side is missing or not positive.
+ */
+int resize_parse(const char *text, int *width, int *height) {
+    char *end;
+    long w = strtol(text, &end, 10);
+    if (end == text || *end != RESIZE_SEPARATOR || w < 1 || w > INT32_MAX) {
+        return ERR_ARGS;
+    }
+
+    const char *rest = end + 1;
+    long h = strtol(rest, &end, 10);
+    if (end == rest || *end != '\0' || h < 1 || h > INT32_MAX) {
+        return ERR_ARGS;
+    }
+
+    *width = (int)w;
+    *height = (int)h;
+    return SUCCESS;
+}
+
+/*
+ * Returns the output index of source position k of n positions mapped onto
+ * m, and stores the weight of k in that output (the rest goes to the next)
+ */
+static int cover(int k, int n, int m, uint32_t *weight) {
+    long long start = (long long)k * m;
+    int first = (int)(start / n);
+    long long boundary = (long long)(first + 1) * n;
+    long long stop = start + m < boundary ? start + m : boundary;
+    *weight = (uint32_t)(stop - start);
+    return first;
+}
+
+/*
+ * Prepares a resizer
+ *
+ * Parameters:
+ *   resizer    - Resizer to set up
+ *   src_width  - Source width, at most MAX_RESIZE_WIDTH
+ *   src_height - Source height
+ *   dst        - Plain view receiving the output, at most as wide and as
+ *                tall as the source, of the source's pixel format
+ *   block      - Most source rows passed to one resize_rows() call
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS if dst is larger than the source or the
+ *   source too wide, ERR_MEMORY if the tables cannot be allocated)
+ */
+int resize_init(RESIZER *resizer, int src_width, int src_height, const IMAGE *dst, int block) {
+    memset(resizer, 0, sizeof(*resizer));
+    if (dst->width > src_width || dst->height > src_height || src_width > MAX_RESIZE_WIDTH) {
+        return ERR_ARGS;
+    }
+
+    const size_t row = ((size_t)dst->width + 1) * dst->channels;
+    resizer->dst = dst;
+    resizer->src_width = src_width;
+    resizer->src_height = src_height;
+    resizer->block = block;
+    resizer->column = malloc(src_width * sizeof(int32_t));
+    resizer->weight = malloc(src_width * sizeof(uint32_t));
+    resizer->rows = malloc(block * row * sizeof(uint32_t));
+    resizer->sums[0] = calloc(2 * row, sizeof(uint64_t));
+    resizer->sums[1] = resizer->sums[0] != NULL ? resizer->sums[0] + row : NULL;
+    stats_count(STATS_ALLOCS, src_width * (sizeof(int32_t) + sizeof(uint32_t)));
+    stats_count(STATS_ALLOCS, block * row * sizeof(uint32_t));
+    stats_count(STATS_ALLOCS, 2 * row * sizeof(uint64_t));
+    if (resizer->column == NULL || resizer->weight == NULL || resizer->rows == NULL || resizer->sums[0] == NULL) {
+        resize_free(resizer);
+        return ERR_MEMORY;
+    }
+
+    for (int j = 0; j < src_width; j++)
+        resizer->column[j] = cover(j, src_width, dst->width, &resizer->weight[j]);
+    return SUCCESS;
+}
+
+/*
+ * Sums one source row horizontally into a row of width + 1 output pixels
+ * The extra pixel takes the zero second weights of the last source column.
+ */
+KERNEL_TEMPLATE void resize_row(const RESIZER *resizer, const BYTE *in, uint32_t *out, const int channels) {
+    const uint32_t step = resizer->dst->width;
+
+    memset(out, 0, ((size_t)resizer->dst->width + 1) * channels * sizeof(uint32_t));
+    for (int j = 0; j < resizer->src_width; j++) {
+        const BYTE *pixel = in + (size_t)j * channels;
+        uint32_t *first = out + (size_t)resizer->column[j] * channels;
+        const uint32_t w0 = resizer->weight[j];
+        const uint32_t w1 = step - w0;
+        for (int c = 0; c < channels; c++) {
+            first[c] += w0 * pixel[c];
+            first[channels + c] += w1 * pixel[c];
+        }
+    }
+}
+
+#define DEFINE_RESIZE_BAND(name, channels) \
+    static void resize_band_##name(void *arg, int begin, int end) { \
+        RESIZE_JOB *job = arg; \
+        const RESIZER *resizer = job->resizer; \
+        const size_t row = ((size_t)resizer->dst->width + 1) * channels; \
+        for (int i = begin; i < end; i++) \
+            resize_row(resizer, image_row(job->src, job->begin + i), resizer->rows + i * row, channels); \
+    }
+PIXEL_FORMATS(DEFINE_RESIZE_BAND)
+
+#define RESIZE_BAND_ENTRY(name, channels) [channels] = resize_band_##name,
+static const BAND_FN resize_bands[PIXEL_BGRA + 1] = { PIXEL_FORMATS(RESIZE_BAND_ENTRY) };
+
+/*
+ * Writes output row `current` from its vertical sums and moves on to the next
+ */
+static void resize_flush(RESIZER *resizer) {
+    const IMAGE *dst = resizer->dst;
+    const size_t bytes = image_row_bytes(dst);
+    const size_t row = bytes + dst->channels;
+    const uint64_t area = (uint64_t)resizer->src_width * resizer->src_height;
+    BYTE *out = image_row(dst, resizer->current);
+
+    for (size_t k = 0; k < bytes; k++)
+        out[k] = (resizer->sums[0][k] + area / 2) / area;
+
+    memcpy(resizer->sums[0], resizer->sums[1], row * sizeof(uint64_t));
+    memset(resizer->sums[1], 0, row * sizeof(uint64_t));
+    resizer->current++;
+}
+
+/*
+ * Adds source rows [begin, end) to the output
+ *
+ * Parameters:
+ *   ctx     - Processing context, whose pool sums the rows horizontally
+ *   resizer - Resizer, fed every source row in order
+ *   src     - View holding the rows (a window or ring of the source)
+ *   begin   - First row, one past the last row of the previous call
+ *   end     - One past the last row, at most begin + resizer->block
+ */
+void resize_rows(CONTEXT *ctx, RESIZER *resizer, const IMAGE *src, int begin, int end) {
+    const IMAGE *dst = resizer->dst;
+    const size_t row = ((size_t)dst->width + 1) * dst->channels;
+    RESIZE_JOB job = { resizer, src, begin };
+
+    thread_pool_run(ctx->pool, end - begin, resize_bands[dst->channels], &job);
+
+    for (int i = begin; i < end; i++) {
+        uint32_t w0;
+        int first = cover(i, resizer->src_height, dst->height, &w0);
+        const uint64_t w1 = dst->height - w0;
+        const uint32_t *in = resizer->rows + (i - begin) * row;
+
+        if (first > resizer->current)
+            resize_flush(resizer);
+        for (size_t k = 0; k < row; k++) {
+            resizer->sums[0][k] += (uint64_t)w0 * in[k];
+            resizer->sums[1][k] += w1 * in[k];
+        }
+    }
+
+    if (end == resizer->src_height)
+        resize_flush(resizer);
+}
+
+/*
+ * Releases the memory of a resizer
+ */
+void resize_free(RESIZER *resizer) {
+    free(resizer->column);
+    free(resizer->weight);
+    free(resizer->rows);
+    free(resizer->sums[0]);
+    resizer->column = NULL;
+    resizer->weight = NULL;
+    resizer->rows = NULL;
+    resizer->sums[0] = resizer->sums[1] = NULL;
+}
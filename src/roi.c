@@ -0,0 +1,192 @@
+/*
+ * roi.c
+ * Implementation of region of interest filtering.
+ *
+ * A pixel filtered by a chain depends only on the source pixels within the
+ * chain's reach of it, the sum of the reaches of its stages, and on where
+ * the image edges are. Each region is therefore grown by that margin, and
+ * clipped to the image, so that its clipped sides are the image edges and
+ * its other sides lie far enough out; the grown rectangle is copied to a
+ * scratch image of its own and the whole chain runs on it, after which the
+ * region in its middle holds exactly the pixels a full-image pass would
+ * produce. The work is proportional to the area of the grown regions, not
+ * of the image, and pixels outside every region are never touched; the
+ * driver only holds the rows roi_rows() spans and passes the others
+ * straight from the input to the output.
+ */
+
+#include "roi.h"
+#include "bmpio.h"
+#include "convolve.h"
+#include "stats.h"
+
+#include <string.h>
+
+/*
+ * Parses a region written "x,y,w,h"
+ * Returns SUCCESS, or ERR_ARGS if a value is missing, x or y is negative,
+ * or w or h is not positive.
+ */
+int roi_parse(const char *text, ROI *roi) {
+    int *fields[] = { &roi->x, &roi->y, &roi->width, &roi->height };
+    const char *p = text;
+
+    for (int k = 0; k < 4; k++) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < (k < 2 ? 0 : 1) || value > INT32_MAX || *end != (k < 3 ? ROI_SEPARATOR : '\0')) {
+            return ERR_ARGS;
+        }
+        *fields[k] = (int)value;
+        p = end + 1;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Returns the number of pixels around a region, in each direction, that a
+ * chain reads to filter it
+ */
+int roi_margin(const PIPELINE *pipeline, const FILTER_PARAMS *params) {
+    int margin = 0;
+
+    for (int i = 0; i < pipeline->stages; i++) {
+        const char flag = pipeline->flags[i];
+        int reach = filter_context(flag, params);
+        if (flag == 'c' && params->kernel != NULL && params->kernel->width / 2 > reach)
+            reach = params->kernel->width / 2;
+        margin += reach;
+    }
+
+    return margin;
+}
+
+/*
+ * Clips a range [start, start + length) to [0, size)
+ * Returns the clipped length, 0 if nothing is left.
+ */
+static int clip_range(long long start, long long length, int size, int *first) {
+    long long begin = start > 0 ? start : 0;
+    long long end = start + length < size ? start + length : size;
+    *first = (int)begin;
+    return end > begin ? (int)(end - begin) : 0;
+}
+
+/*
+ * Clips regions to an image and grows them by the reach of a chain
+ * Returns the number of regions left, whose rectangles in view rows go to
+ * inner[] and, grown and clipped again, to outer[].
+ */
+static int roi_grow(const PIPELINE *pipeline, const FILTER_PARAMS *params, const ROI *rois, int count,
+                    int bottom_up, int width, int height, ROI *inner, ROI *outer) {
+    const int margin = roi_margin(pipeline, params);
+    int regions = 0;
+
+    for (int k = 0; k < count && regions < MAX_ROIS; k++) {
+        ROI *in = &inner[regions], *out = &outer[regions];
+        in->width = clip_range(rois[k].x, rois[k].width, width, &in->x);
+        in->height = clip_range(rois[k].y, rois[k].height, height, &in->y);
+        if (in->width == 0 || in->height == 0) {
+            continue;
+        }
+
+        // From here on y counts rows of the views
+        if (bottom_up)
+            in->y = height - in->y - in->height;
+        out->width = clip_range((long long)in->x - margin, in->width + 2LL * margin, width, &out->x);
+        out->height = clip_range((long long)in->y - margin, in->height + 2LL * margin, height, &out->y);
+        regions++;
+    }
+
+    return regions;
+}
+
+/*
+ * Finds the rows of an image that filtering regions reads or writes
+ * Returns the number of rows from *first on, in view order, that hold every
+ * grown region (0 if no region lies within the image); the rows outside
+ * them pass through roi_apply() untouched.
+ */
+int roi_rows(const PIPELINE *pipeline, const FILTER_PARAMS *params, const ROI *rois, int count, int bottom_up,
+             int width, int height, int *first) {
+    ROI inner[MAX_ROIS], outer[MAX_ROIS];
+    const int regions = roi_grow(pipeline, params, rois, count, bottom_up, width, height, inner, outer);
+    int begin = height, end = 0;
+
+    for (int r = 0; r < regions; r++) {
+        begin = outer[r].y < begin ? outer[r].y : begin;
+        end = outer[r].y + outer[r].height > end ? outer[r].y + outer[r].height : end;
+    }
+
+    *first = regions ? begin : 0;
+    return regions ? end - begin : 0;
+}
+
+/*
+ * Filters regions of an image
+ *
+ * Parameters:
+ *   ctx       - Processing context
+ *   pipeline  - Filters to apply, none of which moves pixels (reflect)
+ *   params    - Parameters of the filters
+ *   rois      - Regions, in picture coordinates; parts outside the image
+ *               are ignored
+ *   count     - Number of regions
+ *   bottom_up - Non-zero if the first row of the views is the bottom row
+ *               of the picture
+ *   src       - Image to read, a window or ring of at least the rows
+ *               roi_rows() reports
+ *   dst       - Image to write, likewise (may be src)
+ *
+ * Returns:
+ *   Error code (SUCCESS, or ERR_MEMORY if the regions could not be stored)
+ *
+ * Description:
+ *   Every grown region is filtered before any is written back, so that
+ *   when filtering in place no region reads pixels another has already
+ *   changed, and overlapping regions agree on the pixels they share.
+ */
+int roi_apply(CONTEXT *ctx, const PIPELINE *pipeline, const FILTER_PARAMS *params, const ROI *rois, int count,
+              int bottom_up, const IMAGE *src, const IMAGE *dst) {
+    const int channels = src->channels;
+    ROI inner[MAX_ROIS], outer[MAX_ROIS];
+    size_t offset[MAX_ROIS], total = 0;
+    const int regions = roi_grow(pipeline, params, rois, count, bottom_up, src->width, src->height, inner, outer);
+
+    for (int r = 0; r < regions; r++) {
+        offset[r] = total;
+        total += ((size_t)outer[r].width * outer[r].height * channels + CONTEXT_ALIGNMENT - 1) &
+                 ~(size_t)(CONTEXT_ALIGNMENT - 1);
+    }
+    if (regions == 0) {
+        return SUCCESS;
+    }
+
+    BYTE *scratch = malloc(total);
+    stats_count(STATS_ALLOCS, total);
+    if (scratch == NULL) {
+        return ERR_MEMORY;
+    }
+
+    int result = SUCCESS;
+    for (int r = 0; r < regions && result == SUCCESS; r++) {
+        const ROI *out = &outer[r];
+        IMAGE view = image_view(scratch + offset[r], (size_t)out->width * channels, channels, out->width, out->height);
+        for (int i = 0; i < out->height; i++)
+            memcpy(image_row(&view, i), image_row(src, out->y + i) + (size_t)out->x * channels, view.stride);
+        result = pipeline_apply(ctx, pipeline, 0, pipeline->stages, params, bottom_up, &view, &view);
+    }
+
+    for (int r = 0; r < regions && result == SUCCESS; r++) {
+        const ROI *in = &inner[r], *out = &outer[r];
+        IMAGE view = image_view(scratch + offset[r], (size_t)out->width * channels, channels, out->width, out->height);
+        size_t left = (size_t)(in->x - out->x) * channels;
+        for (int i = 0; i < in->height; i++)
+            memcpy(image_row(dst, in->y + i) + (size_t)in->x * channels,
+                   image_row(&view, in->y - out->y + i) + left, (size_t)in->width * channels);
+    }
+
+    free(scratch);
+    return result;
+}
@@ -0,0 +1,123 @@
+/*
+ * rowqueue.c
+ * Implementation of the bounded row queue.
+ *
+ * Both sides only ever move forward through the rows of one image, so the
+ * whole state is two row counts under a mutex. Each side sleeps on the
+ * condition variable until the other has moved far enough, and every
+ * change wakes it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "rowqueue.h"
+#include "bmpio.h"
+
+#include <pthread.h>
+
+/*
+ * Row queue state
+ */
+struct ROW_QUEUE {
+    pthread_mutex_t lock;        /* Protects every field below */
+    pthread_cond_t  changed;     /* Signalled whenever a count or error changes */
+    int             capacity;    /* Rows of the ring buffer */
+    int             pushed;      /* Rows [0, pushed) have been produced */
+    int             released;    /* Rows [0, released) may be overwritten */
+    int             error;       /* Error code once aborted, SUCCESS before */
+};
+
+/*
+ * Creates a row queue
+ *
+ * Parameters:
+ *   capacity - Rows of the ring buffer the queue tracks
+ *
+ * Returns:
+ *   Queue handle, or NULL if it could not be allocated
+ */
+ROW_QUEUE *row_queue_create(int capacity) {
+    ROW_QUEUE *queue = malloc(sizeof(ROW_QUEUE));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->capacity = capacity;
+    queue->pushed = 0;
+    queue->released = 0;
+    queue->error = SUCCESS;
+    return queue;
+}
+
+/*
+ * Releases a row queue (NULL is ignored); no thread may be waiting on it
+ */
+void row_queue_destroy(ROW_QUEUE *queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+/*
+ * Producer: waits until the rows before `end` fit in the ring, that is
+ * until the consumer has released every row before end - capacity
+ */
+int row_queue_reserve(ROW_QUEUE *queue, int end) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->error == SUCCESS && end > queue->released + queue->capacity)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    int error = queue->error;
+    pthread_mutex_unlock(&queue->lock);
+    return error;
+}
+
+/*
+ * Producer: publishes the rows before `end`
+ */
+void row_queue_push(ROW_QUEUE *queue, int end) {
+    pthread_mutex_lock(&queue->lock);
+    queue->pushed = end;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Consumer: waits until the rows before `end` have been pushed
+ */
+int row_queue_wait(ROW_QUEUE *queue, int end) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->error == SUCCESS && queue->pushed < end)
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    int error = queue->error;
+    pthread_mutex_unlock(&queue->lock);
+    return error;
+}
+
+/*
+ * Consumer: hands the slots of the rows before `end` back to the producer
+ */
+void row_queue_release(ROW_QUEUE *queue, int end) {
+    pthread_mutex_lock(&queue->lock);
+    if (end > queue->released)
+        queue->released = end;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Stops both sides: every current and later wait returns `error`
+ * Only the first error is kept.
+ */
+void row_queue_abort(ROW_QUEUE *queue, int error) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->error == SUCCESS)
+        queue->error = error;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,668 @@
+/*
+ * serve.c
+ * Implementation of server mode.
+ *
+ * The server listens on a Unix socket and runs one worker per pool thread,
+ * each accepting connections and answering their requests one after
+ * another, so at most that many requests are filtered at once and further
+ * connections wait in the listen backlog. As in batch mode, a worker
+ * filters serially on a context of its own and keeps its request and
+ * response buffers from one request to the next, so a warm server
+ * allocates nothing per image of a size it has seen. A bitmap is filtered
+ * straight from the bytes received into the bytes sent: both views use the
+ * file's padded rows, and only the padding is cleared afterwards.
+ *
+ * Every answered request adds its latency, from the request line to the
+ * last byte of the answer, to a histogram of its chain. Histograms have
+ * logarithmic buckets of a fixed size, so percentiles cost no memory per
+ * request; they are accurate to within one eighth.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "serve.h"
+#include "bmpio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Latency histogram size */
+#define SERVE_LATENCY_BUCKETS ((1 << SERVE_LATENCY_LINEAR) + \
+                               (SERVE_LATENCY_OCTAVES - SERVE_LATENCY_LINEAR) * (1 << SERVE_LATENCY_STEPS))
+#define SERVE_NAME_BYTES     (MAX_STAGES * 10)  /* Longest chain name: stage names and separators */
+
+/*
+ * Latencies of the requests for one chain
+ */
+typedef struct {
+    char          name[SERVE_NAME_BYTES];         /* Chain in --pipeline names, e.g. "reflect,blur" */
+    unsigned long count;                          /* Requests answered */
+    unsigned long failed;                         /* Requests answered with an error */
+    long long     max_us;                         /* Slowest request in microseconds */
+    unsigned long buckets[SERVE_LATENCY_BUCKETS]; /* Requests per latency bucket */
+} SERVE_METRIC;
+
+/*
+ * Connection being served, with the bytes received beyond what was consumed
+ */
+typedef struct {
+    int    fd;                        /* Connected socket */
+    char   buffer[SERVE_LINE_BYTES];  /* Bytes received */
+    size_t begin;                     /* First byte not consumed yet */
+    size_t end;                       /* One past the last byte received */
+} CONNECTION;
+
+/*
+ * Buffers owned by one worker and reused across requests
+ */
+typedef struct {
+    BUFFER   request;       /* Encoded bitmap received */
+    BUFFER   response;      /* Encoded bitmap sent back */
+    CONTEXT  ctx;           /* Serial processing context for the filters */
+} SERVE_WORKER;
+
+/*
+ * State shared by the workers of one serve_run() call
+ */
+typedef struct {
+    int                  listener;  /* Non-blocking listening socket */
+    const FILTER_PARAMS *params;    /* Filter parameters of every request */
+    SERVE_WORKER        *workers;   /* One buffer set per worker */
+    int                  count;     /* Number of workers */
+    pthread_mutex_t      lock;      /* Protects the metrics */
+    SERVE_METRIC        *metrics;   /* SERVE_MAX_METRICS chains, then SERVE_OTHER_METRIC */
+    int                  chains;    /* Chains with a metric of their own */
+    unsigned long        rejected;  /* Requests whose chain could not be parsed */
+} SERVER;
+
+/* Set by SIGINT or SIGTERM; workers finish their request and stop */
+static volatile sig_atomic_t serve_stopping = 0;
+
+/*
+ * Signal handler asking the server to stop
+ */
+static void serve_stop(int number) {
+    serve_stopping = 1;
+}
+
+/*
+ * Returns the monotonic clock in microseconds
+ */
+static long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Returns the histogram bucket of a latency
+ */
+static int latency_bucket(long long us) {
+    const int linear = 1 << SERVE_LATENCY_LINEAR;
+    if (us < linear) {
+        return us > 0 ? (int)us : 0;
+    }
+
+    int octave = SERVE_LATENCY_LINEAR;
+    while (octave + 1 < SERVE_LATENCY_OCTAVES && us >> (octave + 1) != 0)
+        octave++;
+    int step = (int)(us >> (octave - SERVE_LATENCY_STEPS)) & ((1 << SERVE_LATENCY_STEPS) - 1);
+    return linear + (octave - SERVE_LATENCY_LINEAR) * (1 << SERVE_LATENCY_STEPS) + step;
+}
+
+/*
+ * Returns the smallest latency above a histogram bucket, in microseconds
+ */
+static long long latency_bound(int bucket) {
+    const int linear = 1 << SERVE_LATENCY_LINEAR;
+    if (bucket < linear) {
+        return bucket + 1;
+    }
+
+    int octave = SERVE_LATENCY_LINEAR + (bucket - linear) / (1 << SERVE_LATENCY_STEPS);
+    int step = (bucket - linear) % (1 << SERVE_LATENCY_STEPS);
+    return (long long)((1 << SERVE_LATENCY_STEPS) + step + 1) << (octave - SERVE_LATENCY_STEPS);
+}
+
+/*
+ * Returns a latency percentile of a chain in milliseconds
+ * The latency is the upper bound of its bucket, but never above the slowest
+ * request, so that a single request reports its own latency.
+ */
+static double metric_percentile(const SERVE_METRIC *metric, double fraction) {
+    unsigned long rank = (unsigned long)ceil(fraction * metric->count);
+    unsigned long seen = 0;
+    int bucket = 0;
+
+    rank = rank > 0 ? rank : 1;
+    while (bucket < SERVE_LATENCY_BUCKETS - 1 && (seen += metric->buckets[bucket]) < rank)
+        bucket++;
+
+    long long bound = latency_bound(bucket);
+    return (bound < metric->max_us ? bound : metric->max_us) / 1000.0;
+}
+
+/*
+ * Writes the name of a chain as its --pipeline stage names
+ */
+static void chain_name(const PIPELINE *pipeline, char *name) {
+    name[0] = '\0';
+    for (int i = 0; i < pipeline->stages; i++) {
+        if (i > 0)
+            strcat(name, ",");
+        strcat(name, pipeline_stage_name(pipeline->flags[i]));
+    }
+}
+
+/*
+ * Adds an answered request to the metrics of its chain
+ *
+ * Parameters:
+ *   server   - Server
+ *   pipeline - Chain of the request (no stages if it could not be parsed)
+ *   result   - Error code the request was answered with
+ *   us       - Latency in microseconds
+ */
+static void metrics_add(SERVER *server, const PIPELINE *pipeline, int result, long long us) {
+    char name[SERVE_NAME_BYTES];
+    chain_name(pipeline, name);
+
+    pthread_mutex_lock(&server->lock);
+    if (pipeline->stages == 0) {
+        server->rejected++;
+        pthread_mutex_unlock(&server->lock);
+        return;
+    }
+
+    int index = 0;
+    while (index < server->chains && strcmp(server->metrics[index].name, name) != 0)
+        index++;
+    if (index == server->chains && server->chains < SERVE_MAX_METRICS) {
+        strcpy(server->metrics[index].name, name);
+        server->chains++;
+    }
+
+    SERVE_METRIC *metric = &server->metrics[index];
+    metric->count++;
+    metric->failed += result != SUCCESS;
+    metric->max_us = us > metric->max_us ? us : metric->max_us;
+    metric->buckets[latency_bucket(us)]++;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/*
+ * Writes the metrics as a single-line JSON object
+ *
+ * Parameters:
+ *   out    - Stream to write to
+ *   server - Server, whose metrics are locked while they are written
+ *
+ * Description:
+ *   Reports the totals and, per chain in order of first use, the request
+ *   and error counts and the p50, p99 and maximum latencies
+ */
+static void metrics_report(FILE *out, SERVER *server) {
+    unsigned long requests = 0, failed = 0;
+
+    pthread_mutex_lock(&server->lock);
+    for (int k = 0; k <= SERVE_MAX_METRICS; k++) {
+        requests += server->metrics[k].count;
+        failed += server->metrics[k].failed;
+    }
+
+    fprintf(out, "{\"workers\": %d, \"requests\": %lu, \"failed\": %lu, \"rejected\": %lu, \"chains\": {",
+            server->count, requests, failed, server->rejected);
+    int first = 1;
+    for (int k = 0; k <= SERVE_MAX_METRICS; k++) {
+        const SERVE_METRIC *metric = &server->metrics[k];
+        if (metric->count == 0)
+            continue;
+
+        fprintf(out, "%s\"%s\": {\"count\": %lu, \"failed\": %lu, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+                "\"max_ms\": %.3f}", first ? "" : ", ", metric->name, metric->count, metric->failed,
+                metric_percentile(metric, 0.50), metric_percentile(metric, 0.99), metric->max_us / 1000.0);
+        first = 0;
+    }
+    fprintf(out, "}}\n");
+    pthread_mutex_unlock(&server->lock);
+}
+
+/*
+ * Receives the next bytes of a connection into its buffer
+ * Returns non-zero if any arrived, 0 at the end of the connection or on a
+ * timeout.
+ */
+static int connection_fill(CONNECTION *conn) {
+    ssize_t got;
+    do {
+        got = recv(conn->fd, conn->buffer, sizeof(conn->buffer), 0);
+    } while (got < 0 && errno == EINTR);
+
+    conn->begin = 0;
+    conn->end = got > 0 ? (size_t)got : 0;
+    return got > 0;
+}
+
+/*
+ * Waits for the next request of a connection
+ * Returns non-zero once its first byte is in, 0 if the client closed the
+ * connection, stayed idle for SERVE_IDLE_MS or the server is stopping.
+ */
+static int connection_wait(CONNECTION *conn) {
+    struct pollfd poller = { conn->fd, POLLIN, 0 };
+
+    for (int idle = 0; conn->begin == conn->end; idle += SERVE_POLL_MS) {
+        if (serve_stopping || idle >= SERVE_IDLE_MS) {
+            return 0;
+        }
+        int ready = poll(&poller, 1, SERVE_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            return 0;
+        }
+        if (ready > 0 && !connection_fill(conn)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Reads a request line, without its newline (or carriage return and newline)
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS if the line is longer than
+ *   SERVE_LINE_BYTES, ERR_HEADER_READ if the connection ends first)
+ */
+static int connection_line(CONNECTION *conn, char *line) {
+    size_t length = 0;
+
+    for (;;) {
+        if (conn->begin == conn->end && !connection_fill(conn)) {
+            return ERR_HEADER_READ;
+        }
+        char c = conn->buffer[conn->begin++];
+        if (c == '\n') {
+            break;
+        }
+        if (length + 1 >= SERVE_LINE_BYTES) {
+            return ERR_ARGS;
+        }
+        line[length++] = c;
+    }
+
+    if (length > 0 && line[length - 1] == '\r')
+        length--;
+    line[length] = '\0';
+    return SUCCESS;
+}
+
+/*
+ * Reads `size` bytes of a request body
+ * Returns SUCCESS, or ERR_IMAGE_READ if the connection ends or times out.
+ */
+static int connection_read(CONNECTION *conn, BYTE *data, size_t size) {
+    size_t done = conn->end - conn->begin < size ? conn->end - conn->begin : size;
+    memcpy(data, conn->buffer + conn->begin, done);
+    conn->begin += done;
+
+    while (done < size) {
+        ssize_t got = recv(conn->fd, data + done, size - done, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return ERR_IMAGE_READ;
+        }
+        done += got;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Sends bytes to the client
+ * Returns SUCCESS, or ERR_WRITE_DATA if the connection is lost or times out.
+ */
+static int connection_write(CONNECTION *conn, const void *data, size_t size) {
+    const char *bytes = data;
+
+    while (size > 0) {
+        ssize_t sent = send(conn->fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return ERR_WRITE_DATA;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Sends the "OK <size>" line and body of a successful answer
+ */
+static int connection_answer(CONNECTION *conn, const void *data, size_t size) {
+    char line[64];
+    int length = snprintf(line, sizeof(line), "OK %zu\n", size);
+    int result = connection_write(conn, line, length);
+    return result == SUCCESS ? connection_write(conn, data, size) : result;
+}
+
+/*
+ * Sends the "ERR <code> <message>" line of a failed request
+ */
+static int connection_error(CONNECTION *conn, int code) {
+    char line[128];
+    int length = snprintf(line, sizeof(line), "ERR %d %s\n", code, bmp_error_message(code));
+    return connection_write(conn, line, length);
+}
+
+/*
+ * Loads a bitmap named by a request into a worker's request buffer
+ *
+ * Returns:
+ *   Error code (SUCCESS, ERR_ARGS if the file cannot be opened or is larger
+ *   than SERVE_MAX_REQUEST, ERR_MEMORY, ERR_IMAGE_READ if it cannot be read)
+ */
+static int load_file(const char *path, BUFFER *request, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    struct stat info;
+    if (file == NULL) {
+        return ERR_ARGS;
+    }
+    if (fstat(fileno(file), &info) != 0 || !S_ISREG(info.st_mode) || info.st_size > SERVE_MAX_REQUEST) {
+        fclose(file);
+        return ERR_ARGS;
+    }
+
+    *size = info.st_size;
+    BYTE *data = context_buffer(request, *size);
+    int result = data == NULL ? ERR_MEMORY : fread(data, 1, *size, file) == *size ? SUCCESS : ERR_IMAGE_READ;
+    fclose(file);
+    return result;
+}
+
+/*
+ * Receives and filters one request
+ *
+ * Parameters:
+ *   server   - Server
+ *   worker   - Buffers of the worker; the answer is left in its response
+ *   conn     - Connection, positioned after the request line
+ *   line     - Request line, modified
+ *   pipeline - Receives the chain (no stages if it could not be parsed)
+ *   size     - Receives the size of the answer
+ *   keep     - Cleared if the connection cannot be used after this request
+ *
+ * Returns:
+ *   Error code of the request (SUCCESS if the answer is ready)
+ *
+ * Description:
+ *   The body of a request is received even when its chain is invalid, so
+ *   that the next request is found. A request whose size cannot be read or
+ *   is refused leaves the rest of the connection unusable.
+ */
+static int serve_request(SERVER *server, SERVE_WORKER *worker, CONNECTION *conn, char *line,
+                         PIPELINE *pipeline, size_t *size, int *keep) {
+    char *argument = strchr(line, ' ');
+    size_t length = 0;
+    int result;
+
+    pipeline->stages = 0;
+    if (argument == NULL) {
+        *keep = 0;
+        return ERR_ARGS;
+    }
+    *argument++ = '\0';
+
+    if (argument[0] == '@') {
+        result = load_file(argument + 1, &worker->request, &length);
+    } else {
+        char *end;
+        unsigned long long parsed = strtoull(argument, &end, 10);
+        if (end == argument || *end != '\0' || argument[0] == '-' || parsed > SERVE_MAX_REQUEST) {
+            *keep = 0;
+            return ERR_ARGS;
+        }
+        length = parsed;
+        result = context_buffer(&worker->request, length) != NULL ? SUCCESS : ERR_MEMORY;
+        if (result == SUCCESS)
+            result = connection_read(conn, worker->request.data, length);
+        if (result != SUCCESS) {
+            *keep = 0;
+            return result;
+        }
+    }
+
+    if (pipeline_parse(line, pipeline) == 0) {
+        return ERR_ARGS;
+    }
+    for (int i = 0; i < pipeline->stages; i++) {
+        if (pipeline->flags[i] == 'c' && server->params->kernel == NULL)
+            return ERR_ARGS;
+    }
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    const BYTE *data = worker->request.data;
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    result = bmp_read_headers_mem(data, length, &bi);
+    if (result != SUCCESS) {
+        return result;
+    }
+    memcpy(&bf, data, sizeof(BITMAPFILEHEADER));
+
+    const int width = bi.biWidth;
+    const int height = bmp_height(&bi);
+    const int channels = bmp_channels(&bi);
+    const size_t stride = bmp_stride(width, channels);
+    *size = bmp_encoded_size(width, height, channels);
+    BYTE *out = context_buffer(&worker->response, *size);
+    if (out == NULL) {
+        return ERR_MEMORY;
+    }
+
+    // Filter the received rows straight into the rows sent back
+    IMAGE src = image_view((BYTE *)data + BITMAP_HEADER_SIZE, stride, channels, width, height);
+    IMAGE dst = image_view(out + BITMAP_HEADER_SIZE, stride, channels, width, height);
+    result = pipeline_apply(&worker->ctx, pipeline, 0, pipeline->stages, server->params, bi.biHeight > 0,
+                            &src, &dst);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    const size_t row_bytes = image_row_bytes(&dst);
+    for (int i = 0; i < height; i++)
+        memset(image_row(&dst, i) + row_bytes, 0, stride - row_bytes);
+    bmp_set_size(&bf, &bi, width, height);
+    memcpy(out, &bf, sizeof(BITMAPFILEHEADER));
+    memcpy(out + sizeof(BITMAPFILEHEADER), &bi, sizeof(BITMAPINFOHEADER));
+
+    return SUCCESS;
+}
+
+/*
+ * Answers the requests of one connection until it closes
+ */
+static void serve_connection(SERVER *server, SERVE_WORKER *worker, int fd) {
+    CONNECTION conn = { .fd = fd, .begin = 0, .end = 0 };
+    char line[SERVE_LINE_BYTES];
+
+    // A client stalling in the middle of a request is dropped
+    struct timeval timeout = { SERVE_IDLE_MS / 1000, SERVE_IDLE_MS % 1000 * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    while (connection_wait(&conn)) {
+        long long start = now_us();
+        int result = connection_line(&conn, line);
+        if (result != SUCCESS) {
+            if (result == ERR_ARGS)
+                connection_error(&conn, result);
+            break;
+        }
+
+        if (strcmp(line, SERVE_STATS) == 0) {
+            char *text = NULL;
+            size_t length = 0;
+            FILE *out = open_memstream(&text, &length);
+            if (out == NULL) {
+                result = connection_error(&conn, ERR_MEMORY);
+            } else {
+                metrics_report(out, server);
+                fclose(out);
+                result = connection_answer(&conn, text, length);
+            }
+            free(text);
+            if (result != SUCCESS)
+                break;
+            continue;
+        }
+
+        PIPELINE pipeline;
+        size_t size = 0;
+        int keep = 1;
+        result = serve_request(server, worker, &conn, line, &pipeline, &size, &keep);
+        int sent = result == SUCCESS ? connection_answer(&conn, worker->response.data, size)
+                                     : connection_error(&conn, result);
+        metrics_add(server, &pipeline, result != SUCCESS ? result : sent, now_us() - start);
+        if (!keep || sent != SUCCESS)
+            break;
+    }
+}
+
+/*
+ * Worker loop: accepts and serves connections until the server stops
+ */
+static void serve_worker(void *arg, int begin, int end) {
+    SERVER *server = arg;
+    SERVE_WORKER *worker = &server->workers[begin];
+    struct pollfd poller = { server->listener, POLLIN, 0 };
+
+    while (!serve_stopping) {
+        if (poll(&poller, 1, SERVE_POLL_MS) <= 0) {
+            continue;
+        }
+
+        // Another worker may have taken the connection first
+        int fd = accept(server->listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        serve_connection(server, worker, fd);
+        close(fd);
+    }
+}
+
+/*
+ * Opens the listening socket
+ * A socket left behind by an earlier server is replaced; any other file at
+ * the path makes binding fail.
+ */
+static int serve_listen(const char *path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    struct stat info;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return -1;
+    }
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, SERVE_BACKLOG) != 0 || fcntl(listener, F_SETFL, O_NONBLOCK) != 0) {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+/*
+ * Serves filter requests on a Unix socket until SIGINT or SIGTERM
+ *
+ * Parameters:
+ *   path   - Socket path, created on start and removed on exit
+ *   params - Filter parameters of every request
+ *   pool   - Pool whose threads act as workers (NULL for one worker)
+ *   report - Receives the latency metrics on exit
+ *
+ * Returns:
+ *   Error code (SUCCESS once stopped, ERR_SOCKET if the socket cannot be
+ *   set up, ERR_MEMORY if the workers cannot be set up)
+ *
+ * Description:
+ *   The pool size is the request concurrency limit: each of its threads
+ *   serves one connection at a time, filtering serially.
+ */
+int serve_run(const char *path, const FILTER_PARAMS *params, THREAD_POOL *pool, FILE *report) {
+    SERVER server = { -1, params, NULL, thread_pool_size(pool), PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+
+    server.listener = serve_listen(path);
+    if (server.listener < 0) {
+        printf("Could not listen on %s.\n", path);
+        return ERR_SOCKET;
+    }
+
+    server.workers = calloc(server.count, sizeof(SERVE_WORKER));
+    server.metrics = calloc(SERVE_MAX_METRICS + 1, sizeof(SERVE_METRIC));
+    if (server.workers == NULL || server.metrics == NULL) {
+        free(server.metrics);
+        free(server.workers);
+        close(server.listener);
+        unlink(path);
+        printf("Not enough memory to start the server.\n");
+        return ERR_MEMORY;
+    }
+    strcpy(server.metrics[SERVE_MAX_METRICS].name, SERVE_OTHER_METRIC);
+    for (int w = 0; w < server.count; w++)
+        context_init(&server.workers[w].ctx, NULL);
+
+    // Without SA_RESTART, a signal also cuts the wait of the thread it hits short
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serve_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "Serving on %s with %d workers\n", path, server.count);
+
+    // One band per worker; the band index selects the worker's buffers
+    thread_pool_run(pool, server.count, serve_worker, &server);
+
+    metrics_report(report, &server);
+    for (int w = 0; w < server.count; w++) {
+        free(server.workers[w].request.data);
+        free(server.workers[w].response.data);
+        context_free(&server.workers[w].ctx);
+    }
+    free(server.workers);
+    free(server.metrics);
+    pthread_mutex_destroy(&server.lock);
+    close(server.listener);
+    unlink(path);
+
+    return SUCCESS;
+}
@@ -0,0 +1,532 @@
+/*
+ * simd.c
+ * Vectorised grayscale and reflection row kernels.
+ *
+ * Kernels load 16 packed BGR pixels (48 bytes) at a time, split them into
+ * one register per channel with byte shuffles, compute the result lanes and
+ * broadcast each result byte back to the three channels with a second set
+ * of shuffles. The best kernel set for the running CPU is picked once; the
+ * scalar code in filters.c stays the reference and handles row tails.
+ * The reflection kernel reverses 16-pixel blocks with the same kind of
+ * three-register shuffles; the AVX2 set reuses the SSE4.1 one, since
+ * 256-bit byte shuffles cannot move bytes across 128-bit lanes.
+ *
+ * BGRA pixels fill one 32-bit lane each, so their kernels need no
+ * shuffles: the channels are shifted and masked out of each lane, the
+ * result is broadcast back with a multiply by 0x010101 and the alpha byte
+ * is merged in unchanged, and reflection reverses whole lanes. The NEON
+ * set has no BGRA kernels; those rows use the scalar code.
+ *
+ * Results are bit-exact with the scalar round() code:
+ *   - grayscale: round(sum / 3.0f) equals (sum + 1) / 3 for every channel
+ *     sum 0..765, computed as ((sum + 1) * 43691) >> 17 in 16-bit lanes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "simd.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Pixels processed per 128-bit block */
+#define BLOCK_PIXELS 16
+
+/* Kernel set selected for this process */
+static ROW_KERNEL selected_grayscale = NULL;
+static ROW_KERNEL selected_reflect = NULL;
+static ROW_KERNEL selected_grayscale_bgra = NULL;
+static ROW_KERNEL selected_reflect_bgra = NULL;
+static const char *selected_name = "scalar";
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+
+#ifdef SIMD_X86
+
+/*
+ * Shuffle masks splitting three 16-byte BGR registers into channel planes
+ * Entry [c][r] gathers channel c (0 = blue, 1 = green, 2 = red) of the
+ * pixels held in source register r; -1 lanes are zeroed so the three
+ * partial results can be OR-ed together.
+ */
+static const int8_t split_mask[3][3][16] = {
+    { {  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13 } },
+    { {  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14 } },
+    { {  2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15 } },
+};
+
+/*
+ * Shuffle masks broadcasting 16 result bytes to 16 BGR pixels
+ * Output register r byte k belongs to pixel (16 * r + k) / 3.
+ */
+static const int8_t merge_mask[3][16] = {
+    {  0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5 },
+    {  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10 },
+    { 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 },
+};
+
+/*
+ * Shuffle masks reversing the order of 16 BGR pixels held in three registers
+ * Entry [r][s] gathers the bytes of output register r found in source
+ * register s; output pixel p is source pixel 15 - p.
+ */
+static const int8_t reverse_mask[3][3][16] = {
+    { { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14 },
+      { 13, 14, 15, 10, 11, 12,  7,  8,  9,  4,  5,  6,  1,  2,  3, -1 } },
+    { { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 15, -1 },
+      { 15, -1, 11, 12, 13,  8,  9, 10,  5,  6,  7,  2,  3,  4, -1,  0 },
+      { -1,  0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 } },
+    { { -1, 12, 13, 14,  9, 10, 11,  6,  7,  8,  3,  4,  5,  0,  1,  2 },
+      {  1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 } },
+};
+
+/*
+ * Gathers one channel of 16 pixels held in three registers
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i split_sse(__m128i a, __m128i b, __m128i c, int channel) {
+    __m128i x = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)split_mask[channel][0]));
+    __m128i y = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)split_mask[channel][1]));
+    __m128i z = _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)split_mask[channel][2]));
+    return _mm_or_si128(_mm_or_si128(x, y), z);
+}
+
+/*
+ * Stores 16 result bytes as 16 gray BGR pixels
+ */
+__attribute__((target("sse4.1")))
+static inline void merge_sse(__m128i value, BYTE *out) {
+    for (int r = 0; r < 3; r++) {
+        __m128i mask = _mm_loadu_si128((const __m128i *)merge_mask[r]);
+        _mm_storeu_si128((__m128i *)(out + 16 * r), _mm_shuffle_epi8(value, mask));
+    }
+}
+
+/*
+ * Gathers the bytes of reversed register r found in source register s
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i reverse_part(__m128i value, int r, int s) {
+    return _mm_shuffle_epi8(value, _mm_loadu_si128((const __m128i *)reverse_mask[r][s]));
+}
+
+/*
+ * Reverses the order of 16 pixels held in three registers
+ * Only five of the nine reverse_mask entries select any bytes.
+ */
+__attribute__((target("sse4.1")))
+static inline void reverse_sse(__m128i *a, __m128i *b, __m128i *c) {
+    __m128i x = _mm_or_si128(reverse_part(*b, 0, 1), reverse_part(*c, 0, 2));
+    __m128i y = _mm_or_si128(_mm_or_si128(reverse_part(*a, 1, 0), reverse_part(*b, 1, 1)),
+                             reverse_part(*c, 1, 2));
+    __m128i z = _mm_or_si128(reverse_part(*a, 2, 0), reverse_part(*b, 2, 1));
+    *a = x;
+    *b = y;
+    *c = z;
+}
+
+/*
+ * Grayscale of 8 pixels from 16-bit channel lanes: ((sum + 1) * 43691) >> 17
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i gray_sse(__m128i blue, __m128i green, __m128i red) {
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(blue, green), red);
+    sum = _mm_add_epi16(sum, _mm_set1_epi16(1));
+    return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((short)43691)), 1);
+}
+
+/*
+ * SSE4.1 grayscale row kernel
+ */
+__attribute__((target("sse4.1")))
+static int grayscale_row_sse41(const BYTE *in, BYTE *out, int width) {
+    const BYTE *src = in;
+    BYTE *dst = out;
+    const __m128i zero = _mm_setzero_si128();
+    int j = 0;
+
+    for (; j + BLOCK_PIXELS <= width; j += BLOCK_PIXELS, src += 48, dst += 48) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i blue = split_sse(a, b, c, 0);
+        __m128i green = split_sse(a, b, c, 1);
+        __m128i red = split_sse(a, b, c, 2);
+
+        __m128i lo = gray_sse(_mm_unpacklo_epi8(blue, zero), _mm_unpacklo_epi8(green, zero),
+                              _mm_unpacklo_epi8(red, zero));
+        __m128i hi = gray_sse(_mm_unpackhi_epi8(blue, zero), _mm_unpackhi_epi8(green, zero),
+                              _mm_unpackhi_epi8(red, zero));
+        merge_sse(_mm_packus_epi16(lo, hi), dst);
+    }
+
+    return j;
+}
+
+/*
+ * SSE4.1 reflection row kernel
+ * Reverses one block of 16 pixels from each end of the row per step, walking
+ * both ends forwards in 48-byte blocks. Both blocks are loaded before either
+ * is stored, so the row may be reflected in place.
+ */
+__attribute__((target("sse4.1")))
+static int reflect_row_sse41(const BYTE *in, BYTE *out, int width) {
+    int j = 0;
+
+    for (; 2 * (j + BLOCK_PIXELS) <= width; j += BLOCK_PIXELS) {
+        const BYTE *head = in + 3 * j;
+        const BYTE *tail = in + 3 * (width - j - BLOCK_PIXELS);
+        __m128i a = _mm_loadu_si128((const __m128i *)head);
+        __m128i b = _mm_loadu_si128((const __m128i *)(head + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(head + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)tail);
+        __m128i e = _mm_loadu_si128((const __m128i *)(tail + 16));
+        __m128i f = _mm_loadu_si128((const __m128i *)(tail + 32));
+        reverse_sse(&a, &b, &c);
+        reverse_sse(&d, &e, &f);
+
+        BYTE *front = out + 3 * j;
+        BYTE *back = out + 3 * (width - j - BLOCK_PIXELS);
+        _mm_storeu_si128((__m128i *)front, d);
+        _mm_storeu_si128((__m128i *)(front + 16), e);
+        _mm_storeu_si128((__m128i *)(front + 32), f);
+        _mm_storeu_si128((__m128i *)back, a);
+        _mm_storeu_si128((__m128i *)(back + 16), b);
+        _mm_storeu_si128((__m128i *)(back + 32), c);
+    }
+
+    return j;
+}
+
+/*
+ * Loads 32 pixels (96 bytes) so that pixels 0-15 sit in the low 128-bit
+ * lanes and pixels 16-31 in the high lanes, matching the in-lane shuffles
+ */
+__attribute__((target("avx2")))
+static inline void load_avx2(const BYTE *src, __m256i *a, __m256i *b, __m256i *c) {
+    *a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+                                 _mm_loadu_si128((const __m128i *)(src + 48)), 1);
+    *b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 16))),
+                                 _mm_loadu_si128((const __m128i *)(src + 64)), 1);
+    *c = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 32))),
+                                 _mm_loadu_si128((const __m128i *)(src + 80)), 1);
+}
+
+/*
+ * Gathers one channel of 32 pixels laid out by load_avx2()
+ */
+__attribute__((target("avx2")))
+static inline __m256i split_avx2(__m256i a, __m256i b, __m256i c, int channel) {
+    __m256i x = _mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)split_mask[channel][0])));
+    __m256i y = _mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)split_mask[channel][1])));
+    __m256i z = _mm256_shuffle_epi8(c, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)split_mask[channel][2])));
+    return _mm256_or_si256(_mm256_or_si256(x, y), z);
+}
+
+/*
+ * Stores 32 result bytes (pixels 0-15 in the low lane) as 32 gray BGR pixels
+ */
+__attribute__((target("avx2")))
+static inline void merge_avx2(__m256i value, BYTE *out) {
+    for (int r = 0; r < 3; r++) {
+        __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)merge_mask[r]));
+        __m256i bytes = _mm256_shuffle_epi8(value, mask);
+        _mm_storeu_si128((__m128i *)(out + 16 * r), _mm256_castsi256_si128(bytes));
+        _mm_storeu_si128((__m128i *)(out + 48 + 16 * r), _mm256_extracti128_si256(bytes, 1));
+    }
+}
+
+/*
+ * AVX2 grayscale row kernel
+ */
+__attribute__((target("avx2")))
+static int grayscale_row_avx2(const BYTE *in, BYTE *out, int width) {
+    const BYTE *src = in;
+    BYTE *dst = out;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i third = _mm256_set1_epi16((short)43691);
+    int j = 0;
+
+    for (; j + 2 * BLOCK_PIXELS <= width; j += 2 * BLOCK_PIXELS, src += 96, dst += 96) {
+        __m256i a, b, c;
+        load_avx2(src, &a, &b, &c);
+        __m256i blue = split_avx2(a, b, c, 0);
+        __m256i green = split_avx2(a, b, c, 1);
+        __m256i red = split_avx2(a, b, c, 2);
+
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(blue, zero),
+                                                       _mm256_unpacklo_epi8(green, zero)),
+                                      _mm256_unpacklo_epi8(red, zero));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(blue, zero),
+                                                       _mm256_unpackhi_epi8(green, zero)),
+                                      _mm256_unpackhi_epi8(red, zero));
+        lo = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(lo, one), third), 1);
+        hi = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(hi, one), third), 1);
+        merge_avx2(_mm256_packus_epi16(lo, hi), dst);
+    }
+
+    // Finish a remaining block of 16 with the 128-bit kernel
+    return j + grayscale_row_sse41(src, dst, width - j);
+}
+
+/*
+ * Splits 4 BGRA pixels into 32-bit channel lanes
+ */
+__attribute__((target("sse4.1")))
+static inline void split_bgra_sse(__m128i px, __m128i *blue, __m128i *green, __m128i *red) {
+    const __m128i low = _mm_set1_epi32(0xFF);
+    *blue = _mm_and_si128(px, low);
+    *green = _mm_and_si128(_mm_srli_epi32(px, 8), low);
+    *red = _mm_and_si128(_mm_srli_epi32(px, 16), low);
+}
+
+/*
+ * Broadcasts a result lane to the colour channels of 4 BGRA pixels,
+ * keeping the alpha of px
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i merge_bgra_sse(__m128i value, __m128i px) {
+    __m128i alpha = _mm_andnot_si128(_mm_set1_epi32(0xFFFFFF), px);
+    return _mm_or_si128(_mm_mullo_epi32(value, _mm_set1_epi32(0x010101)), alpha);
+}
+
+/*
+ * SSE4.1 BGRA grayscale row kernel: ((sum + 1) * 43691) >> 17 in 32-bit lanes
+ */
+__attribute__((target("sse4.1")))
+static int grayscale_row_bgra_sse41(const BYTE *in, BYTE *out, int width) {
+    int j = 0;
+
+    for (; j + 4 <= width; j += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i *)(in + 4 * j));
+        __m128i blue, green, red;
+        split_bgra_sse(px, &blue, &green, &red);
+        __m128i sum = _mm_add_epi32(_mm_add_epi32(blue, green), _mm_add_epi32(red, _mm_set1_epi32(1)));
+        __m128i gray = _mm_srli_epi32(_mm_mullo_epi32(sum, _mm_set1_epi32(43691)), 17);
+        _mm_storeu_si128((__m128i *)(out + 4 * j), merge_bgra_sse(gray, px));
+    }
+
+    return j;
+}
+
+/*
+ * SSE4.1 BGRA reflection row kernel
+ * Reverses one block of 4 pixels from each end of the row per step.
+ */
+__attribute__((target("sse4.1")))
+static int reflect_row_bgra_sse41(const BYTE *in, BYTE *out, int width) {
+    int j = 0;
+
+    for (; 2 * (j + 4) <= width; j += 4) {
+        __m128i head = _mm_loadu_si128((const __m128i *)(in + 4 * j));
+        __m128i tail = _mm_loadu_si128((const __m128i *)(in + 4 * (width - j - 4)));
+        _mm_storeu_si128((__m128i *)(out + 4 * j), _mm_shuffle_epi32(tail, _MM_SHUFFLE(0, 1, 2, 3)));
+        _mm_storeu_si128((__m128i *)(out + 4 * (width - j - 4)), _mm_shuffle_epi32(head, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+
+    return j;
+}
+
+/*
+ * Splits 8 BGRA pixels into 32-bit channel lanes
+ */
+__attribute__((target("avx2")))
+static inline void split_bgra_avx2(__m256i px, __m256i *blue, __m256i *green, __m256i *red) {
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    *blue = _mm256_and_si256(px, low);
+    *green = _mm256_and_si256(_mm256_srli_epi32(px, 8), low);
+    *red = _mm256_and_si256(_mm256_srli_epi32(px, 16), low);
+}
+
+/*
+ * Broadcasts a result lane to the colour channels of 8 BGRA pixels,
+ * keeping the alpha of px
+ */
+__attribute__((target("avx2")))
+static inline __m256i merge_bgra_avx2(__m256i value, __m256i px) {
+    __m256i alpha = _mm256_andnot_si256(_mm256_set1_epi32(0xFFFFFF), px);
+    return _mm256_or_si256(_mm256_mullo_epi32(value, _mm256_set1_epi32(0x010101)), alpha);
+}
+
+/*
+ * AVX2 BGRA grayscale row kernel
+ */
+__attribute__((target("avx2")))
+static int grayscale_row_bgra_avx2(const BYTE *in, BYTE *out, int width) {
+    int j = 0;
+
+    for (; j + 8 <= width; j += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(in + 4 * j));
+        __m256i blue, green, red;
+        split_bgra_avx2(px, &blue, &green, &red);
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(blue, green), _mm256_add_epi32(red, _mm256_set1_epi32(1)));
+        __m256i gray = _mm256_srli_epi32(_mm256_mullo_epi32(sum, _mm256_set1_epi32(43691)), 17);
+        _mm256_storeu_si256((__m256i *)(out + 4 * j), merge_bgra_avx2(gray, px));
+    }
+
+    return j + grayscale_row_bgra_sse41(in + 4 * j, out + 4 * j, width - j);
+}
+
+/*
+ * AVX2 BGRA reflection row kernel
+ * Lane permutes cross the 128-bit halves for 32-bit pixels; the middle of
+ * the row, shorter than two blocks of 8, is left to the SSE4.1 kernel.
+ */
+__attribute__((target("avx2")))
+static int reflect_row_bgra_avx2(const BYTE *in, BYTE *out, int width) {
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    int j = 0;
+
+    for (; 2 * (j + 8) <= width; j += 8) {
+        __m256i head = _mm256_loadu_si256((const __m256i *)(in + 4 * j));
+        __m256i tail = _mm256_loadu_si256((const __m256i *)(in + 4 * (width - j - 8)));
+        _mm256_storeu_si256((__m256i *)(out + 4 * j), _mm256_permutevar8x32_epi32(tail, reverse));
+        _mm256_storeu_si256((__m256i *)(out + 4 * (width - j - 8)), _mm256_permutevar8x32_epi32(head, reverse));
+    }
+
+    return j + reflect_row_bgra_sse41(in + 4 * j, out + 4 * j, width - 2 * j);
+}
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+
+/*
+ * NEON grayscale row kernel
+ * vld3q/vst3q deinterleave and interleave the BGR channels directly.
+ */
+static int grayscale_row_neon(const BYTE *in, BYTE *out, int width) {
+    const BYTE *src = in;
+    BYTE *dst = out;
+    const uint16x8_t one = vdupq_n_u16(1);
+    int j = 0;
+
+    for (; j + BLOCK_PIXELS <= width; j += BLOCK_PIXELS, src += 48, dst += 48) {
+        uint8x16x3_t px = vld3q_u8(src);
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(px.val[0]), vget_low_u8(px.val[1])),
+                                  vmovl_u8(vget_low_u8(px.val[2])));
+        uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(px.val[0]), vget_high_u8(px.val[1])),
+                                  vmovl_u8(vget_high_u8(px.val[2])));
+        lo = vaddq_u16(lo, one);
+        hi = vaddq_u16(hi, one);
+
+        // ((sum + 1) * 43691) >> 17 in 32-bit products
+        uint16x4_t q0 = vshrn_n_u32(vmull_n_u16(vget_low_u16(lo), 43691), 16);
+        uint16x4_t q1 = vshrn_n_u32(vmull_n_u16(vget_high_u16(lo), 43691), 16);
+        uint16x4_t q2 = vshrn_n_u32(vmull_n_u16(vget_low_u16(hi), 43691), 16);
+        uint16x4_t q3 = vshrn_n_u32(vmull_n_u16(vget_high_u16(hi), 43691), 16);
+        uint8x16_t gray = vcombine_u8(vshrn_n_u16(vcombine_u16(q0, q1), 1),
+                                      vshrn_n_u16(vcombine_u16(q2, q3), 1));
+
+        px.val[0] = px.val[1] = px.val[2] = gray;
+        vst3q_u8(dst, px);
+    }
+
+    return j;
+}
+
+/*
+ * Reverses the 16 lanes of a register
+ */
+static inline uint8x16_t reverse_neon(uint8x16_t value) {
+    uint8x16_t halves = vrev64q_u8(value);
+    return vextq_u8(halves, halves, 8);
+}
+
+/*
+ * NEON reflection row kernel
+ * Same block scheme as the SSE4.1 kernel, on deinterleaved channels.
+ */
+static int reflect_row_neon(const BYTE *in, BYTE *out, int width) {
+    int j = 0;
+
+    for (; 2 * (j + BLOCK_PIXELS) <= width; j += BLOCK_PIXELS) {
+        uint8x16x3_t left = vld3q_u8(in + 3 * j);
+        uint8x16x3_t right = vld3q_u8(in + 3 * (width - j - BLOCK_PIXELS));
+        for (int k = 0; k < 3; k++) {
+            left.val[k] = reverse_neon(left.val[k]);
+            right.val[k] = reverse_neon(right.val[k]);
+        }
+        vst3q_u8(out + 3 * j, right);
+        vst3q_u8(out + 3 * (width - j - BLOCK_PIXELS), left);
+    }
+
+    return j;
+}
+
+#endif /* SIMD_NEON */
+
+/*
+ * Picks the best kernel set supported by the CPU, honouring BMPFILTER_SIMD
+ */
+static void select_kernels(void) {
+    const char *force = getenv(SIMD_ENV);
+
+    if (force != NULL && strcmp(force, "scalar") == 0) {
+        return;
+    }
+
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    int want_avx2 = force == NULL || strcmp(force, "avx2") == 0;
+    if (want_avx2 && __builtin_cpu_supports("avx2")) {
+        selected_grayscale = grayscale_row_avx2;
+        selected_reflect = reflect_row_sse41;
+        selected_grayscale_bgra = grayscale_row_bgra_avx2;
+        selected_reflect_bgra = reflect_row_bgra_avx2;
+        selected_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        selected_grayscale = grayscale_row_sse41;
+        selected_reflect = reflect_row_sse41;
+        selected_grayscale_bgra = grayscale_row_bgra_sse41;
+        selected_reflect_bgra = reflect_row_bgra_sse41;
+        selected_name = "sse4.1";
+    }
+#elif defined(SIMD_NEON)
+    selected_grayscale = grayscale_row_neon;
+    selected_reflect = reflect_row_neon;
+    selected_name = "neon";
+#endif
+}
+
+/*
+ * Returns the grayscale row kernel for this CPU and pixel format, or NULL
+ * to use scalar code
+ */
+ROW_KERNEL simd_grayscale_row(int channels) {
+    pthread_once(&selected_once, select_kernels);
+    return channels == PIXEL_BGRA ? selected_grayscale_bgra : selected_grayscale;
+}
+
+/*
+ * Returns the reflection row kernel for this CPU and pixel format, or NULL
+ * to use scalar code
+ */
+ROW_KERNEL simd_reflect_row(int channels) {
+    pthread_once(&selected_once, select_kernels);
+    return channels == PIXEL_BGRA ? selected_reflect_bgra : selected_reflect;
+}
+
+/*
+ * Returns the name of the selected kernel set ("scalar" when none)
+ */
+const char *simd_name(void) {
+    pthread_once(&selected_once, select_kernels);
+    return selected_name;
+}
@@ -0,0 +1,81 @@
+/*
+ * stats.c
+ * Implementation of the --stats counters.
+ *
+ * All counters are process-wide atomics, so the batch workers can update
+ * them concurrently. When statistics are off, every probe reduces to a test
+ * of stats_enabled in the inline wrappers of stats.h. The counters are part
+ * of the library, whose I/O and allocations they count; starting them and
+ * reporting them is left to the command line tool (statsreport.c).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+int stats_enabled = 0;
+
+static atomic_llong phase_wall[STATS_PHASES];
+static atomic_llong phase_cpu[STATS_PHASES];
+static atomic_llong counter_calls[STATS_COUNTERS];
+static atomic_llong counter_bytes[STATS_COUNTERS];
+static atomic_llong largest_alloc;
+
+/*
+ * Reads a clock in nanoseconds
+ */
+static long long clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Returns the current wall and CPU clocks
+ */
+STATS_TIMER stats_now(void) {
+    STATS_TIMER now = { clock_ns(CLOCK_MONOTONIC), clock_ns(CLOCK_PROCESS_CPUTIME_ID) };
+    return now;
+}
+
+/*
+ * Adds the wall and CPU time elapsed since start to a phase
+ */
+void stats_add_phase(STATS_PHASE phase, const STATS_TIMER *start) {
+    STATS_TIMER now = stats_now();
+    atomic_fetch_add(&phase_wall[phase], now.wall_ns - start->wall_ns);
+    atomic_fetch_add(&phase_cpu[phase], now.cpu_ns - start->cpu_ns);
+}
+
+/*
+ * Counts one call of an operation moving `bytes` bytes
+ */
+void stats_add_count(STATS_COUNTER counter, size_t bytes) {
+    atomic_fetch_add(&counter_calls[counter], 1);
+    atomic_fetch_add(&counter_bytes[counter], (long long)bytes);
+
+    if (counter == STATS_ALLOCS) {
+        long long largest = atomic_load(&largest_alloc);
+        while ((long long)bytes > largest &&
+               !atomic_compare_exchange_weak(&largest_alloc, &largest, (long long)bytes))
+            ;
+    }
+}
+
+/*
+ * Reads the totals collected so far
+ */
+void stats_totals(STATS_TOTALS *totals) {
+    for (int p = 0; p < STATS_PHASES; p++) {
+        totals->phase_wall[p] = atomic_load(&phase_wall[p]);
+        totals->phase_cpu[p] = atomic_load(&phase_cpu[p]);
+    }
+    for (int c = 0; c < STATS_COUNTERS; c++) {
+        totals->counter_calls[c] = atomic_load(&counter_calls[c]);
+        totals->counter_bytes[c] = atomic_load(&counter_bytes[c]);
+    }
+    totals->largest_alloc = atomic_load(&largest_alloc);
+}
@@ -0,0 +1,113 @@
+/*
+ * statsreport.c
+ * Reports of the --stats instrumentation.
+ *
+ * The command line tool starts the counters of stats.c before it opens any
+ * file and prints their totals when it is done, as a table or as JSON.
+ * Neither is part of the library, which only counts.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <sys/resource.h>
+
+/* Display names of the phases and counters, in enum order */
+static const char *const phase_names[STATS_PHASES] = {
+    "setup", "headers", "read", "filter", "write"
+};
+static const char *const counter_names[STATS_COUNTERS] = {
+    "reads", "seeks", "writes", "maps", "allocs", "cache_hit", "cache_miss"
+};
+
+static STATS_FORMAT stats_format = STATS_OFF;
+static STATS_TIMER stats_origin;
+
+/*
+ * Starts collecting statistics
+ *
+ * Parameters:
+ *   format - Report format (STATS_OFF leaves statistics disabled)
+ */
+void stats_start(STATS_FORMAT format) {
+    stats_format = format;
+    stats_enabled = format != STATS_OFF;
+    stats_origin = stats_now();
+}
+
+/*
+ * Writes the collected statistics
+ *
+ * Parameters:
+ *   out  - Report stream
+ *   pool - Pool whose thread utilisation is reported (NULL if serial)
+ *
+ * Description:
+ *   Times are in milliseconds. Phase CPU times cover all threads of the
+ *   process; in batch mode, phases of different files overlap, so phase
+ *   times are summed over the workers and may exceed the total. A thread's
+ *   utilisation is its busy time over the time spent in pool jobs.
+ */
+void stats_report(FILE *out, const THREAD_POOL *pool) {
+    if (!stats_enabled) {
+        return;
+    }
+
+    STATS_TOTALS totals;
+    stats_totals(&totals);
+    STATS_TIMER now = stats_now();
+    double total_wall = (now.wall_ns - stats_origin.wall_ns) / 1e6;
+    double total_cpu = (now.cpu_ns - stats_origin.cpu_ns) / 1e6;
+    double run_ms = thread_pool_run_ns(pool) / 1e6;
+    int threads = thread_pool_size(pool);
+    int json = stats_format == STATS_JSON;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (json) {
+        fprintf(out, "{\"phases\": {");
+        for (int p = 0; p < STATS_PHASES; p++)
+            fprintf(out, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", p ? ", " : "",
+                    phase_names[p], totals.phase_wall[p] / 1e6, totals.phase_cpu[p] / 1e6);
+        fprintf(out, "}, \"total\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}, \"counters\": {",
+                total_wall, total_cpu);
+        for (int c = 0; c < STATS_COUNTERS; c++)
+            fprintf(out, "%s\"%s\": {\"calls\": %lld, \"bytes\": %lld}", c ? ", " : "",
+                    counter_names[c], totals.counter_calls[c], totals.counter_bytes[c]);
+        fprintf(out, "}, \"largest_alloc_bytes\": %lld, \"peak_rss_kb\": %ld, "
+                "\"minor_faults\": %ld, \"major_faults\": %ld, \"threads\": [",
+                totals.largest_alloc, usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt);
+        for (int k = 0; k < threads && pool != NULL; k++) {
+            double busy = thread_pool_busy_ns(pool, k) / 1e6;
+            fprintf(out, "%s{\"busy_ms\": %.3f, \"utilisation\": %.3f}", k ? ", " : "",
+                    busy, run_ms > 0 ? busy / run_ms : 0.0);
+        }
+        fprintf(out, "], \"pool_ms\": %.3f}\n", run_ms);
+        return;
+    }
+
+    fprintf(out, "%-10s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for (int p = 0; p < STATS_PHASES; p++)
+        fprintf(out, "%-10s %12.3f %12.3f\n", phase_names[p], totals.phase_wall[p] / 1e6, totals.phase_cpu[p] / 1e6);
+    fprintf(out, "%-10s %12.3f %12.3f\n", "total", total_wall, total_cpu);
+
+    fprintf(out, "\n%-10s %12s %14s\n", "counter", "calls", "bytes");
+    for (int c = 0; c < STATS_COUNTERS; c++)
+        fprintf(out, "%-10s %12lld %14lld\n", counter_names[c],
+                totals.counter_calls[c], totals.counter_bytes[c]);
+    fprintf(out, "\nlargest allocation %lld bytes, peak RSS %ld KB, page faults %ld minor / %ld major\n",
+            totals.largest_alloc, usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt);
+
+    if (pool == NULL) {
+        fprintf(out, "threads: 1 (serial)\n");
+        return;
+    }
+    fprintf(out, "threads: %d, %.3f ms in pool jobs\n", threads, run_ms);
+    for (int k = 0; k < threads; k++) {
+        double busy = thread_pool_busy_ns(pool, k) / 1e6;
+        fprintf(out, "  thread %-3d busy %12.3f ms  %5.1f%%\n", k, busy,
+                run_ms > 0 ? 100.0 * busy / run_ms : 0.0);
+    }
+}
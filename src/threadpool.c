@@ -0,0 +1,350 @@
+/*
+ * threadpool.c
+ * Implementation of the worker pool used to split filters into row bands.
+ *
+ * The pool owns (threads - 1) workers; the calling thread always processes
+ * band 0 itself, so a pool of size 1 runs everything inline.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Thread pool state
+ * A job is published by bumping `generation`; each worker processes the
+ * band matching its index and reports back through `pending`.
+ */
+struct THREAD_POOL {
+    pthread_t       *workers;     /* Worker thread handles */
+    int              threads;     /* Total threads including the caller */
+    pthread_mutex_t  lock;        /* Protects every field below */
+    pthread_cond_t   start;       /* Signalled when a new job is published */
+    pthread_cond_t   done;        /* Signalled when the last band finishes */
+    unsigned long    generation;  /* Incremented for every published job */
+    int              pending;     /* Worker bands still running */
+    int              shutdown;    /* Set when the pool is being destroyed */
+    BAND_FN          fn;          /* Current job callback */
+    void            *arg;         /* Current job data */
+    int              rows;        /* Current job row count */
+    int              bands;       /* Number of bands the job is split into */
+    int              timing;      /* Measure busy times (set before any job) */
+    long long       *busy_ns;     /* Time each thread spent in callbacks */
+    long long        run_ns;      /* Wall time spent in thread_pool_run() */
+};
+
+/* Per-worker startup data */
+typedef struct {
+    THREAD_POOL *pool;
+    int          index;           /* Band index served by this worker */
+} WORKER;
+
+/*
+ * Returns the monotonic clock in nanoseconds
+ */
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Runs one band, adding its duration to the thread's busy time when timing
+ */
+static void run_band(THREAD_POOL *pool, int index, BAND_FN fn, void *arg, int begin, int end) {
+    if (!pool->timing) {
+        fn(arg, begin, end);
+        return;
+    }
+
+    long long start = monotonic_ns();
+    fn(arg, begin, end);
+    pool->busy_ns[index] += monotonic_ns() - start;
+}
+
+/*
+ * Worker thread main loop
+ *
+ * Waits for a new job generation, processes its own band when the job has
+ * one for it, and signals completion.
+ */
+static void *worker_main(void *data) {
+    WORKER *worker = data;
+    THREAD_POOL *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->shutdown)
+            break;
+        seen = pool->generation;
+
+        if (worker->index < pool->bands) {
+            BAND_FN fn = pool->fn;
+            void *arg = pool->arg;
+            int begin, end;
+            thread_pool_band_range(pool->rows, pool->bands, worker->index, &begin, &end);
+
+            pthread_mutex_unlock(&pool->lock);
+            run_band(pool, worker->index, fn, arg, begin, end);
+            pthread_mutex_lock(&pool->lock);
+
+            if (--pool->pending == 0)
+                pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(worker);
+    return NULL;
+}
+
+/*
+ * Creates a thread pool
+ *
+ * Parameters:
+ *   threads - Total number of threads, including the calling thread
+ *
+ * Returns:
+ *   Pool handle, or NULL if threads is out of range or a resource could
+ *   not be allocated
+ */
+THREAD_POOL *thread_pool_create(int threads) {
+    if (threads < 1 || threads > MAX_THREADS) {
+        return NULL;
+    }
+
+    THREAD_POOL *pool = calloc(1, sizeof(THREAD_POOL));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = threads;
+    pool->workers = calloc(threads, sizeof(pthread_t));
+    pool->busy_ns = calloc(threads, sizeof(long long));
+    if (pool->workers == NULL || pool->busy_ns == NULL) {
+        free(pool->busy_ns);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // Worker k serves band k; band 0 belongs to the caller
+    for (int k = 1; k < threads; k++) {
+        WORKER *worker = malloc(sizeof(WORKER));
+        if (worker == NULL) {
+            pool->threads = k;
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+        worker->pool = pool;
+        worker->index = k;
+        if (pthread_create(&pool->workers[k], NULL, worker_main, worker) != 0) {
+            free(worker);
+            pool->threads = k;
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+/*
+ * Stops all workers and releases the pool
+ *
+ * Parameters:
+ *   pool - Pool handle (NULL is ignored)
+ */
+void thread_pool_destroy(THREAD_POOL *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int k = 1; k < pool->threads; k++)
+        pthread_join(pool->workers[k], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->busy_ns);
+    free(pool->workers);
+    free(pool);
+}
+
+/*
+ * Returns the total number of threads of a pool (1 for a NULL pool)
+ */
+int thread_pool_size(const THREAD_POOL *pool) {
+    return pool == NULL ? 1 : pool->threads;
+}
+
+/*
+ * Returns the number of bands thread_pool_run() splits a job of `rows` rows into
+ */
+int thread_pool_bands(const THREAD_POOL *pool, int rows) {
+    int bands = thread_pool_size(pool);
+    return bands > rows ? rows : bands;
+}
+
+/*
+ * Computes the row range of one band
+ *
+ * Parameters:
+ *   rows  - Number of rows covered by the job
+ *   bands - Number of bands, as returned by thread_pool_bands()
+ *   index - Band index
+ *   begin - Receives the first row of the band
+ *   end   - Receives one past the last row of the band
+ *
+ * Description:
+ *   Rows are distributed as evenly as possible; the first (rows % bands)
+ *   bands get one extra row.
+ */
+void thread_pool_band_range(int rows, int bands, int index, int *begin, int *end) {
+    int base = rows / bands;
+    int extra = rows % bands;
+
+    *begin = index * base + (index < extra ? index : extra);
+    *end = *begin + base + (index < extra ? 1 : 0);
+}
+
+/*
+ * Returns the index of the band holding a row
+ *
+ * Parameters:
+ *   rows  - Number of rows covered by the job
+ *   bands - Number of bands, as returned by thread_pool_bands()
+ *   row   - Row in [0, rows)
+ *
+ * Returns:
+ *   The band whose thread_pool_band_range() contains row
+ */
+int thread_pool_band_index(int rows, int bands, int row) {
+    int base = rows / bands;
+    int extra = rows % bands;
+    int split = extra * (base + 1);
+
+    return row < split ? row / (base + 1) : extra + (row - split) / base;
+}
+
+/*
+ * Runs a job split into horizontal row bands and waits for completion
+ *
+ * Parameters:
+ *   pool - Pool handle, or NULL to run the whole job on the calling thread
+ *   rows - Number of rows covered by the job
+ *   fn   - Callback invoked once per band with its row range
+ *   arg  - Job data passed to every callback
+ *
+ * Description:
+ *   Splits [0, rows) into at most one band per thread. The caller processes
+ *   band 0 and returns once every band has finished, so consecutive calls
+ *   act as barriers between filter passes.
+ */
+void thread_pool_run(THREAD_POOL *pool, int rows, BAND_FN fn, void *arg) {
+    int bands = thread_pool_bands(pool, rows);
+
+    if (pool == NULL || rows <= 0) {
+        if (rows > 0)
+            fn(arg, 0, rows);
+        return;
+    }
+
+    long long start = pool->timing ? monotonic_ns() : 0;
+
+    if (bands == 1) {
+        run_band(pool, 0, fn, arg, 0, rows);
+        if (pool->timing)
+            pool->run_ns += monotonic_ns() - start;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->rows = rows;
+    pool->bands = bands;
+    pool->pending = bands - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    int begin, end;
+    thread_pool_band_range(rows, bands, 0, &begin, &end);
+    run_band(pool, 0, fn, arg, begin, end);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->timing)
+        pool->run_ns += monotonic_ns() - start;
+}
+
+/*
+ * Enables or disables busy-time measurement
+ *
+ * Parameters:
+ *   pool    - Pool handle (NULL is ignored)
+ *   enabled - Non-zero to time every band
+ *
+ * Description:
+ *   Must be called while no job is running
+ */
+void thread_pool_set_timing(THREAD_POOL *pool, int enabled) {
+    if (pool != NULL)
+        pool->timing = enabled;
+}
+
+/*
+ * Returns the time a thread of the pool spent running bands, in nanoseconds
+ */
+long long thread_pool_busy_ns(const THREAD_POOL *pool, int index) {
+    return pool == NULL ? 0 : pool->busy_ns[index];
+}
+
+/*
+ * Returns the wall time spent in thread_pool_run() calls, in nanoseconds
+ */
+long long thread_pool_run_ns(const THREAD_POOL *pool) {
+    return pool == NULL ? 0 : pool->run_ns;
+}
+
+/*
+ * Determines the default thread count
+ *
+ * Returns:
+ *   The value of BMPFILTER_THREADS when it is a valid count, otherwise the
+ *   number of online processors (clamped to MAX_THREADS)
+ */
+int thread_count_default(void) {
+    const char *env = getenv(THREADS_ENV);
+    if (env != NULL) {
+        char *end;
+        long value = strtol(env, &end, 10);
+        if (end != env && *end == '\0' && value >= 1 && value <= MAX_THREADS)
+            return (int)value;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1)
+        return 1;
+    return online > MAX_THREADS ? MAX_THREADS : (int)online;
+}
@@ -0,0 +1,113 @@
+/*
+ * tile.c
+ * Implementation of the tile scheduler.
+ *
+ * The rows of a pass are split into the same row bands as
+ * thread_pool_run(), and each band into column strips narrow enough for
+ * the per-column state of the kernel, plus the source rows it revisits, to
+ * stay in cache. The tiles are numbered band by band and handed to the
+ * thread pool as its work items, so every thread walks the strips of its
+ * own band from left to right. Images narrower than one strip get a single
+ * full-width tile per band, which is exactly the previous row-band split.
+ * A tile's working set is kept to half the L2 cache, leaving the rest to
+ * the source and destination rows streaming through it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tile.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Cache budget of one tile, measured once */
+static size_t tile_budget = 0;
+static pthread_once_t tile_budget_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Data shared by all bands of a tiled pass
+ */
+typedef struct {
+    TILE_FN  fn;             /* Tile kernel */
+    void    *arg;            /* Kernel data */
+    int      width;          /* Image width in pixels */
+    int      first_row;      /* First row of the pass */
+    int      rows;           /* Number of rows of the pass */
+    int      bands;          /* Number of row bands */
+    int      strips;         /* Number of column strips per band */
+    int      workers;        /* Number of pool bands the tiles are split into */
+} TILE_JOB;
+
+/*
+ * Sets the tile budget from the L2 cache size
+ */
+static void measure_budget(void) {
+    long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    tile_budget = (l2 > 0 ? (size_t)l2 : TILE_CACHE_BYTES) / 2;
+}
+
+/*
+ * Runs tiles [begin, end) of a pass
+ */
+static void tile_band(void *arg, int begin, int end) {
+    TILE_JOB *job = arg;
+    const int worker = thread_pool_band_index(job->bands * job->strips, job->workers, begin);
+
+    for (int t = begin; t < end; t++) {
+        TILE tile;
+        int first, last, left, right;
+        tile.worker = worker;
+        tile.band = t / job->strips;
+        thread_pool_band_range(job->rows, job->bands, tile.band, &first, &last);
+        thread_pool_band_range(job->width, job->strips, t % job->strips, &left, &right);
+        tile.x = left;
+        tile.y = job->first_row + first;
+        tile.width = right - left;
+        tile.height = last - first;
+        job->fn(job->arg, &tile);
+    }
+}
+
+/*
+ * Runs a kernel over the rows [first_row, first_row + rows) of an image, tile by tile
+ *
+ * Parameters:
+ *   pool         - Pool to split the tiles across, or NULL to run serially
+ *   width        - Image width in pixels
+ *   first_row    - First row to produce
+ *   rows         - Number of rows to produce
+ *   halo         - Columns the kernel reads on each side of a tile
+ *   column_bytes - Cache the kernel needs per column, or 0 to keep whole rows
+ *   fn           - Tile kernel
+ *   arg          - Kernel data
+ *
+ * Description:
+ *   Row band b of the tiles covers rows thread_pool_band_range(rows, bands, b)
+ *   with bands = thread_pool_bands(pool, rows), so kernels can prepare data
+ *   per band ahead of the pass. Strips are at least TILE_MIN_WIDTH and four
+ *   halos wide. Tiles that run concurrently have different TILE.worker
+ *   indices, so a kernel can use per-worker memory without locking.
+ */
+void tile_run(THREAD_POOL *pool, int width, int first_row, int rows, int halo,
+              size_t column_bytes, TILE_FN fn, void *arg) {
+    TILE_JOB job = { fn, arg, width, first_row, rows, thread_pool_bands(pool, rows), 1, 1 };
+
+    if (column_bytes > 0) {
+        pthread_once(&tile_budget_once, measure_budget);
+        int strip = tile_budget / column_bytes;
+        if (strip < TILE_MIN_WIDTH)
+            strip = TILE_MIN_WIDTH;
+        if (strip < 4 * halo)
+            strip = 4 * halo;
+        job.strips = (width + strip - 1) / strip;
+        if (job.strips < 1)
+            job.strips = 1;
+    }
+
+    job.workers = thread_pool_bands(pool, job.bands * job.strips);
+    if (rows > 0 && width > 0)
+        thread_pool_run(pool, job.bands * job.strips, tile_band, &job);
+}
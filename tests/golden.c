@@ -0,0 +1,462 @@
+/*
+ * File: golden.c
+ * Description: Golden-output regression suite for the command line driver
+ *
+ * Writes synthetic BMP files of the shapes that reach the edge cases of the
+ * fast paths (1, 2 and 3 pixel wide images, odd widths giving every row
+ * padding, single rows, 32-bit BGRA and top-down files, and images large
+ * enough to split into bands and tiles, plus with --large rows of data
+ * beyond IO_BLOCK_BYTES), filters each of them with every
+ * filter and a few chains through the serial scalar reference (-j 1,
+ * BMPFILTER_SIMD=scalar), then through every other execution path, and
+ * checks that each output file is byte-for-byte identical to the reference.
+ * Each input is also stored with the opposite row order, and filtering it
+ * must give the same picture. The --cache paths run twice, first storing
+ * the output (a miss) and then copying it back (a hit). Built and run by
+ * `make test`.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bmpio.h"
+#include "simd.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Suite settings */
+#define GOLDEN_SEED      2024u  /* Seed of the input image contents */
+#define GOLDEN_THREADS   "4"    /* Thread count of the threaded paths */
+#define MAX_CHAIN_ARGS   8      /* Most arguments of one chain */
+#define MAX_PATH_ARGS    4      /* Most arguments of one execution path */
+#define MAX_ARGS         (MAX_CHAIN_ARGS + MAX_PATH_ARGS + 8)
+
+/*
+ * Input images; the large ones, whose rows take several IO_BLOCK_BYTES
+ * blocks or a block of their own and split into many bands and tiles, only
+ * run with --large
+ */
+static const struct {
+    int width;
+    int height;
+    int channels;
+    int top_down;
+    int large;
+} golden_inputs[] = {
+    { 1, 1, PIXEL_BGR, 0, 0 },
+    { 1, 7, PIXEL_BGR, 0, 0 },
+    { 2, 5, PIXEL_BGR, 0, 0 },
+    { 3, 9, PIXEL_BGR, 0, 0 },
+    { 4, 4, PIXEL_BGR, 0, 0 },
+    { 5, 1, PIXEL_BGR, 0, 0 },
+    { 7, 6, PIXEL_BGR, 0, 0 },
+    { 9, 3, PIXEL_BGR, 0, 0 },
+    { 11, 11, PIXEL_BGR, 0, 0 },
+    { 257, 1, PIXEL_BGR, 0, 0 },
+    { 33, 17, PIXEL_BGR, 1, 0 },
+    { 301, 203, PIXEL_BGR, 0, 0 },
+    { 1031, 67, PIXEL_BGR, 0, 0 },
+    { 1, 5, PIXEL_BGRA, 0, 0 },
+    { 3, 3, PIXEL_BGRA, 0, 0 },
+    { 2, 1, PIXEL_BGRA, 1, 0 },
+    { 37, 23, PIXEL_BGRA, 0, 0 },
+    { 37, 23, PIXEL_BGRA, 1, 0 },
+    { 173, 149, PIXEL_BGRA, 1, 0 },
+    { 1, 300007, PIXEL_BGR, 0, 1 },
+    { 700001, 3, PIXEL_BGR, 1, 1 },
+    { 1543, 1021, PIXEL_BGRA, 0, 1 },
+};
+
+/*
+ * Filters and chains; those with more than one blur, convolve or edges
+ * stage cannot run with --stream
+ */
+static const struct {
+    const char *args[MAX_CHAIN_ARGS];
+    int         streamable;
+} golden_chains[] = {
+    { { "-g" }, 1 },
+    { { "-r" }, 1 },
+    { { "-i" }, 1 },
+    { { "-t", "--threshold", "100" }, 1 },
+    { { "-l", "--gamma", "1.7", "--contrast", "130", "--brightness", "-20" }, 1 },
+    { { "-b" }, 1 },
+    { { "-b", "--radius", "3" }, 1 },
+    { { "-b", "--radius", "9" }, 1 },
+    { { "-e" }, 1 },
+    { { "-c", "--kernel", "1,2,1;2,4,2;1,2,1" }, 1 },
+    { { "-c", "--kernel", "0,-1,0;-1,5,-1;0,-1,0", "--border", "zero" }, 1 },
+    { { "-c", "--kernel", "1,2,1;0,0,0;0,0,0", "--border", "skip" }, 1 },
+    { { "-c", "--kernel", "1,1,1,1,1", "--border", "clamp" }, 1 },
+    { { "-r,-b,-g" }, 1 },
+    { { "--pipeline", "reflect,blur,gray", "--radius", "5" }, 1 },
+    { { "-g,-e" }, 1 },
+    { { "-l,-t,-i" }, 1 },
+    { { "-e,-r" }, 1 },
+    { { "-b,-e" }, 0 },
+    { { "-c,-b", "--kernel", "1;2;1", "--radius", "4" }, 0 },
+};
+
+/*
+ * Execution paths compared with the reference
+ */
+typedef struct {
+    const char *name;
+    const char *simd;                /* BMPFILTER_SIMD, or NULL for the CPU's best; a set the CPU lacks is skipped */
+    const char *threads;             /* Value of -j */
+    const char *args[MAX_PATH_ARGS]; /* Extra arguments */
+    int         stream;              /* Needs a streamable chain */
+    int         pipe;                /* Reads stdin and writes stdout */
+    int         cache;               /* GOLDEN_CACHE_MISS or GOLDEN_CACHE_HIT with --cache, else 0 */
+} GOLDEN_PATH;
+
+/* Cache runs: the first must store a new entry, the second reads it back */
+#define GOLDEN_CACHE_MISS 1
+#define GOLDEN_CACHE_HIT  2
+
+static const GOLDEN_PATH reference_path = { "reference", "scalar", "1", { NULL }, 0, 0, 0 };
+
+static const GOLDEN_PATH golden_paths[] = {
+    { "simd", NULL, "1", { NULL }, 0, 0, 0 },
+    { "sse4.1", "sse4.1", "1", { NULL }, 0, 0, 0 },
+    { "avx2", "avx2", "1", { NULL }, 0, 0, 0 },
+    { "threads", NULL, GOLDEN_THREADS, { NULL }, 0, 0, 0 },
+    { "threads-scalar", "scalar", GOLDEN_THREADS, { NULL }, 0, 0, 0 },
+    { "stream", NULL, "1", { "--stream" }, 1, 0, 0 },
+    { "stream-threads", NULL, GOLDEN_THREADS, { "--stream" }, 1, 0, 0 },
+    { "overlap", NULL, GOLDEN_THREADS, { "--stream", "--overlap" }, 1, 0, 0 },
+    { "mmap", NULL, GOLDEN_THREADS, { "--mmap" }, 0, 0, 0 },
+    { "pipe", NULL, GOLDEN_THREADS, { NULL }, 0, 1, 0 },
+    { "cache-miss", NULL, GOLDEN_THREADS, { NULL }, 0, 0, GOLDEN_CACHE_MISS },
+    { "cache-hit", NULL, GOLDEN_THREADS, { NULL }, 0, 0, GOLDEN_CACHE_HIT },
+};
+
+/* Directory of the --cache paths, within the work directory */
+static char cache_dir[PATH_MAX];
+
+/*
+ * Returns non-zero if the CPU runs the kernel set a path forces
+ * The driver would fall back to another set, which other paths cover.
+ */
+static int path_supported(const GOLDEN_PATH *path) {
+    if (path->simd == NULL || strcmp(path->simd, "scalar") == 0) {
+        return 1;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(path->simd, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(path->simd, "sse4.1") == 0) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Writes the rows of an image as a BMP file, in the order of the view or
+ * reversed
+ *
+ * Returns:
+ *   Error code (SUCCESS if written, various ERR codes on failure)
+ */
+static int write_bmp(const char *path, const IMAGE *image, int top_down, int reversed) {
+    BITMAPFILEHEADER bf = { .bfType = BITMAP_TYPE, .bfOffBits = BITMAP_HEADER_SIZE };
+    BITMAPINFOHEADER bi = { .biSize = sizeof(BITMAPINFOHEADER), .biHeight = top_down ? -1 : 1, .biPlanes = 1,
+                            .biBitCount = image->channels * 8, .biCompression = BITMAP_COMPRESSION };
+    bmp_set_size(&bf, &bi, image->width, image->height);
+
+    FILE *outptr = fopen(path, "wb");
+    if (outptr == NULL) {
+        return ERR_OUTPUT_FILE;
+    }
+
+    int result = bmp_write_headers(outptr, &bf, &bi);
+    for (int i = 0; i < image->height && result == SUCCESS; i++) {
+        IMAGE row = *image;
+        row.data = image_row(image, reversed ? image->height - 1 - i : i);
+        row.height = row.rows = 1;
+        result = bmp_write_rows(outptr, &row, 0, 1, 0);
+    }
+    if (fclose(outptr) != 0 && result == SUCCESS)
+        result = ERR_WRITE_DATA;
+    return result;
+}
+
+/*
+ * Writes a BMP file of deterministic noise over a diagonal gradient, with
+ * an alpha channel that varies too for 32-bit images, and the same picture
+ * with the opposite row order
+ *
+ * Returns:
+ *   Error code (SUCCESS if written, various ERR codes on failure)
+ */
+static int write_input(const char *path, const char *flipped, int width, int height, int channels, int top_down) {
+    IMAGE image = image_view(NULL, (size_t)width * channels, channels, width, height);
+    image.data = malloc(image.stride * height);
+    if (image.data == NULL) {
+        return ERR_MEMORY;
+    }
+
+    uint32_t state = GOLDEN_SEED;
+    for (int i = 0; i < height; i++) {
+        BYTE *row = image_row(&image, i);
+        for (int j = 0; j < width; j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            int base = (i * 7 + j * 3) & 0xff;
+            BYTE *pixel = row + (size_t)j * channels;
+            pixel[CHANNEL_BLUE] = base ^ (state & 0x3f);
+            pixel[CHANNEL_GREEN] = (base + (state >> 8)) & 0xff;
+            pixel[CHANNEL_RED] = state & 0x80 ? ~base : base;
+            if (channels == PIXEL_BGRA)
+                pixel[CHANNEL_ALPHA] = state >> 24;
+        }
+    }
+
+    int result = write_bmp(path, &image, top_down, 0);
+    if (result == SUCCESS)
+        result = write_bmp(flipped, &image, !top_down, 1);
+    free(image.data);
+    return result;
+}
+
+/*
+ * Runs the driver on one chain through one execution path
+ *
+ * Returns:
+ *   Non-zero if the driver ran and exited with SUCCESS
+ */
+static int run_path(const char *program, const GOLDEN_PATH *path, int chain, const char *input,
+                    const char *output) {
+    const char *argv[MAX_ARGS];
+    int argc = 0;
+
+    argv[argc++] = program;
+    for (int k = 0; k < MAX_CHAIN_ARGS && golden_chains[chain].args[k] != NULL; k++)
+        argv[argc++] = golden_chains[chain].args[k];
+    for (int k = 0; k < MAX_PATH_ARGS && path->args[k] != NULL; k++)
+        argv[argc++] = path->args[k];
+    if (path->cache) {
+        argv[argc++] = "--cache";
+        argv[argc++] = cache_dir;
+    }
+    argv[argc++] = "-j";
+    argv[argc++] = path->threads;
+    argv[argc++] = path->pipe ? "-" : input;
+    argv[argc++] = path->pipe ? "-" : output;
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (path->simd != NULL)
+            setenv(SIMD_ENV, path->simd, 1);
+        else
+            unsetenv(SIMD_ENV);
+
+        // Messages are dropped; with -, the image files take over stdin and stdout
+        int in = path->pipe ? open(input, O_RDONLY) : open("/dev/null", O_RDONLY);
+        int out = path->pipe ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open("/dev/null", O_WRONLY);
+        int quiet = open("/dev/null", O_WRONLY);
+        if (in == -1 || out == -1 || quiet == -1 || dup2(in, STDIN_FILENO) == -1 ||
+            dup2(out, STDOUT_FILENO) == -1 || dup2(quiet, STDERR_FILENO) == -1) {
+            _exit(ERR_ARGS);
+        }
+        execv(program, (char *const *)argv);
+        _exit(ERR_ARGS);
+    }
+
+    int status;
+    return pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == SUCCESS;
+}
+
+/*
+ * Counts the files of the cache directory, removing them if `clear` is set
+ */
+static int cache_entries(int clear) {
+    DIR *dir = opendir(cache_dir);
+    char path[PATH_MAX];
+    struct dirent *item;
+    int count = 0;
+
+    while (dir != NULL && (item = readdir(dir)) != NULL) {
+        if (item->d_name[0] == '.')
+            continue;
+        count++;
+        if (clear && snprintf(path, sizeof(path), "%s/%s", cache_dir, item->d_name) < (int)sizeof(path))
+            remove(path);
+    }
+
+    if (dir != NULL)
+        closedir(dir);
+    return count;
+}
+
+/*
+ * Returns non-zero if two files have the same contents
+ */
+static int same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+
+    while (same) {
+        char bufa[BUFSIZ], bufb[BUFSIZ];
+        size_t na = fread(bufa, 1, sizeof(bufa), fa);
+        size_t nb = fread(bufb, 1, sizeof(bufb), fb);
+        same = na == nb && memcmp(bufa, bufb, na) == 0;
+        if (na == 0)
+            break;
+    }
+
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+/*
+ * Loads the pixels of a BMP file into a freshly allocated image
+ *
+ * Returns:
+ *   Error code (SUCCESS if loaded, various ERR codes on failure)
+ */
+static int load_bmp(const char *path, IMAGE *image, int *top_down) {
+    FILE *inptr = fopen(path, "rb");
+    if (inptr == NULL) {
+        return ERR_ARGS;
+    }
+
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    int result = bmp_read_headers(inptr, &bf, &bi);
+    if (result == SUCCESS) {
+        int width = bi.biWidth;
+        int height = bmp_height(&bi);
+        int channels = bmp_channels(&bi);
+        *image = image_view(NULL, (size_t)width * channels, channels, width, height);
+        *top_down = bi.biHeight < 0;
+        image->data = malloc(image->stride * height);
+        result = image->data == NULL ? ERR_MEMORY : bmp_read_rows(inptr, image, 0, height);
+    }
+
+    fclose(inptr);
+    return result;
+}
+
+/*
+ * Returns non-zero if two BMP files of opposite row orders hold the same
+ * picture
+ */
+static int same_picture(const char *a, const char *b) {
+    IMAGE ia = { 0 }, ib = { 0 };
+    int ta, tb;
+    int same = load_bmp(a, &ia, &ta) == SUCCESS && load_bmp(b, &ib, &tb) == SUCCESS && ta != tb &&
+               ia.width == ib.width && ia.height == ib.height && ia.channels == ib.channels;
+
+    for (int i = 0; same && i < ia.height; i++)
+        same = memcmp(image_row(&ia, i), image_row(&ib, ib.height - 1 - i), ia.stride) == 0;
+
+    free(ia.data);
+    free(ib.data);
+    return same;
+}
+
+/*
+ * Prints a chain and the input it failed on
+ */
+static void report_failure(const char *what, int chain, int input) {
+    printf("FAIL %s:", what);
+    for (int k = 0; k < MAX_CHAIN_ARGS && golden_chains[chain].args[k] != NULL; k++)
+        printf(" %s", golden_chains[chain].args[k]);
+    printf(" on %dx%d %d-bit %s\n", golden_inputs[input].width, golden_inputs[input].height,
+           golden_inputs[input].channels * 8, golden_inputs[input].top_down ? "top-down" : "bottom-up");
+}
+
+/*
+ * Golden suite entry point
+ *
+ * Usage: golden [--large] <bmpfilter binary> <work directory>
+ *
+ * Returns:
+ *   SUCCESS if every path matched the reference, ERR_ARGS otherwise
+ */
+int main(int argc, char *argv[]) {
+    const int large = argc == 4 && strcmp(argv[1], "--large") == 0;
+    if (argc != 3 + large) {
+        printf("Usage: %s [--large] <bmpfilter binary> <work directory>\n", argv[0]);
+        return ERR_ARGS;
+    }
+
+    const char *program = argv[1 + large];
+    const char *work = argv[2 + large];
+    char input[PATH_MAX], flipped[PATH_MAX], reference[PATH_MAX], output[PATH_MAX];
+    snprintf(input, sizeof(input), "%s/input.bmp", work);
+    snprintf(flipped, sizeof(flipped), "%s/flipped.bmp", work);
+    snprintf(reference, sizeof(reference), "%s/reference.bmp", work);
+    snprintf(output, sizeof(output), "%s/output.bmp", work);
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", work);
+    cache_entries(1);
+
+    for (size_t p = 0; p < sizeof(golden_paths) / sizeof(golden_paths[0]); p++) {
+        if (!path_supported(&golden_paths[p]))
+            printf("skipping %s: not supported by this CPU\n", golden_paths[p].name);
+    }
+
+    int cases = 0, failures = 0;
+    for (size_t i = 0; i < sizeof(golden_inputs) / sizeof(golden_inputs[0]); i++) {
+        if (golden_inputs[i].large && !large)
+            continue;
+        int result = write_input(input, flipped, golden_inputs[i].width, golden_inputs[i].height,
+                                 golden_inputs[i].channels, golden_inputs[i].top_down);
+        if (result != SUCCESS) {
+            printf("%s: %s\n", input, bmp_error_message(result));
+            return result;
+        }
+
+        for (size_t c = 0; c < sizeof(golden_chains) / sizeof(golden_chains[0]); c++) {
+            cases++;
+            if (!run_path(program, &reference_path, (int)c, input, reference)) {
+                report_failure(reference_path.name, (int)c, (int)i);
+                failures++;
+                continue;
+            }
+
+            for (size_t p = 0; p < sizeof(golden_paths) / sizeof(golden_paths[0]); p++) {
+                const GOLDEN_PATH *path = &golden_paths[p];
+                if ((path->stream && !golden_chains[c].streamable) || !path_supported(path))
+                    continue;
+                cases++;
+                int stored = cache_entries(0);
+                if (!run_path(program, path, (int)c, input, output) || !same_file(reference, output) ||
+                    (path->cache == GOLDEN_CACHE_MISS && cache_entries(0) != stored + 1)) {
+                    report_failure(path->name, (int)c, (int)i);
+                    failures++;
+                }
+            }
+
+            // The same picture stored the other way up must come out the same
+            cases++;
+            if (!run_path(program, &reference_path, (int)c, flipped, output) || !same_picture(reference, output)) {
+                report_failure("orientation", (int)c, (int)i);
+                failures++;
+            }
+        }
+    }
+
+    remove(input);
+    remove(flipped);
+    remove(reference);
+    remove(output);
+    cache_entries(1);
+    rmdir(cache_dir);
+    printf("%d of %d golden cases passed\n", cases - failures, cases);
+    return failures == 0 ? SUCCESS : ERR_ARGS;
+}